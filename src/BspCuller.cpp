@@ -0,0 +1,269 @@
+#include "BspCuller.h"
+#include <cmath>
+#include <numbers>
+#include <algorithm>
+
+#include "CoordinateTransformer.h"
+#include "helpers.h"
+
+static constexpr double pi = std::numbers::pi;
+static constexpr double clipListMergeEpsilon = 1e-9; //neighbouring walls share their end angles exactly, this only swallows rounding of ranges that should touch
+
+BspCuller::BspCuller(const DoomMap& map)
+{
+	this->map = &map;
+	for (const Sector& sector : map.sectors) this->skyCeilings.push_back(wadStrToStd(sector.ceilingTexture) == "F_SKY1");
+	for (const Subsector& subsector : map.subsectors)
+	{
+		int sector = -1;
+		if (subsector.segCount && subsector.firstSeg < map.segs.size())
+		{
+			const Seg& seg = map.segs[subsector.firstSeg];
+			sector = this->getSidedefSector(seg.linedef, seg.direction);
+		}
+		this->subsectorSectors.push_back(sector);
+	}
+}
+
+bool BspCuller::findVisibleSectors(const Camera& pov, real aspectRatio, real fovMult, std::vector<bool>& visibleSectors)
+{
+	if (this->findCameraSector(pov.pos) < 0) return false;
+	this->viewX = pov.pos.x;
+	this->viewY = pov.pos.z;
+
+	CoordinateTransformer ctr;
+	ctr.prepare(pov.pos, pov.angle);
+	Matrix4 cameraToWorld = ctr.getCurrentInverseTransformationMatrix();
+	auto getWorldDirection = [&](real x, real y) { return cameraToWorld * Vec4(x, y, -1, 1) - pov.pos; };
+	Vec4 forward = getWorldDirection(0, 0);
+	this->viewAngle = std::atan2(double(forward.z), double(forward.x));
+
+	//angles outside the view frustum start out clipped. When it contains straight up or down, every direction is in view
+	this->clipList.clear();
+	real halfHeightPerDistance = 1 / (2 * fovMult);
+	real halfWidthPerDistance = halfHeightPerDistance * aspectRatio;
+	bool verticalInView = false;
+	for (real dir : { real(-1), real(1) })
+	{
+		Vec4 v = ctr.rotateAndTranslate(Vec4(pov.pos.x, pov.pos.y + dir, pov.pos.z, 1));
+		verticalInView |= v.z < 0 && std::abs(v.x) <= -v.z * halfWidthPerDistance && std::abs(v.y) <= -v.z * halfHeightPerDistance;
+	}
+	if (!verticalInView)
+	{
+		double minAngle = 0, maxAngle = 0;
+		for (int corner = 0; corner < 4; ++corner)
+		{
+			Vec4 dir = getWorldDirection(corner & 1 ? halfWidthPerDistance : -halfWidthPerDistance, corner & 2 ? halfHeightPerDistance : -halfHeightPerDistance);
+			double angle = this->getRelativeAngle(pov.pos.x + dir.x, pov.pos.z + dir.z);
+			minAngle = std::min(minAngle, angle);
+			maxAngle = std::max(maxAngle, angle);
+		}
+		if (maxAngle - minAngle < pi)
+		{
+			this->addRangeToClipList(-pi, minAngle - 1e-3);
+			this->addRangeToClipList(maxAngle + 1e-3, pi);
+		}
+	}
+
+	visibleSectors.assign(this->map->sectors.size(), false);
+	this->lastVisitedSubsectorCount = 0;
+	//a map with a single subsector has no nodes
+	this->visitNode(this->map->nodes.empty() ? Node::subsectorFlag : uint16_t(this->map->nodes.size() - 1), visibleSectors);
+	this->lastVisibleSectorCount = std::count(visibleSectors.begin(), visibleSectors.end(), true);
+	return true;
+}
+
+int BspCuller::findCameraSector(const Vec4& pos) const
+{
+	if (!this->map || this->map->subsectors.empty() || this->map->segs.empty()) return -1;
+	int subsector = this->findSubsector(pos.x, pos.z);
+	int sector = this->subsectorSectors[subsector];
+	if (sector < 0 || !this->isInsideSubsector(subsector, pos.x, pos.z)) return -1;
+	const Sector& s = this->map->sectors[sector];
+	if (pos.y <= s.floorHeight || pos.y >= s.ceilingHeight) return -1;
+	return sector;
+}
+
+size_t BspCuller::getLastVisitedSubsectorCount() const
+{
+	return this->lastVisitedSubsectorCount;
+}
+
+size_t BspCuller::getLastVisibleSectorCount() const
+{
+	return this->lastVisibleSectorCount;
+}
+
+int BspCuller::getSidedefSector(int linedef, int side) const
+{
+	const Linedef& l = this->map->linedefs[linedef];
+	int sidedef = side ? l.backSidedef : l.frontSidedef;
+	if (sidedef == -1) return -1;
+	return this->map->sidedefs[sidedef].facingSector;
+}
+
+int BspCuller::findSubsector(double x, double y) const
+{
+	if (this->map->nodes.empty()) return 0;
+	uint16_t child = this->map->nodes.size() - 1;
+	while (!(child & Node::subsectorFlag))
+	{
+		const Node& node = this->map->nodes[child];
+		child = node.children[this->isPointOnFrontSide(x, y, node.x, node.y, node.x + node.dx, node.y + node.dy) ? 0 : 1];
+	}
+	return child & ~Node::subsectorFlag;
+}
+
+bool BspCuller::isInsideSubsector(int subsector, double x, double y) const
+{
+	//subsectors are convex and lie on the front side of all their segs. The BSP also sorts points outside of the level into some subsector, which this catches
+	const Subsector& s = this->map->subsectors[subsector];
+	for (int i = s.firstSeg; i < s.firstSeg + s.segCount; ++i)
+	{
+		const Vertex& v1 = this->map->vertices[this->map->segs[i].startVertex];
+		const Vertex& v2 = this->map->vertices[this->map->segs[i].endVertex];
+		if (!this->isPointOnFrontSide(x, y, v1.x, v1.y, v2.x, v2.y)) return false;
+	}
+	return true;
+}
+
+bool BspCuller::isSolidWall(const Seg& seg) const
+{
+	int frontSector = this->getSidedefSector(seg.linedef, seg.direction);
+	int backSector = this->getSidedefSector(seg.linedef, !seg.direction);
+	if (frontSector < 0) return false;
+	//there's no sky wall, so taller geometry behind can be seen over the wall, like PortalCuller has it for sky neighbours
+	if (this->skyCeilings[frontSector]) return false;
+	if (backSector < 0) return true;
+
+	//closed doors and lifts leave no gap to look through, the same test the original renderer does
+	const Sector& front = this->map->sectors[frontSector];
+	const Sector& back = this->map->sectors[backSector];
+	return back.ceilingHeight <= front.floorHeight || back.floorHeight >= front.ceilingHeight;
+}
+
+bool BspCuller::isPointOnFrontSide(double x, double y, double x1, double y1, double x2, double y2) const
+{
+	//front is to the right of the line
+	return (x2 - x1) * (y - y1) - (y2 - y1) * (x - x1) < 0;
+}
+
+double BspCuller::getRelativeAngle(double x, double y) const
+{
+	double angle = std::atan2(y - this->viewY, x - this->viewX) - this->viewAngle;
+	if (angle > pi) angle -= 2 * pi;
+	if (angle < -pi) angle += 2 * pi;
+	return angle;
+}
+
+void BspCuller::visitNode(uint16_t child, std::vector<bool>& visibleSectors)
+{
+	if (this->isClipListFull()) return;
+	if (child & Node::subsectorFlag)
+	{
+		this->visitSubsector(child & ~Node::subsectorFlag, visibleSectors);
+		return;
+	}
+
+	const Node& node = this->map->nodes[child];
+	int nearSide = this->isPointOnFrontSide(this->viewX, this->viewY, node.x, node.y, node.x + node.dx, node.y + node.dy) ? 0 : 1;
+	for (int side : { nearSide, nearSide ^ 1 })
+	{
+		if (this->isBoundingBoxVisible(node.boundingBoxes[side])) this->visitNode(node.children[side], visibleSectors);
+	}
+}
+
+void BspCuller::visitSubsector(int subsector, std::vector<bool>& visibleSectors)
+{
+	this->lastVisitedSubsectorCount++;
+	if (this->subsectorSectors[subsector] >= 0) visibleSectors[this->subsectorSectors[subsector]] = true;
+
+	const Subsector& s = this->map->subsectors[subsector];
+	for (int i = s.firstSeg; i < s.firstSeg + s.segCount; ++i)
+	{
+		const Seg& seg = this->map->segs[i];
+		const Vertex& v1 = this->map->vertices[seg.startVertex];
+		const Vertex& v2 = this->map->vertices[seg.endVertex];
+		double angle1 = this->getRelativeAngle(v1.x, v1.y);
+		double angle2 = this->getRelativeAngle(v2.x, v2.y);
+		if (!this->isArcVisible(angle1, angle2)) continue;
+
+		//wall pieces of a two sided linedef may belong to the model of either sector
+		for (int side = 0; side < 2; ++side)
+		{
+			int sector = this->getSidedefSector(seg.linedef, side);
+			if (sector >= 0) visibleSectors[sector] = true;
+		}
+		if (this->isSolidWall(seg) && this->isPointOnFrontSide(this->viewX, this->viewY, v1.x, v1.y, v2.x, v2.y)) this->addArcToClipList(angle1, angle2);
+	}
+}
+
+bool BspCuller::isBoundingBoxVisible(const int16_t* boundingBox) const
+{
+	double top = boundingBox[0], bottom = boundingBox[1], left = boundingBox[2], right = boundingBox[3];
+	if (this->viewX >= left && this->viewX <= right && this->viewY >= bottom && this->viewY <= top) return true;
+
+	//seen from outside, the box covers less than half of the circle, so it's angles can be measured from any one corner
+	double reference = this->getRelativeAngle(left, bottom);
+	double minOffset = 0, maxOffset = 0;
+	for (auto [x, y] : { std::pair(right, bottom), std::pair(left, top), std::pair(right, top) })
+	{
+		double offset = this->getRelativeAngle(x, y) - reference;
+		if (offset > pi) offset -= 2 * pi;
+		if (offset < -pi) offset += 2 * pi;
+		minOffset = std::min(minOffset, offset);
+		maxOffset = std::max(maxOffset, offset);
+	}
+	double begin = reference + minOffset, end = reference + maxOffset;
+	if (begin < -pi) return this->isRangeVisible(begin + 2 * pi, pi) || this->isRangeVisible(-pi, end);
+	if (end > pi) return this->isRangeVisible(begin, pi) || this->isRangeVisible(-pi, end - 2 * pi);
+	return this->isRangeVisible(begin, end);
+}
+
+bool BspCuller::isArcVisible(double angle1, double angle2) const
+{
+	double begin = std::min(angle1, angle2), end = std::max(angle1, angle2);
+	if (end - begin <= pi) return this->isRangeVisible(begin, end);
+	return this->isRangeVisible(end, pi) || this->isRangeVisible(-pi, begin); //wraps around behind the camera
+}
+
+bool BspCuller::isRangeVisible(double begin, double end) const
+{
+	for (const AngleRange& it : this->clipList)
+	{
+		if (it.begin <= begin && it.end >= end) return false;
+	}
+	return true;
+}
+
+void BspCuller::addArcToClipList(double angle1, double angle2)
+{
+	double begin = std::min(angle1, angle2), end = std::max(angle1, angle2);
+	if (end - begin <= pi) this->addRangeToClipList(begin, end);
+	else
+	{
+		this->addRangeToClipList(end, pi);
+		this->addRangeToClipList(-pi, begin);
+	}
+}
+
+void BspCuller::addRangeToClipList(double begin, double end)
+{
+	if (begin > end) return;
+	AngleRange merged = { begin, end };
+	auto first = std::find_if(this->clipList.begin(), this->clipList.end(), [&](const AngleRange& it) { return it.end >= begin - clipListMergeEpsilon; });
+	auto last = first;
+	while (last != this->clipList.end() && last->begin <= end + clipListMergeEpsilon)
+	{
+		merged.begin = std::min(merged.begin, last->begin);
+		merged.end = std::max(merged.end, last->end);
+		++last;
+	}
+	first = this->clipList.erase(first, last);
+	this->clipList.insert(first, merged);
+}
+
+bool BspCuller::isClipListFull() const
+{
+	return this->clipList.size() == 1 && this->clipList[0].begin <= -pi && this->clipList[0].end >= pi;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "DoomMap.h"
+#include "Camera.h"
+
+//Walks a Doom map's BSP front to back from the camera, the same way the original renderer does, to find the sectors that may be visible.
+//Walls that block the whole height of the view add the range of view angles they cover to a clip list, and subtrees whose bounding box is already covered are skipped.
+//The clip list is kept over horizontal view angles instead of screen columns, because the camera can pitch, and then vertical walls don't stay vertical on screen.
+//Only valid while the camera is inside the level, between the floor and ceiling of it's sector. Elsewhere walls don't hide what's behind them, and nothing is culled
+class BspCuller
+{
+public:
+	BspCuller() = default;
+	BspCuller(const DoomMap& map); //the map must outlive the culler. Sector heights are read on every call, so moving sectors are fine
+
+	bool findVisibleSectors(const Camera& pov, real aspectRatio, real fovMult, std::vector<bool>& visibleSectors); //false if nothing can be culled from here, visibleSectors is left untouched then
+	int findCameraSector(const Vec4& pos) const; //-1 if the camera is outside the level, or above or below it's sector
+	size_t getLastVisitedSubsectorCount() const;
+	size_t getLastVisibleSectorCount() const;
+private:
+	struct AngleRange
+	{
+		double begin, end; //relative to the view direction, in [-pi, pi]
+	};
+
+	const DoomMap* map = nullptr;
+	std::vector<int> subsectorSectors;
+	std::vector<bool> skyCeilings;
+	std::vector<AngleRange> clipList; //sorted and disjoint
+	double viewX = 0, viewY = 0, viewAngle = 0; //in map coordinates
+	size_t lastVisitedSubsectorCount = 0, lastVisibleSectorCount = 0;
+
+	int getSidedefSector(int linedef, int side) const; //-1 if the linedef has no sidedef on that side
+	int findSubsector(double x, double y) const;
+	bool isInsideSubsector(int subsector, double x, double y) const;
+	bool isSolidWall(const Seg& seg) const; //walls under a sky ceiling never are, the renderer draws nothing above them
+	bool isPointOnFrontSide(double x, double y, double x1, double y1, double x2, double y2) const;
+
+	double getRelativeAngle(double x, double y) const;
+	void visitNode(uint16_t child, std::vector<bool>& visibleSectors);
+	void visitSubsector(int subsector, std::vector<bool>& visibleSectors);
+	bool isBoundingBoxVisible(const int16_t* boundingBox) const;
+	bool isArcVisible(double angle1, double angle2) const; //the shorter arc between both angles
+	bool isRangeVisible(double begin, double end) const;
+	void addArcToClipList(double angle1, double angle2);
+	void addRangeToClipList(double begin, double end);
+	bool isClipListFull() const;
+};
@@ -0,0 +1,119 @@
+#include "CascadedShadowMap.h"
+#include "CoordinateTransformer.h"
+#include "Threadpool.h"
+
+//returns world space directions of the camera's screen x and y axes and of the direction it looks at
+static void getCameraAxes(const Vec4& angle, Vec4& right, Vec4& up, Vec4& forward)
+{
+	CoordinateTransformer ctr(1, 1);
+	ctr.prepare(Vec4(0, 0, 0), angle);
+	//the view transformation is a pure rotation here, so it's transpose (the inverse) is made of the rotated basis vectors' components
+	Vec4 ex = ctr.rotateAndTranslate(Vec4(1, 0, 0, 0));
+	Vec4 ey = ctr.rotateAndTranslate(Vec4(0, 1, 0, 0));
+	Vec4 ez = ctr.rotateAndTranslate(Vec4(0, 0, 1, 0));
+	right = Vec4(ex.x, ey.x, ez.x, 0);
+	up = Vec4(ex.y, ey.y, ez.y, 0);
+	forward = Vec4(-ex.z, -ey.z, -ez.z, 0); //cameras look towards negative z
+}
+
+CascadedShadowMap::CascadedShadowMap(const Camera& sunPov, int cascadeCount, int resolution, real maxShadowDistance, real sunDistance)
+{
+	this->sunPov = sunPov;
+	this->resolution = resolution;
+	this->sunDistance = sunDistance;
+	getCameraAxes(sunPov.angle, this->sunRight, this->sunUp, this->sunForward);
+
+	//split scheme blends logarithmic and uniform splits, the usual compromise between near field density and not wasting the far cascades
+	constexpr real logWeight = 0.75;
+	real nearDistance = 1;
+	for (int i = 0; i <= cascadeCount; ++i)
+	{
+		real t = real(i) / cascadeCount;
+		real logSplit = nearDistance * pow(maxShadowDistance / nearDistance, t);
+		real uniformSplit = nearDistance + (maxShadowDistance - nearDistance) * t;
+		this->splitDistances.push_back(lerp(uniformSplit, logSplit, logWeight));
+	}
+
+	for (int i = 0; i < cascadeCount; ++i) this->cascades.emplace_back(resolution, resolution, sunPov, DepthFormat::FLOAT32); //each cascade has it's own depth range, which makes integer formats much harder to fit
+	this->cascadeRendered.resize(cascadeCount, false);
+}
+
+void CascadedShadowMap::update(const std::vector<Model>& models, const Camera& viewer, real viewerAspectRatio, const GameSettings& gameSettings, Threadpool& threadpool, uint64_t frameNumber)
+{
+	std::vector<ShadowMap*> cascadesToRender;
+	for (size_t i = 0; i < this->cascades.size(); ++i)
+	{
+		if (this->cascadeRendered[i] && frameNumber % refitInterval != i % refitInterval) continue;
+
+		real fovMult, sunDistance;
+		Camera pov = this->fitCascade(i, viewer, viewerAspectRatio, gameSettings.fovMult, &fovMult, &sunDistance);
+		this->cascades[i].setPov(pov, fovMult);
+
+		//bias is specified in world units proportional to the texel size, then converted to zInv units at the cascade's distance
+		real texelWorldSize = (sunDistance / fovMult) / this->resolution;
+		real worldBias = 1.5 * texelWorldSize + 0.5;
+		this->cascades[i].depthBias = worldBias * fovMult / (sunDistance * sunDistance);
+
+		cascadesToRender.push_back(&this->cascades[i]);
+		this->cascadeRendered[i] = true;
+	}
+	if (!cascadesToRender.empty()) ShadowMap::renderBatch(cascadesToRender, models, gameSettings, threadpool, this->shadowMapRenderer);
+}
+
+void CascadedShadowMap::invalidate()
+{
+	std::fill(this->cascadeRendered.begin(), this->cascadeRendered.end(), false);
+}
+
+const std::vector<ShadowMap>& CascadedShadowMap::getCascades() const
+{
+	return this->cascades;
+}
+
+real CascadedShadowMap::getCascadeFarDistance(size_t cascadeIndex) const
+{
+	return this->splitDistances[cascadeIndex + 1];
+}
+
+size_t CascadedShadowMap::getMemoryUsage() const
+{
+	size_t ret = 0;
+	for (const auto& it : this->cascades) ret += it.depthBuffer.getStorage().size();
+	return ret;
+}
+
+Camera CascadedShadowMap::fitCascade(size_t cascadeIndex, const Camera& viewer, real viewerAspectRatio, real viewerFovMult, real* fovMultOut, real* sunDistanceOut) const
+{
+	real nearDist = this->splitDistances[cascadeIndex];
+	real farDist = this->splitDistances[cascadeIndex + 1];
+
+	//bounding sphere of the frustum slice. It only depends on the slice and FOV, not on the viewer's orientation, so the cascade's texel size stays constant while looking around
+	real halfDiagonalPerDistance = sqrt(pow(viewerAspectRatio / (2 * viewerFovMult), 2) + pow(1 / (2 * viewerFovMult), 2));
+	real nearRadius = nearDist * halfDiagonalPerDistance;
+	real farRadius = farDist * halfDiagonalPerDistance;
+	real centerDist = std::clamp<real>((farDist * farDist + farRadius * farRadius - nearDist * nearDist - nearRadius * nearRadius) / (2 * (farDist - nearDist)), nearDist, farDist);
+	real radius = sqrt(pow(farDist - centerDist, 2) + farRadius * farRadius);
+
+	Vec4 viewerRight, viewerUp, viewerForward;
+	getCameraAxes(viewer.angle, viewerRight, viewerUp, viewerForward);
+	Vec4 center = viewer.pos + viewerForward * centerDist;
+	center.w = 0;
+
+	//move the cascade only in whole texel steps across the sun's view, else shadow edges shimmer whenever the viewer moves
+	real texelWorldSize = 2 * radius / this->resolution;
+	real r = floor(center.dot(this->sunRight) / texelWorldSize) * texelWorldSize;
+	real u = floor(center.dot(this->sunUp) / texelWorldSize) * texelWorldSize;
+	real f = center.dot(this->sunForward);
+	Vec4 snappedCenter = this->sunRight * r + this->sunUp * u + this->sunForward * f;
+
+	//with a wide FOV or a long shadow distance the far cascades get big enough to reach past the sun, which would put casters behind it
+	real sunDistance = std::max(this->sunDistance, radius + minSunClearance);
+	Camera ret;
+	ret.angle = this->sunPov.angle;
+	ret.pos = snappedCenter - this->sunForward * sunDistance;
+	ret.pos.w = 0;
+
+	*fovMultOut = (sunDistance - radius) / (2 * radius); //the side of the sphere closest to the sun must still fit into the map
+	*sunDistanceOut = sunDistance;
+	return ret;
+}
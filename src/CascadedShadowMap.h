@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+
+#include "ShadowMap.h"
+#include "Renderers/ShadowMapRenderer.h"
+#include "Camera.h"
+#include "misc/GameSettings.h"
+
+class Threadpool;
+
+//A set of modest resolution shadow maps, each fitted to a depth slice of the viewer's frustum. All cascades look along the same sun direction,
+//taken from the sun's point of view camera, and are placed far away along it, so their perspective projection is close to orthographic.
+class CascadedShadowMap
+{
+public:
+	static constexpr int refitInterval = 2; //cascade i is refit on frames where frameNumber % refitInterval == i % refitInterval
+	static constexpr real minSunClearance = 1000; //cascades too big for sunDistance move their sun out, so it stays at least this far from the side of the cascade facing it
+
+	CascadedShadowMap() = default;
+	CascadedShadowMap(const Camera& sunPov, int cascadeCount = 4, int resolution = 2048, real maxShadowDistance = 3000, real sunDistance = 8000);
+
+	void update(const std::vector<Model>& models, const Camera& viewer, real viewerAspectRatio, const GameSettings& gameSettings, Threadpool& threadpool, uint64_t frameNumber);
+	void invalidate(); //makes all cascades refit on the next update, e.g. after the level geometry changed
+
+	const std::vector<ShadowMap>& getCascades() const;
+	real getCascadeFarDistance(size_t cascadeIndex) const; //distance from the viewer along it's view direction, where the cascade stops covering the frustum
+	size_t getMemoryUsage() const;
+private:
+	Camera sunPov;
+	Vec4 sunRight, sunUp, sunForward;
+	int resolution = 0;
+	real sunDistance = 0;
+
+	std::vector<ShadowMap> cascades;
+	std::vector<real> splitDistances; //cascadeCount+1 values, from the near plane to maxShadowDistance
+	std::vector<bool> cascadeRendered;
+	ShadowMapRenderer shadowMapRenderer;
+
+	Camera fitCascade(size_t cascadeIndex, const Camera& viewer, real viewerAspectRatio, real viewerFovMult, real* fovMultOut, real* sunDistanceOut) const;
+};
@@ -18,7 +18,7 @@ void CoordinateTransformer::prepare(const Vec4 camPos, const Vec4 camAng)
 	translation[3][3] = 1;
 
 	this->rotationTranslation = (rotation * translation).transposed();
-	//this->inverseRotationTranslation = rotationTranslation.inverse();
+	this->inverseRotationTranslation = (rotation * translation).inverse();
 	//this->translationRotation = translation * rotation;
 }
 
@@ -57,6 +57,11 @@ Vec4 CoordinateTransformer::shift(const Vec4 v) const
 	return v + this->_shift;
 }
 
+VectorPack16 CoordinateTransformer::pixelsToScreenSpace16(const VectorPack16& px) const
+{
+	return px / hVec - _shift;
+}
+
 VectorPack16 CoordinateTransformer::pixelsToWorld16(const VectorPack16& px) const
 {
 	FloatPack16 z = FloatPack16(-1) / px.z;
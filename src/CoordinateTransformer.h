@@ -15,6 +15,7 @@ public:
 	Vec4 rotateAndTranslate(Vec4 v) const;
 	Vec4 shift(const Vec4 v) const;
 
+	VectorPack16 pixelsToScreenSpace16(const VectorPack16& px) const; //inverse of screenSpaceToPixels
 	VectorPack16 pixelsToWorld16(const VectorPack16& px) const;
 
 	Matrix4 getCurrentTransformationMatrix() const;
@@ -0,0 +1,152 @@
+#include "DitherTable.h"
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+const DitherTable& DitherTable::getBlueNoise()
+{
+	static const DitherTable table(generateVoidAndClusterRanks()); //generated on first use, takes a few dozen milliseconds
+	return table;
+}
+
+const DitherTable& DitherTable::getOrdered()
+{
+	static const DitherTable table(generateBayerRanks());
+	return table;
+}
+
+FloatPack16 DitherTable::getThresholds16(size_t x, size_t y, int channel, uint32_t frameNumber) const
+{
+	//offsets follow the R2 low discrepancy sequence in 32 bit fixed point, so consecutive frames and channels land far apart from each other
+	uint32_t n = frameNumber * 4 + channel;
+	uint32_t offsetX = (n * 3242174889u) >> 26;
+	uint32_t offsetY = (n * 2447445413u) >> 26;
+	static_assert(size == 1 << (32 - 26));
+
+	size_t row = (y + offsetY) & (size - 1);
+	size_t column = (x + offsetX) & (size - 1);
+	return _mm512_loadu_ps(&this->thresholds[row * paddedW + column]);
+}
+
+DitherTable::DitherTable(const std::vector<uint32_t>& ranks)
+{
+	assert(ranks.size() == size * size);
+	this->thresholds.resize(paddedW * size);
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < paddedW; ++x)
+		{
+			this->thresholds[y * paddedW + x] = (ranks[y * size + (x & (size - 1))] + 0.5f) / (size * size);
+		}
+	}
+}
+
+std::vector<uint32_t> DitherTable::generateVoidAndClusterRanks()
+{
+	//Ulichney's void-and-cluster method on a torus, so the result tiles seamlessly
+	constexpr int pixelCount = size * size;
+	constexpr float sigma = 1.5;
+
+	std::vector<float> gaussian(pixelCount); //energy contribution of a pixel at offset (x,y), with wraparound
+	for (int y = 0; y < size; ++y)
+	{
+		for (int x = 0; x < size; ++x)
+		{
+			int dx = std::min(x, size - x);
+			int dy = std::min(y, size - y);
+			gaussian[y * size + x] = expf(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+		}
+	}
+
+	std::vector<uint8_t> pattern(pixelCount, 0);
+	std::vector<float> energy(pixelCount, 0);
+	auto togglePixel = [&](int index) {
+		pattern[index] ^= 1;
+		float sign = pattern[index] ? 1 : -1;
+		int px = index % size, py = index / size;
+		for (int y = 0; y < size; ++y)
+		{
+			const float* gaussianRow = &gaussian[((y - py) & (size - 1)) * size];
+			for (int x = 0; x < size; ++x) energy[y * size + x] += sign * gaussianRow[(x - px) & (size - 1)];
+		}
+	};
+	auto findTightestCluster = [&]() {
+		int best = -1;
+		for (int i = 0; i < pixelCount; ++i) if (pattern[i] && (best == -1 || energy[i] > energy[best])) best = i;
+		return best;
+	};
+	auto findLargestVoid = [&]() {
+		int best = -1;
+		for (int i = 0; i < pixelCount; ++i) if (!pattern[i] && (best == -1 || energy[i] < energy[best])) best = i;
+		return best;
+	};
+
+	//initial pattern is random (with a fixed seed, so the table is the same on every run), then relaxed until it's evenly distributed
+	uint32_t seed = 12345;
+	int initialOnes = pixelCount / 10;
+	for (int placed = 0; placed < initialOnes;)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		int index = (seed >> 8) % pixelCount;
+		if (pattern[index]) continue;
+		togglePixel(index);
+		++placed;
+	}
+	while (true)
+	{
+		int cluster = findTightestCluster();
+		togglePixel(cluster);
+		int largestVoid = findLargestVoid();
+		if (largestVoid == cluster)
+		{
+			togglePixel(cluster);
+			break;
+		}
+		togglePixel(largestVoid);
+	}
+
+	std::vector<uint32_t> ranks(pixelCount);
+	std::vector<uint8_t> prototype = pattern;
+	std::vector<float> prototypeEnergy = energy;
+
+	//ranks below the prototype's are assigned by removing clusters, ranks above - by filling voids
+	for (int rank = initialOnes - 1; rank >= 0; --rank)
+	{
+		int cluster = findTightestCluster();
+		togglePixel(cluster);
+		ranks[cluster] = rank;
+	}
+	pattern = prototype;
+	energy = prototypeEnergy;
+	for (int rank = initialOnes; rank < pixelCount; ++rank)
+	{
+		int largestVoid = findLargestVoid();
+		togglePixel(largestVoid);
+		ranks[largestVoid] = rank;
+	}
+
+	return ranks;
+}
+
+std::vector<uint32_t> DitherTable::generateBayerRanks()
+{
+	constexpr int bits = 6;
+	static_assert(size == 1 << bits);
+
+	std::vector<uint32_t> ranks(size * size);
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			uint32_t rank = 0;
+			for (int i = 0; i < bits; ++i)
+			{
+				int shift = 2 * (bits - 1 - i);
+				rank |= (((x ^ y) >> i) & 1) << (shift + 1);
+				rank |= ((y >> i) & 1) << shift;
+			}
+			ranks[y * size + x] = rank;
+		}
+	}
+	return ranks;
+}
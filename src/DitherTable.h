@@ -0,0 +1,25 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "FloatPack16.h"
+
+//Tileable threshold texture for dithering. Thresholds are in [0;1) range, and a channel value gets rounded up if it's fractional part is larger than the threshold.
+//Rows are padded with a copy of their first 16 elements, so that 16 consecutive thresholds can be read with a single unaligned load at any column.
+class DitherTable
+{
+public:
+	static constexpr int size = 64; //must be a power of 2
+
+	static const DitherTable& getBlueNoise();
+	static const DitherTable& getOrdered();
+
+	FloatPack16 getThresholds16(size_t x, size_t y, int channel, uint32_t frameNumber) const; //returns thresholds for pixels x..x+15 of row y. The table is shifted every frame and for every channel
+private:
+	static constexpr int paddedW = size + 16;
+	std::vector<float> thresholds;
+
+	DitherTable(const std::vector<uint32_t>& ranks); //ranks must be a permutation of 0..size*size-1
+	static std::vector<uint32_t> generateVoidAndClusterRanks();
+	static std::vector<uint32_t> generateBayerRanks();
+};
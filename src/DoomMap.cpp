@@ -1,17 +1,29 @@
 #include "DoomMap.h"
 #include "DoomWorldLoader.h"
+#include "Threadpool.h"
+#include "DynamicSectors.h"
 
-#include <functional>
-std::vector<std::vector<Model>> DoomMap::getMapGeometryModels(TextureManager& tm)
+std::vector<SectorGeometry> DoomMap::getMapGeometryModels(TextureManager& tm, Threadpool& threadpool)
 {
-    auto models = DoomWorldLoader::loadMapSectorsAsModels(linedefs, vertices, sidedefs, sectors, tm);
-    std::function modelIsEmpty = [&](const Model& m) {return m.getTriangleCount() == 0; };
+    auto models = DoomWorldLoader::loadMapSectorsAsModels(linedefs, vertices, sidedefs, sectors, DynamicSectors::findMovableSectors(*this), tm, threadpool);
 
-    for (auto& sectorModels : models)
+    //a sector has a single light level, so merging stays within it and sector culling keeps working on whole models
+    size_t threadCount = threadpool.getThreadCount();
+    std::vector<task_id> mergeTasks;
+    for (size_t tNum = 0; tNum < threadCount; ++tNum)
     {
-        auto it = std::remove_if(sectorModels.begin(), sectorModels.end(), modelIsEmpty);
-        sectorModels.resize(it - sectorModels.begin());
+        mergeTasks.push_back(threadpool.addTask([&, tNum]() {
+            for (size_t i = tNum; i < models.size(); i += threadCount) models[i] = DoomWorldLoader::mergeModelsByMaterial(models[i], tm);
+        }));
     }
+    threadpool.waitForMultipleTasks(mergeTasks);
 
     return models;
 }
+
+bool DoomMap::canSectorSeeSector(int fromSector, int toSector) const
+{
+    if (reject.empty()) return true;
+    size_t bit = size_t(fromSector) * sectors.size() + toSector;
+    return !(reject[bit >> 3] & (1 << (bit & 7)));
+}
@@ -1,18 +1,29 @@
 #pragma once
 #include <vector>
+#include <span>
 
 #include "DoomStructs.h"
 #include "Triangle.h"
 #include "Model.h"
+#include "SectorGeometry.h"
 
+class Threadpool;
+
+//The lumps point into the WadLoader's mapping of the WAD, so a map must not outlive the loader it came from
 class DoomMap
 {
 public:
 	DoomMap() = default;
-	std::vector<Vertex> vertices;
-	std::vector<Linedef> linedefs;
-	std::vector<Sidedef> sidedefs;
-	std::vector<Sector> sectors;
+	std::span<const Vertex> vertices;
+	std::span<const Linedef> linedefs;
+	std::span<const Sidedef> sidedefs;
+	std::vector<Sector> sectors; //copied, since moving sectors changes their heights
+	std::span<const Seg> segs;
+	std::span<const Subsector> subsectors;
+	std::span<const Node> nodes;
+	std::span<const uint8_t> reject; //sector to sector visibility bits, empty when the WAD has none or it's all zero
+
+	bool canSectorSeeSector(int fromSector, int toSector) const; //from the REJECT lump, so true whenever it's missing
 
-	std::vector<std::vector<Model>> getMapGeometryModels(TextureManager& tm);
+	std::vector<SectorGeometry> getMapGeometryModels(TextureManager& tm, Threadpool& threadpool); //models per sector, built on all workers
 };
\ No newline at end of file
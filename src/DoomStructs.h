@@ -38,4 +38,29 @@ struct Sector
 	int16_t specialType;
 	int16_t tagNumber;
 };
+
+//BSP lumps. Indices are unsigned, since node builders use the whole 16 bits on big maps
+struct Seg
+{
+	uint16_t startVertex;
+	uint16_t endVertex;
+	int16_t angle;
+	uint16_t linedef;
+	int16_t direction; //0 if the seg runs along the linedef's front side, 1 if along it's back side
+	int16_t offset;
+};
+
+struct Subsector
+{
+	uint16_t segCount;
+	uint16_t firstSeg;
+};
+
+struct Node
+{
+	int16_t x, y, dx, dy; //partition line
+	int16_t boundingBoxes[2][4]; //right child's, then left child's. Top, bottom, left, right
+	uint16_t children[2]; //right child, then left child. Subsector indices have subsectorFlag set
+	static constexpr uint16_t subsectorFlag = 0x8000;
+};
 #pragma pack(pop)
\ No newline at end of file
@@ -3,19 +3,25 @@
 #include "TextureManager.h"
 #include "helpers.h"
 #include "PolygonTriangulator.h"
+#include "Threadpool.h"
 
 #include <iostream>
-
-std::vector<std::vector<Model>> DoomWorldLoader::loadMapSectorsAsModels(
-	const std::vector<Linedef>& linedefs,
-	const std::vector<Vertex>& vertices,
-	const std::vector<Sidedef>& sidedefs,
+#include <map>
+#include <tuple>
+#include <limits>
+
+std::vector<SectorGeometry> DoomWorldLoader::loadMapSectorsAsModels(
+	std::span<const Linedef> linedefs,
+	std::span<const Vertex> vertices,
+	std::span<const Sidedef> sidedefs,
 	const std::vector<Sector>& sectors,
-	TextureManager& textureManager
+	const std::vector<bool>& movableSectors,
+	TextureManager& textureManager,
+	Threadpool& threadpool
 )
 {
-	std::vector<std::vector<Model>> sectorModels(sectors.size());
 	std::vector<std::vector<Linedef>> sectorLinedefs(sectors.size());
+	std::vector<WallPiece> wallPieces;
 
 	for (const auto& linedef : linedefs)
 	{
@@ -62,20 +68,15 @@ std::vector<std::vector<Model>> DoomWorldLoader::loadMapSectorsAsModels(
 		}
 
 		std::sort(linedefSectors.begin(), linedefSectors.end(), [](const SectorInfo& si1, const SectorInfo& si2) {return si1.floorHeight < si2.floorHeight; });
+		//heights are kept as the lower or higher of both sectors' floors or ceilings, so pieces stay between the right planes when a sector moves
+		int32_t sideSectors[2] = { linedefSectors[0].sectorNumber, linedefSectors.back().sectorNumber };
+		auto heightSource = [&](bool isCeiling, bool takesHigher) { return SectorHeightSource{ { sideSectors[0], sideSectors[1] }, isCeiling, takesHigher }; };
+		bool nextToMovableSector = movableSectors[sideSectors[0]] || movableSectors[sideSectors[1]]; //like the walls of a closed door, which only get a height once it opens
+
 		//middle section of the wall is a section between higher floor and lower ceiling
 		{
-			int higherFloor = linedefSectors[0].floorHeight;
-			int lowerCeiling = linedefSectors[0].ceilingHeight;
-			if (linedefSectors.size() > 1)
-			{
-				higherFloor = std::max(higherFloor, linedefSectors[1].floorHeight);
-				lowerCeiling = std::min(lowerCeiling, linedefSectors[1].ceilingHeight);
-			}
-	
 			const auto& si = linedefSectors[0];
-			auto model = getTrianglesForSectorWallQuads(higherFloor, lowerCeiling, linedef3dVerts, si, si.middleTexture, textureManager);
-			auto& target = sectorModels[si.sectorNumber];
-			target.push_back(model);
+			addWallPiece(wallPieces, heightSource(false, true), heightSource(true, false), sectors, nextToMovableSector, linedef3dVerts, si, si.middleTexture, si.sectorNumber, false);
 		}
 
 		if (linedefSectors.size() > 1)
@@ -83,10 +84,11 @@ std::vector<std::vector<Model>> DoomWorldLoader::loadMapSectorsAsModels(
 			{	//lower sections
 				SectorInfo low = linedefSectors[0];
 				SectorInfo high = linedefSectors[1];
+				//flush floors keep the sidedef order, but a movable sector is the side that ends up lower, like a lift resting at the top
+				if (low.floorHeight == high.floorHeight && movableSectors[high.sectorNumber] && !movableSectors[low.sectorNumber]) std::swap(low, high);
 
-				auto model = getTrianglesForSectorWallQuads(low.floorHeight, high.floorHeight, linedef3dVerts, high, low.lowerTexture, textureManager);
-				auto& target = sectorModels[low.sectorNumber]; //TODO: think about which sector to assign this triangles to
-				target.push_back(model);
+				bool swapVertexOrder = low.sidedefNumber == linedef.backSidedef; //unswapped quads face the front side, the piece is seen from the lower sector
+				addWallPiece(wallPieces, heightSource(false, false), heightSource(false, true), sectors, nextToMovableSector, linedef3dVerts, high, low.lowerTexture, low.sectorNumber, swapVertexOrder); //TODO: think about which sector to assign this triangles to
 			}
 
 			auto preSortLinedefSectors = linedefSectors;
@@ -95,47 +97,137 @@ std::vector<std::vector<Model>> DoomWorldLoader::loadMapSectorsAsModels(
 				SectorInfo low = linedefSectors[0];
 				SectorInfo high = linedefSectors[1];
 
-				auto model = getTrianglesForSectorWallQuads(low.ceilingHeight, high.ceilingHeight, linedef3dVerts, high, high.upperTexture, textureManager);
-				if (preSortLinedefSectors[0].sectorNumber == linedefSectors[0].sectorNumber) model.swapVertexOrder();
-				auto& target = sectorModels[high.sectorNumber]; //TODO: think about which sector to assign this triangles to
-				target.push_back(model);
+				bool swapVertexOrder = preSortLinedefSectors[0].sectorNumber == linedefSectors[0].sectorNumber;
+				addWallPiece(wallPieces, heightSource(true, false), heightSource(true, true), sectors, nextToMovableSector, linedef3dVerts, high, high.upperTexture, high.sectorNumber, swapVertexOrder); //TODO: think about which sector to assign this triangles to
 			}
 		}
 	}
 
+	//textures get their indices in the same order as in a serial build, so the result doesn't depend on the thread count. The manager loads them one at a time anyway
+	for (auto& it : wallPieces) it.textureIndex = textureManager.getTextureIndexByName(it.textureName);
+
+	size_t threadCount = threadpool.getThreadCount();
+	std::vector<Model> wallModels(wallPieces.size());
+	std::vector<std::vector<VertexHeightBinding>> wallHeightBindings(wallPieces.size());
+	std::vector<IndexedTriangles> sectorPolygons(sectors.size());
+	std::vector<task_id> buildTasks;
+	for (size_t tNum = 0; tNum < threadCount; ++tNum)
+	{
+		buildTasks.push_back(threadpool.addTask([&, tNum]() {
+			std::vector<Line> polygonLines;
+			PolygonTriangulator::Arena arena;
+			for (size_t i = tNum; i < wallPieces.size(); i += threadCount) wallModels[i] = getTrianglesForSectorWallQuads(wallPieces[i], textureManager, wallHeightBindings[i]);
+			for (size_t i = tNum; i < sectors.size(); i += threadCount) triangulateSector(sectorLinedefs[i], vertices, polygonLines, arena, sectorPolygons[i]);
+		}));
+	}
+	threadpool.waitForMultipleTasks(buildTasks);
+
+	//sectors the triangulator failed on never load their flats
+	std::vector<std::array<int, 2>> flatTextureIndices(sectors.size(), { -1, -1 });
 	for (int nSector = 0; nSector < sectors.size(); ++nSector)
 	{
-		auto triangulation = triangulateFloorsAndCeilingsForSector(sectors[nSector], sectorLinedefs[nSector], vertices, textureManager);
-		auto& target = sectorModels[nSector];
-		target.insert(target.end(), triangulation.begin(), triangulation.end());
+		if (sectorPolygons[nSector].indices.empty()) continue;
+		flatTextureIndices[nSector][0] = textureManager.getTextureIndexByName(wadStrToStd(sectors[nSector].floorTexture));
+		flatTextureIndices[nSector][1] = textureManager.getTextureIndexByName(wadStrToStd(sectors[nSector].ceilingTexture));
+	}
 
-		size_t sum = 0;
-		for (auto& it : triangulation) sum += it.getTriangleCount();
-		//std::cout << "Sector " << nSector << " got split into " << sum << " triangles.\n";
+	std::vector<SectorGeometry> sectorModels(sectors.size());
+	for (size_t i = 0; i < wallPieces.size(); ++i)
+	{
+		sectorModels[wallPieces[i].sectorNumber].models.push_back(std::move(wallModels[i]));
+		sectorModels[wallPieces[i].sectorNumber].heightBindings.push_back(std::move(wallHeightBindings[i]));
 	}
+	buildTasks.clear();
+	for (size_t tNum = 0; tNum < threadCount; ++tNum)
+	{
+		buildTasks.push_back(threadpool.addTask([&, tNum]() {
+			for (size_t nSector = tNum; nSector < sectors.size(); nSector += threadCount)
+			{
+				if (sectorPolygons[nSector].indices.empty()) continue;
+				auto& target = sectorModels[nSector];
+				auto flats = getFloorAndCeilingForSector(sectors[nSector], nSector, sectorPolygons[nSector], flatTextureIndices[nSector][0], flatTextureIndices[nSector][1], textureManager, target.heightBindings);
+				target.models.insert(target.models.end(), flats.begin(), flats.end());
+			}
+		}));
+	}
+	threadpool.waitForMultipleTasks(buildTasks);
 
 	return sectorModels;
 }
 
-Model DoomWorldLoader::getTrianglesForSectorWallQuads(real bottomHeight, real topHeight, const std::array<Vec4, 6>& quadVerts, const SectorInfo& sectorInfo, const std::string& textureName, TextureManager& textureManager)
+void DoomWorldLoader::addWallPiece(std::vector<WallPiece>& wallPieces, const SectorHeightSource& bottomSource, const SectorHeightSource& topSource, const std::vector<Sector>& sectors, bool keepIfFlat, const std::array<Vec4, 6>& quadVerts, const SectorInfo& sectorInfo, const std::string& textureName, int sectorNumber, bool swapVertexOrder)
 {
-	Model ret;
-	if (textureName.empty() || textureName == "-" || bottomHeight == topHeight) return ret; //nonsensical arrangement or undefined texture
+	real bottomHeight = bottomSource.getHeight(sectors);
+	real topHeight = topSource.getHeight(sectors);
+	if (textureName.empty() || textureName == "-" || (bottomHeight == topHeight && !keepIfFlat)) return; //nonsensical arrangement or undefined texture
+
+	WallPiece& piece = wallPieces.emplace_back();
+	bool flipped = bottomHeight > topHeight;
+	piece.bottomHeight = flipped ? topHeight : bottomHeight;
+	piece.topHeight = flipped ? bottomHeight : topHeight;
+	piece.bottomSource = flipped ? topSource : bottomSource;
+	piece.topSource = flipped ? bottomSource : topSource;
+	piece.quadVerts = quadVerts;
+	piece.xTextureOffset = sectorInfo.xTextureOffset;
+	piece.yTextureOffset = sectorInfo.yTextureOffset;
+	piece.textureName = textureName;
+	piece.sectorNumber = sectorNumber;
+	piece.swapVertexOrder = swapVertexOrder;
+}
 
-	Vec4 origin;
-	if (bottomHeight > topHeight) std::swap(bottomHeight, topHeight);
+SectorGeometry DoomWorldLoader::mergeModelsByMaterial(const SectorGeometry& geometry, const TextureManager& textureManager)
+{
+	//models that get drawn the same way can share one triangle list, which saves the renderer a model and a slice per wall piece
+	using MaterialKey = std::tuple<int, real, SurfaceOrientation>;
+	std::map<MaterialKey, size_t> groupIndices;
+	std::vector<std::vector<Triangle>> groupTriangles;
+	std::vector<std::vector<VertexHeightBinding>> groupHeightBindings;
+	std::vector<const Model*> groupFirstModels;
+	for (size_t i = 0; i < geometry.models.size(); ++i)
+	{
+		const Model& model = geometry.models[i];
+		if (!model.getTriangleCount()) continue;
+		MaterialKey key = { model.textureIndex, model.lightMult.value_or(-1), model.orientation };
+		auto [it, inserted] = groupIndices.try_emplace(key, groupTriangles.size());
+		if (inserted)
+		{
+			groupTriangles.emplace_back();
+			groupHeightBindings.emplace_back();
+			groupFirstModels.push_back(&model);
+		}
+		const auto& triangles = model.getTriangles();
+		const auto& heightBindings = geometry.heightBindings[i];
+		groupTriangles[it->second].insert(groupTriangles[it->second].end(), triangles.begin(), triangles.end());
+		groupHeightBindings[it->second].insert(groupHeightBindings[it->second].end(), heightBindings.begin(), heightBindings.end());
+	}
+
+	SectorGeometry ret;
+	for (size_t i = 0; i < groupTriangles.size(); ++i)
+	{
+		Model& merged = ret.models.emplace_back(groupTriangles[i], groupFirstModels[i]->textureIndex, textureManager);
+		merged.lightMult = groupFirstModels[i]->lightMult;
+		merged.orientation = groupFirstModels[i]->orientation;
+		ret.heightBindings.push_back(std::move(groupHeightBindings[i]));
+	}
+	return ret;
+}
 
+Model DoomWorldLoader::getTrianglesForSectorWallQuads(const WallPiece& wallPiece, const TextureManager& textureManager, std::vector<VertexHeightBinding>& heightBindings)
+{
+	Vec4 origin;
 	std::vector<Triangle> triangles;
 	//TODO: add some kind of Z figting prevention for double-sided linedefs
-	int textureIndex = textureManager.getTextureIndexByName(textureName);
-	const Texture& texture = textureManager.getTextureByIndex(textureIndex);
+	const Texture& texture = textureManager.getTextureByIndex(wallPiece.textureIndex);
 	for (int i = 0; i < 2; ++i)
 	{
 		Triangle t;
 		for (int j = 0; j < 3; ++j)
 		{
-			Vec4 cookedVert = quadVerts[i * 3 + j];
-			cookedVert.y = cookedVert.y == 0 ? topHeight : bottomHeight;
+			Vec4 cookedVert = wallPiece.quadVerts[i * 3 + j];
+			bool isTop = cookedVert.y == 0;
+			cookedVert.y = isTop ? wallPiece.topHeight : wallPiece.bottomHeight;
+			//the origin is at the top, so v there is just the texture offset
+			heightBindings.push_back({ isTop ? wallPiece.topSource : wallPiece.bottomSource, wallPiece.topSource, float(real(wallPiece.yTextureOffset) / texture.getH()), 1 });
 			t.tv[j].spaceCoords = cookedVert;
 			if (i * 3 + j == 0) origin = cookedVert; //if this is the first vertice processed, then save it as an origin for following texture coordinate calculation
 
@@ -143,46 +235,62 @@ Model DoomWorldLoader::getTrianglesForSectorWallQuads(real bottomHeight, real to
 			Vec2 uvPrefab;
 			uvPrefab.x = std::max(abs(worldOffset.x), abs(worldOffset.z)) == abs(worldOffset.x) ? worldOffset.x : worldOffset.z;
 			uvPrefab.y = worldOffset.y;
-			Vec2 uv = Vec2(sectorInfo.xTextureOffset, sectorInfo.yTextureOffset) - uvPrefab;
+			Vec2 uv = Vec2(wallPiece.xTextureOffset, wallPiece.yTextureOffset) - uvPrefab;
 			t.tv[j].textureCoords = Vec4(uv.x, uv.y) / Vec4(texture.getW(), texture.getH());
 		}
 		triangles.push_back(t);
 	}
-	return Model(triangles, textureIndex, textureManager);
+	Model model(triangles, wallPiece.textureIndex, textureManager);
+	model.orientation = SurfaceOrientation::VERTICAL;
+	if (wallPiece.swapVertexOrder)
+	{
+		model.swapVertexOrder();
+		for (size_t i = 0; i < heightBindings.size(); i += 3) std::swap(heightBindings[i + 1], heightBindings[i + 2]);
+	}
+	return model;
 }
 
-std::vector<Model> DoomWorldLoader::triangulateFloorsAndCeilingsForSector(const Sector& sector, const std::vector<Linedef>& sectorLinedefs, const std::vector<Vertex>& vertices, TextureManager& textureManager)
+void DoomWorldLoader::triangulateSector(const std::vector<Linedef>& sectorLinedefs, std::span<const Vertex> vertices, std::vector<Line>& polygonLines, PolygonTriangulator::Arena& arena, IndexedTriangles& out)
 {
-	std::vector<Triangle> trisFloor, trisCeiling;
-
-	if (sectorLinedefs.size() < 3) return {};
-	assert(sectorLinedefs.size() >= 3);
+	out.vertices.clear();
+	out.indices.clear();
+	if (sectorLinedefs.size() < 3) return;
 
-	std::vector<Line> polygonLines;
+	polygonLines.clear();
 	for (const auto& ldf : sectorLinedefs)
 	{
 		Vertex sv = vertices[ldf.startVertex];
 		Vertex ev = vertices[ldf.endVertex];
 		polygonLines.push_back({ Ved2(sv.x, sv.y), Ved2(ev.x, ev.y) });
 	}
+	if (PolygonTriangulator::triangulateIndexed(polygonLines, arena, out)) return;
 
-	auto polygonSplit = PolygonTriangulator::triangulate(polygonLines);
-	if (polygonSplit.empty()) return {};
+	//the GLU tessellator copes with more broken sectors, at many times the cost
+	out.vertices = PolygonTriangulator::triangulate(polygonLines);
+	out.indices.resize(out.vertices.size());
+	for (uint32_t i = 0; i < out.indices.size(); ++i) out.indices[i] = i;
+}
 
-	real minX = std::min_element(polygonSplit.begin(), polygonSplit.end(), [](const Ved2& v1, const Ved2& v2) {return v1.x < v2.x; })->x;
-	real minY = std::min_element(polygonSplit.begin(), polygonSplit.end(), [](const Ved2& v1, const Ved2& v2) {return v1.y < v2.y; })->y;
-	Vec2 uvOffset = { minX, minY };
+std::vector<Model> DoomWorldLoader::getFloorAndCeilingForSector(const Sector& sector, int sectorNumber, const IndexedTriangles& polygonSplit, int floorTextureIndex, int ceilingTextureIndex, const TextureManager& textureManager, std::vector<std::vector<VertexHeightBinding>>& heightBindings)
+{
+	std::vector<Triangle> trisFloor, trisCeiling;
 
-	int floorTextureIndex = textureManager.getTextureIndexByName(wadStrToStd(sector.floorTexture));
-	int ceilingTextureIndex = textureManager.getTextureIndexByName(wadStrToStd(sector.ceilingTexture));
+	//only vertices that ended up in triangles count, lines sticking into the sector don't move the texture origin
+	double minX = std::numeric_limits<double>::infinity(), minY = std::numeric_limits<double>::infinity();
+	for (uint32_t index : polygonSplit.indices)
+	{
+		minX = std::min(minX, polygonSplit.vertices[index].x);
+		minY = std::min(minY, polygonSplit.vertices[index].y);
+	}
+	Vec2 uvOffset = { real(minX), real(minY) };
 
-	for (int i = 0; i < polygonSplit.size(); i += 3)
+	for (int i = 0; i < polygonSplit.indices.size(); i += 3)
 	{
 		Triangle t[2];
 		for (int j = 0; j < 6; ++j)
 		{
 			bool isFloor = j < 3;
-			Ved2 _2vert = polygonSplit[i + j % 3];
+			Ved2 _2vert = polygonSplit.vertices[polygonSplit.indices[i + j % 3]];
 			Vec4 vert = Vec4(real(_2vert.x), 0, real(_2vert.y));
 			Vec4 uv = vert - Vec4(uvOffset.x, uvOffset.y);
 			t[j / 3].tv[j % 3].spaceCoords = vert;
@@ -207,5 +315,13 @@ std::vector<Model> DoomWorldLoader::triangulateFloorsAndCeilingsForSector(const
 		if (nf.dot(up) <= 0) std::swap(trisFloor[i].tv[1], trisFloor[i].tv[2]);
 		if (nc.dot(up) > 0) std::swap(trisCeiling[i].tv[1], trisCeiling[i].tv[2]);
 	}
-	return { Model(trisFloor, floorTextureIndex, textureManager), Model(trisCeiling, ceilingTextureIndex, textureManager) };
+	Model floorModel(trisFloor, floorTextureIndex, textureManager), ceilingModel(trisCeiling, ceilingTextureIndex, textureManager);
+	floorModel.orientation = SurfaceOrientation::HORIZONTAL;
+	ceilingModel.orientation = SurfaceOrientation::HORIZONTAL;
+	for (bool isCeiling : { false, true })
+	{
+		SectorHeightSource source = { { sectorNumber, sectorNumber }, isCeiling, false };
+		heightBindings.emplace_back(trisFloor.size() * 3, VertexHeightBinding{ source, source, 0, 0 });
+	}
+	return { floorModel, ceilingModel };
 }
\ No newline at end of file
@@ -1,15 +1,22 @@
 #pragma once
 #include <vector>
+#include <span>
 
 #include "Triangle.h"
 #include "DoomStructs.h"
 #include "TextureManager.h"
 #include "Model.h"
+#include "PolygonTriangulator.h"
+#include "SectorGeometry.h"
+
+class Threadpool;
 
 class DoomWorldLoader
 {
 public:
-	static std::vector<std::vector<Model>> loadMapSectorsAsModels(const std::vector<Linedef>& linedefs, const std::vector<Vertex>& vertices, const std::vector<Sidedef>& sidedefs, const std::vector<Sector>& sectors, TextureManager& textureManager);
+	//walls next to movable sectors are built even while they have no height, so they can grow when the sector moves
+	static std::vector<SectorGeometry> loadMapSectorsAsModels(std::span<const Linedef> linedefs, std::span<const Vertex> vertices, std::span<const Sidedef> sidedefs, const std::vector<Sector>& sectors, const std::vector<bool>& movableSectors, TextureManager& textureManager, Threadpool& threadpool);
+	static SectorGeometry mergeModelsByMaterial(const SectorGeometry& geometry, const TextureManager& textureManager); //one model per texture, light level and orientation, in order of first appearance
 private:
 	struct SectorInfo //info about the sector in relation to linedef being processed. This struct is for internal use
 	{
@@ -18,6 +25,20 @@ private:
 		std::vector<Triangle> triangles;
 	};
 
-	static Model getTrianglesForSectorWallQuads(real bottomHeight, real topHeight, const std::array<Vec4, 6>& quadVerts, const SectorInfo& sectorInfo, const std::string& textureName, TextureManager& textureManager);
-	static std::vector<Model> triangulateFloorsAndCeilingsForSector(const Sector& sector, const std::vector<Linedef>& sectorLinedefs, const std::vector<Vertex>& vertices, TextureManager& textureManager);
+	struct WallPiece //one section of a linedef's wall, gathered serially and built into a model on any thread
+	{
+		real bottomHeight, topHeight;
+		SectorHeightSource bottomSource, topSource;
+		std::array<Vec4, 6> quadVerts;
+		int xTextureOffset, yTextureOffset;
+		std::string textureName;
+		int textureIndex = -1; //resolved after all pieces are gathered
+		int sectorNumber;
+		bool swapVertexOrder;
+	};
+
+	static void addWallPiece(std::vector<WallPiece>& wallPieces, const SectorHeightSource& bottomSource, const SectorHeightSource& topSource, const std::vector<Sector>& sectors, bool keepIfFlat, const std::array<Vec4, 6>& quadVerts, const SectorInfo& sectorInfo, const std::string& textureName, int sectorNumber, bool swapVertexOrder); //skips pieces that wouldn't be visible
+	static Model getTrianglesForSectorWallQuads(const WallPiece& wallPiece, const TextureManager& textureManager, std::vector<VertexHeightBinding>& heightBindings);
+	static void triangulateSector(const std::vector<Linedef>& sectorLinedefs, std::span<const Vertex> vertices, std::vector<Line>& polygonLines, PolygonTriangulator::Arena& arena, IndexedTriangles& out); //polygonLines and arena are scratch of the calling thread. out is empty if the triangulation failed
+	static std::vector<Model> getFloorAndCeilingForSector(const Sector& sector, int sectorNumber, const IndexedTriangles& polygonSplit, int floorTextureIndex, int ceilingTextureIndex, const TextureManager& textureManager, std::vector<std::vector<VertexHeightBinding>>& heightBindings);
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "DynamicSectors.h"
+#include <algorithm>
+#include <limits>
+#include <cassert>
+
+//vanilla Doom line specials that move a door's ceiling or a lift's floor. Manual doors act on the sector behind the line, the rest on tagged sectors
+static constexpr int16_t manualDoorSpecials[] = { 1, 26, 27, 28, 31, 32, 33, 34, 117, 118 };
+static constexpr int16_t taggedDoorSpecials[] = { 2, 3, 4, 16, 29, 42, 46, 50, 61, 63, 75, 76, 86, 90, 103, 105, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116, 133, 134, 135, 136, 137 };
+static constexpr int16_t liftSpecials[] = { 10, 21, 62, 88, 120, 121, 122, 123 };
+
+DynamicSectors::DynamicSectors(const DoomMap& map, std::vector<std::vector<VertexHeightBinding>> sceneModelHeightBindings)
+{
+	this->heightBindings = std::move(sceneModelHeightBindings);
+	this->originalSectors = map.sectors;
+	this->sectorVertices.resize(map.sectors.size());
+	this->sectorModels.resize(map.sectors.size());
+
+	auto moverTypes = findMoverTypes(map);
+	for (uint32_t nModel = 0; nModel < this->heightBindings.size(); ++nModel)
+	{
+		const auto& bindings = this->heightBindings[nModel];
+		for (uint32_t nVertex = 0; nVertex < bindings.size(); ++nVertex)
+		{
+			const VertexHeightBinding& b = bindings[nVertex];
+			int sectors[] = { b.height.sectors[0], b.height.sectors[1], b.textureAnchor.sectors[0], b.textureAnchor.sectors[1] };
+			for (int i = 0; i < 4; ++i)
+			{
+				int nSector = sectors[i];
+				if (moverTypes[nSector] == MoverType::NONE || std::find(sectors, sectors + i, nSector) != sectors + i) continue;
+				this->sectorVertices[nSector].push_back({ nModel, nVertex });
+				auto& models = this->sectorModels[nSector];
+				if (models.empty() || models.back() != nModel) models.push_back(nModel);
+			}
+		}
+	}
+
+	std::vector<int16_t> lowestNeighbourFloors(map.sectors.size(), std::numeric_limits<int16_t>::max());
+	std::vector<int16_t> lowestNeighbourCeilings(map.sectors.size(), std::numeric_limits<int16_t>::max());
+	for (const Linedef& linedef : map.linedefs)
+	{
+		if (linedef.frontSidedef == -1 || linedef.backSidedef == -1) continue;
+		int sides[2] = { map.sidedefs[linedef.frontSidedef].facingSector, map.sidedefs[linedef.backSidedef].facingSector };
+		for (int i = 0; i < 2; ++i)
+		{
+			const Sector& other = map.sectors[sides[1 - i]];
+			lowestNeighbourFloors[sides[i]] = std::min(lowestNeighbourFloors[sides[i]], other.floorHeight);
+			lowestNeighbourCeilings[sides[i]] = std::min(lowestNeighbourCeilings[sides[i]], other.ceilingHeight);
+		}
+	}
+
+	for (int nSector = 0; nSector < map.sectors.size(); ++nSector)
+	{
+		const Sector& sector = map.sectors[nSector];
+		Mover mover;
+		mover.sector = nSector;
+		mover.floorHeight = sector.floorHeight;
+		mover.ceilingHeight = sector.ceilingHeight;
+		if (moverTypes[nSector] == MoverType::DOOR && lowestNeighbourCeilings[nSector] != std::numeric_limits<int16_t>::max())
+		{
+			mover.movesCeiling = true;
+			mover.low = sector.floorHeight;
+			mover.high = lowestNeighbourCeilings[nSector] - 4; //doors stop a bit short, like in Doom
+			mover.speed = doorSpeed;
+			mover.waitFrames = doorWaitFrames;
+			mover.direction = 1;
+		}
+		else if (moverTypes[nSector] == MoverType::LIFT)
+		{
+			mover.movesCeiling = false;
+			mover.low = std::min(lowestNeighbourFloors[nSector], sector.floorHeight);
+			mover.high = sector.floorHeight;
+			mover.speed = liftSpeed;
+			mover.waitFrames = liftWaitFrames;
+			mover.direction = -1;
+		}
+		else continue;
+		if (mover.low < mover.high) this->movers.push_back(mover);
+	}
+}
+
+std::vector<DynamicSectors::MoverType> DynamicSectors::findMoverTypes(const DoomMap& map)
+{
+	std::vector<MoverType> ret(map.sectors.size(), MoverType::NONE);
+	auto isIn = [](int16_t special, const auto& specials) { return std::find(std::begin(specials), std::end(specials), special) != std::end(specials); };
+	for (const Linedef& linedef : map.linedefs)
+	{
+		if (linedef.specialType == 0) continue;
+		if (isIn(linedef.specialType, manualDoorSpecials))
+		{
+			if (linedef.backSidedef != -1) ret[map.sidedefs[linedef.backSidedef].facingSector] = MoverType::DOOR;
+			continue;
+		}
+
+		MoverType type = isIn(linedef.specialType, taggedDoorSpecials) ? MoverType::DOOR : isIn(linedef.specialType, liftSpecials) ? MoverType::LIFT : MoverType::NONE;
+		if (type == MoverType::NONE || linedef.sectorTag == 0) continue;
+		for (int nSector = 0; nSector < map.sectors.size(); ++nSector)
+		{
+			if (map.sectors[nSector].tagNumber == linedef.sectorTag) ret[nSector] = type;
+		}
+	}
+	return ret;
+}
+
+std::vector<bool> DynamicSectors::findMovableSectors(const DoomMap& map)
+{
+	auto moverTypes = findMoverTypes(map);
+	std::vector<bool> ret(moverTypes.size());
+	for (size_t i = 0; i < moverTypes.size(); ++i) ret[i] = moverTypes[i] != MoverType::NONE;
+	return ret;
+}
+
+std::vector<DynamicSectors::SectorMove> DynamicSectors::advanceMovers()
+{
+	std::vector<SectorMove> ret;
+	this->lastMovedSectorCount = 0;
+	this->lastMovedVertexCount = 0;
+	for (Mover& mover : this->movers)
+	{
+		if (mover.waitLeft > 0)
+		{
+			mover.waitLeft--;
+			continue;
+		}
+
+		int16_t& height = mover.movesCeiling ? mover.ceilingHeight : mover.floorHeight;
+		height = std::clamp<int16_t>(int16_t(height + mover.direction * mover.speed), mover.low, mover.high);
+		if (height == mover.low || height == mover.high)
+		{
+			//turns around after waiting at either end, so the demo keeps going
+			mover.direction = height == mover.low ? 1 : -1;
+			mover.waitLeft = mover.waitFrames;
+		}
+		ret.push_back({ mover.sector, mover.floorHeight, mover.ceilingHeight });
+	}
+	return ret;
+}
+
+const std::vector<uint32_t>& DynamicSectors::getBoundModels(int sector) const
+{
+	return this->sectorModels[sector];
+}
+
+void DynamicSectors::setSectorHeights(DoomMap& map, const SectorMove& move, std::vector<Model>& sceneModels, const TextureManager& textureManager)
+{
+	Sector& sector = map.sectors[move.sector];
+	if (sector.floorHeight == move.floorHeight && sector.ceilingHeight == move.ceilingHeight) return;
+	sector.floorHeight = move.floorHeight;
+	sector.ceilingHeight = move.ceilingHeight;
+
+	for (const BoundVertex& it : this->sectorVertices[move.sector])
+	{
+		Model& model = sceneModels[it.model];
+		TexVertex& tv = model.getTrianglesForUpdate()[it.vertex / 3].tv[it.vertex % 3];
+		const VertexHeightBinding& b = this->heightBindings[it.model][it.vertex];
+		tv.spaceCoords.y = b.height.getHeight(map.sectors);
+		if (b.movesTexture) tv.textureCoords.y = b.textureAnchorV + (b.textureAnchor.getHeight(map.sectors) - tv.spaceCoords.y) / textureManager.getTextureByIndex(model.textureIndex).getH();
+	}
+	for (uint32_t nModel : this->sectorModels[move.sector]) sceneModels[nModel].updateBoundingBox();
+
+	this->lastMovedSectorCount++;
+	this->lastMovedVertexCount += this->sectorVertices[move.sector].size();
+}
+
+void DynamicSectors::restoreHeights(DoomMap& map) const
+{
+	assert(map.sectors.size() == this->originalSectors.size());
+	for (const Mover& mover : this->movers)
+	{
+		map.sectors[mover.sector].floorHeight = this->originalSectors[mover.sector].floorHeight;
+		map.sectors[mover.sector].ceilingHeight = this->originalSectors[mover.sector].ceilingHeight;
+	}
+}
+
+size_t DynamicSectors::getMoverCount() const
+{
+	return this->movers.size();
+}
+
+size_t DynamicSectors::getLastMovedSectorCount() const
+{
+	return this->lastMovedSectorCount;
+}
+
+size_t DynamicSectors::getLastMovedVertexCount() const
+{
+	return this->lastMovedVertexCount;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "DoomMap.h"
+#include "Model.h"
+#include "SectorGeometry.h"
+#include "TextureManager.h"
+
+//Moves doors and lifts without rebuilding the map. Every scene vertex knows which sector heights it follows, so a sector that moves only
+//recomputes the vertices bound to it, which are it's flats and the walls it shares with it's neighbours. Only sectors found by findMovableSectors
+//can move, the walls next to them are the only ones built while they have no height.
+//Walls keep the sidedef texture and vertex order they were built with, so sectors moving past their neighbours' heights aren't handled
+class DynamicSectors
+{
+public:
+	struct SectorMove
+	{
+		int sector;
+		int16_t floorHeight, ceilingHeight;
+	};
+
+	static constexpr int16_t doorSpeed = 2, liftSpeed = 4; //units per frame, Doom's door and lift speeds per tic
+	static constexpr int doorWaitFrames = 150, liftWaitFrames = 105;
+
+	DynamicSectors() = default;
+	DynamicSectors(const DoomMap& map, std::vector<std::vector<VertexHeightBinding>> sceneModelHeightBindings); //bindings of every scene model, the scene must not be reordered after
+
+	static std::vector<bool> findMovableSectors(const DoomMap& map); //sectors of door and lift specials
+
+	std::vector<SectorMove> advanceMovers(); //runs every door and lift one frame further, the sectors aren't moved until setSectorHeights. Starts a new count of moved sectors
+	const std::vector<uint32_t>& getBoundModels(int sector) const; //scene models with vertices following the sector
+	void setSectorHeights(DoomMap& map, const SectorMove& move, std::vector<Model>& sceneModels, const TextureManager& textureManager);
+	void restoreHeights(DoomMap& map) const; //puts every movable sector back where the map had it, without touching the geometry
+
+	size_t getMoverCount() const;
+	size_t getLastMovedSectorCount() const;
+	size_t getLastMovedVertexCount() const;
+private:
+	enum class MoverType
+	{
+		NONE,
+		DOOR, //ceiling rises up to just below the lowest neighbouring ceiling
+		LIFT, //floor lowers down to the lowest neighbouring floor
+	};
+
+	struct Mover
+	{
+		int sector;
+		bool movesCeiling;
+		int16_t floorHeight, ceilingHeight;
+		int16_t low, high, speed;
+		int waitFrames, waitLeft = 0;
+		int direction; //1 up, -1 down
+	};
+
+	struct BoundVertex
+	{
+		uint32_t model, vertex; //vertex counts 3 per triangle
+	};
+
+	std::vector<std::vector<VertexHeightBinding>> heightBindings; //per scene model
+	std::vector<std::vector<BoundVertex>> sectorVertices; //only filled for movable sectors
+	std::vector<std::vector<uint32_t>> sectorModels;
+	std::vector<Sector> originalSectors;
+	std::vector<Mover> movers;
+	size_t lastMovedSectorCount = 0, lastMovedVertexCount = 0;
+
+	static std::vector<MoverType> findMoverTypes(const DoomMap& map);
+};
@@ -7,30 +7,38 @@ FloatColorBuffer::FloatColorBuffer(const FloatColorBuffer& other)
 
 FloatColorBuffer::FloatColorBuffer(int w, int h)
 {
-	int pixelCount = w * h;
-	r = std::make_unique<float[]>(pixelCount);
-	g = std::make_unique<float[]>(pixelCount);
-	b = std::make_unique<float[]>(pixelCount);
-	a = std::make_unique<float[]>(pixelCount);
 	size = FloatColorBufferSize(w, h);
+	storage = LargePageBuffer(getPlaneStride() * 4 * sizeof(float));
+	assignPlanePointers();
 }
 
 void FloatColorBuffer::operator=(const FloatColorBuffer& other)
 {
-	int w = other.getW();
-	int h = other.getH();
-	int pixelCount = w * h;
+	size = other.size;
+	storage = other.storage;
+	assignPlanePointers();
+}
 
-	r = std::make_unique<float[]>(pixelCount);
-	g = std::make_unique<float[]>(pixelCount);
-	b = std::make_unique<float[]>(pixelCount);
-	a = std::make_unique<float[]>(pixelCount);
-	size = FloatColorBufferSize(w, h);
+void FloatColorBuffer::operator=(FloatColorBuffer&& other) noexcept
+{
+	size = other.size;
+	storage = std::move(other.storage);
+	assignPlanePointers();
+	other.assignPlanePointers();
+}
 
-	memcpy(r.get(), other.r.get(), pixelCount * sizeof(float));
-	memcpy(g.get(), other.g.get(), pixelCount * sizeof(float));
-	memcpy(b.get(), other.b.get(), pixelCount * sizeof(float));
-	memcpy(a.get(), other.a.get(), pixelCount * sizeof(float));
+void FloatColorBuffer::assignPlanePointers()
+{
+	size_t stride = getPlaneStride();
+	r = storage.as<float>();
+	g = r ? r + stride : nullptr;
+	b = r ? g + stride : nullptr;
+	a = r ? b + stride : nullptr;
+}
+
+size_t FloatColorBuffer::getPlaneStride() const
+{
+	return (size_t(size.w) * size.h + 15) / 16 * 16; //keep every plane 64 byte aligned
 }
 
 VectorPack8 FloatColorBuffer::gatherPixels8(const __m256i& xCoords, const __m256i& yCoords, const __mmask8& mask) const
@@ -39,10 +47,10 @@ VectorPack8 FloatColorBuffer::gatherPixels8(const __m256i& xCoords, const __m256
 	__m256i rowStart = _mm256_mullo_epi32(yCoords, _mm256_set1_epi32(size.w));
 	__m256i pixelIndices = _mm256_add_epi32(rowStart, xCoords);
 
-	ret.x = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, r.get(), sizeof(float));
-	ret.y = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, g.get(), sizeof(float));
-	ret.z = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, b.get(), sizeof(float));
-	ret.w = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, a.get(), sizeof(float));
+	ret.x = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, r, sizeof(float));
+	ret.y = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, g, sizeof(float));
+	ret.z = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, b, sizeof(float));
+	ret.w = _mm256_mmask_i32gather_ps(_mm256_setzero_ps(), mask, pixelIndices, a, sizeof(float));
 	return ret;
 }
 
@@ -52,10 +60,10 @@ VectorPack16 FloatColorBuffer::gatherPixels16(const __m512i& xCoords, const __m5
 	__m512i rowStart = _mm512_mullo_epi32(yCoords, _mm512_set1_epi32(size.w));
 	__m512i pixelIndices = _mm512_add_epi32(rowStart, xCoords);
 
-	ret.x = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, r.get(), sizeof(float));
-	ret.y = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, g.get(), sizeof(float));
-	ret.z = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, b.get(), sizeof(float));
-	ret.w = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, a.get(), sizeof(float));
+	ret.x = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, r, sizeof(float));
+	ret.y = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, g, sizeof(float));
+	ret.z = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, b, sizeof(float));
+	ret.w = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, pixelIndices, a, sizeof(float));
 	return ret;
 }
 
@@ -64,10 +72,10 @@ void FloatColorBuffer::scatterPixels16(const __m512i& xCoords, const __m512i& yC
 	__m512i rowStart = _mm512_mullo_epi32(yCoords, _mm512_set1_epi32(size.w));
 	__m512i pixelIndices = _mm512_add_epi32(rowStart, xCoords);
 
-	_mm512_mask_i32scatter_ps(r.get(), mask, pixelIndices, pixels.r, sizeof(float));
-	_mm512_mask_i32scatter_ps(g.get(), mask, pixelIndices, pixels.g, sizeof(float));
-	_mm512_mask_i32scatter_ps(b.get(), mask, pixelIndices, pixels.b, sizeof(float));
-	_mm512_mask_i32scatter_ps(a.get(), mask, pixelIndices, pixels.a, sizeof(float));
+	_mm512_mask_i32scatter_ps(r, mask, pixelIndices, pixels.r, sizeof(float));
+	_mm512_mask_i32scatter_ps(g, mask, pixelIndices, pixels.g, sizeof(float));
+	_mm512_mask_i32scatter_ps(b, mask, pixelIndices, pixels.b, sizeof(float));
+	_mm512_mask_i32scatter_ps(a, mask, pixelIndices, pixels.a, sizeof(float));
 }
 
 VectorPack16 FloatColorBuffer::getPixels16(size_t xStart, size_t y) const
@@ -113,6 +121,16 @@ void FloatColorBuffer::setPixel(int x, int y, Color color)
 	a[ind] = color.a / 255.0f;
 }
 
+void FloatColorBuffer::clearSpan(size_t y, size_t xBegin, size_t xEnd)
+{
+	size_t begin = y * size.w + xBegin;
+	size_t end = y * size.w + xEnd;
+	std::fill(&r[begin], &r[end], 0.0f);
+	std::fill(&g[begin], &g[end], 0.0f);
+	std::fill(&b[begin], &b[end], 0.0f);
+	std::fill(&a[begin], &a[end], 0.0f);
+}
+
 Vec4 FloatColorBuffer::getPixelAsVec4(int x, int y) const
 {
 	size_t ind = y * getW() + x;
@@ -131,22 +149,22 @@ int FloatColorBuffer::getH() const
 
 float* FloatColorBuffer::getp_R()
 {
-	return r.get();
+	return r;
 }
 
 float* FloatColorBuffer::getp_G()
 {
-	return g.get();
+	return g;
 }
 
 float* FloatColorBuffer::getp_B()
 {
-	return b.get();
+	return b;
 }
 
 float* FloatColorBuffer::getp_A()
 {
-	return a.get();
+	return a;
 }
 
 const FloatColorBufferSize& FloatColorBuffer::getSize() const
@@ -157,9 +175,19 @@ const FloatColorBufferSize& FloatColorBuffer::getSize() const
 VectorPack16 FloatColorBuffer::gatherPixels16(const __m512i &indices, const __mmask16 &mask) const
 {
     VectorPack16 ret;
-    ret.x = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, r.get(), sizeof(float));
-    ret.y = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, g.get(), sizeof(float));
-    ret.z = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, b.get(), sizeof(float));
-    ret.w = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, a.get(), sizeof(float));
+    ret.x = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, r, sizeof(float));
+    ret.y = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, g, sizeof(float));
+    ret.z = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, b, sizeof(float));
+    ret.w = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, a, sizeof(float));
     return ret;
 }
+
+const LargePageBuffer& FloatColorBuffer::getStorage() const
+{
+	return storage;
+}
+
+void FloatColorBuffer::firstTouch(Threadpool& threadpool)
+{
+	storage.firstTouch(threadpool, 4);
+}
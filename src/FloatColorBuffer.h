@@ -5,11 +5,12 @@
 #include "VectorPack.h"
 #include "Color.h"
 #include "Vec.h"
+#include "LargePageBuffer.h"
 
 struct FloatColorBufferSize
 {
-	float fw, fh;
-	uint32_t w, h;
+	float fw = 0, fh = 0;
+	uint32_t w = 0, h = 0;
 
 	FloatColorBufferSize() = default;
 	FloatColorBufferSize(int w, int h)
@@ -28,6 +29,7 @@ public:
 	FloatColorBuffer(int w, int h);
 
 	void operator=(const FloatColorBuffer& other);
+	void operator=(FloatColorBuffer&& other) noexcept;
 	VectorPack8 gatherPixels8(const __m256i& xCoords, const __m256i& yCoords, const __mmask8& mask) const;
 	VectorPack16 gatherPixels16(const __m512i& xCoords, const __m512i& yCoords, const __mmask16& mask) const;
 	VectorPack16 gatherPixels16(const __m512i& indices, const __mmask16& mask) const;
@@ -41,6 +43,7 @@ public:
 	void setPixels16(size_t pixelIndex, const VectorPack16& pixels, __mmask16 mask);
 
 	void setPixel(int x, int y, Color color);
+	void clearSpan(size_t y, size_t xBegin, size_t xEnd); //sets pixels xBegin..xEnd-1 of row y to 0 in all channels
 
 	Vec4 getPixelAsVec4(int x, int y) const;
 
@@ -53,7 +56,16 @@ public:
 	float* getp_A();
 
 	const FloatColorBufferSize& getSize() const;
+	const LargePageBuffer& getStorage() const;
+	void firstTouch(Threadpool& threadpool); //see LargePageBuffer::firstTouch
 private:
 	FloatColorBufferSize size;
-	std::unique_ptr<float[]> r, g, b, a;
+	LargePageBuffer storage; //all 4 channels are planes in a single allocation
+	float* r = nullptr;
+	float* g = nullptr;
+	float* b = nullptr;
+	float* a = nullptr;
+
+	void assignPlanePointers();
+	size_t getPlaneStride() const;
 };
\ No newline at end of file
@@ -52,6 +52,7 @@ void BenchmarkState::update()
 		std::stringstream ss;
 		ss << "\n" << benchmarkModeFrames << " frames rendered in " << benchmarkTimer.getTime() << " s\n";
 		ss << info.fps_avg << " avg, " << "1% low: " << info.fps_1pct_low << ", " << "0.1% low: " << info.fps_point1pct_low << "\n";
+		if (generatedPointLightCount) ss << "Point lights: " << pointLights.size() << "\n";
 		if (!benchmarkPassName.empty()) ss << "Comment: " << benchmarkPassName << "\n";
 
 		std::cout << ss.str();
@@ -4,6 +4,8 @@
 #include <SDL/SDL_ttf.h>
 #include <memory>
 #include <optional>
+#include <map>
+#include <string>
 
 #include "../C_Input.h"
 
@@ -14,6 +16,7 @@ struct GameStateInitData
 {
 	int argc;
 	char** argv;
+	std::map<std::string, std::string> args; //parsed --key [value] arguments
 
 	SDL_Window* wnd;
 	Threadpool* threadpool;	
@@ -1,12 +1,15 @@
 #include "MainGame.h"
 #include <fstream>
 #include <iostream>
+#include <random>
+#include <bit>
 
 #include "../blitting.h"
 #include "../EnumclassHelper.h"
 #include "../AssetLoader.h"
 #include "../shaders/MainFragmentRenderShader.h"
 #include "../Renderers/RasterizationRenderer.h"
+#include "../Renderers/ShadowMapRenderer.h"
 
 MainGame::MainGame(GameStateInitData data)
 {
@@ -73,9 +76,21 @@ void MainGame::handleInput()
 	if (input.wasCharPressedOnThisFrame('R')) settings.backfaceCullingEnabled ^= 1;
 	if (input.wasCharPressedOnThisFrame('U')) settings.fogEffectVersion = EnumclassHelper::next(settings.fogEffectVersion);
 	if (input.wasCharPressedOnThisFrame('Y')) settings.ditheringEnabled ^= 1;
+	if (input.wasCharPressedOnThisFrame('I')) settings.ditheringMode = EnumclassHelper::next(settings.ditheringMode);
+	if (input.wasCharPressedOnThisFrame('T')) settings.directSurfaceOutputEnabled ^= 1;
+	if (input.wasCharPressedOnThisFrame('F')) settings.shadowPass = EnumclassHelper::next(settings.shadowPass);
+	if (input.wasCharPressedOnThisFrame('M'))
+	{
+		settings.shadowMode = EnumclassHelper::next(settings.shadowMode);
+		this->updateRendererShadows();
+	}
 	if (input.wasCharPressedOnThisFrame('Q') && settings.ssaaMult > 1) this->adjustSsaaMult(settings.ssaaMult - 1);
 	if (input.wasCharPressedOnThisFrame('E')) this->adjustSsaaMult(settings.ssaaMult + 1);
 	if (input.wasCharPressedOnThisFrame('H')) this->renderer->saveBuffers();
+	if (input.wasButtonPressedOnThisFrame(SDL_SCANCODE_F1)) settings.pointLightsEnabled ^= 1;
+	if (input.wasButtonPressedOnThisFrame(SDL_SCANCODE_F2)) settings.sectorCullingMode = EnumclassHelper::next(settings.sectorCullingMode);
+	if (input.wasButtonPressedOnThisFrame(SDL_SCANCODE_F3)) settings.rejectCullingEnabled ^= 1;
+	if (input.wasButtonPressedOnThisFrame(SDL_SCANCODE_F4)) settings.sectorAnimationEnabled ^= 1;
 
 	if (input.wasButtonPressedOnThisFrame(SDL_SCANCODE_LCTRL))
 	{
@@ -133,7 +148,7 @@ void MainGame::handleInput()
 		camAdd /= len;
 		this->camera.pos += camAdd * settings.flySpeed;
 
-		for (int i = 0; i < 4; ++i) pointLights[i].pos += camAdd * settings.flySpeed;
+		if (!this->generatedPointLightCount) for (auto& it : pointLights) it.pos += camAdd * settings.flySpeed;
 	}
 }
 
@@ -169,7 +184,7 @@ void MainGame::init()
 		}
 	}
 
-	maps = WadLoader::loadWad("doom2.wad"); //can't redistribute commercial wads!
+	wad = WadLoader("doom2.wad"); //can't redistribute commercial wads! Maps are only parsed when changeMapTo first asks for them
 
 	pointLights = {
 		{this->camera.pos, Vec4(1,0.7,0.4,1), 2e4},
@@ -181,8 +196,15 @@ void MainGame::init()
 		//{Vec4(500,300,0), Vec4(0.5,0.7,1,1), 2e5},
 		//{Vec4(-500,300,0), Vec4(0.1,0.5,1,1), 2e5},
 	};
+	if (initData.args.contains("lights"))
+	{
+		this->generatedPointLightCount = atol(initData.args["lights"].c_str());
+		settings.pointLightsEnabled = this->generatedPointLightCount > 0;
+	}
 
-	this->renderer = std::make_unique<RasterizationRenderer>(w, h, *threadpool);
+	auto rasterizationRenderer = std::make_unique<RasterizationRenderer>(w, h, *threadpool);
+	rasterizationRenderer->setPointLights(&this->pointLights);
+	this->renderer = std::move(rasterizationRenderer);
 }
 
 std::string vecToStr(const Vec4& v)
@@ -190,6 +212,50 @@ std::string vecToStr(const Vec4& v)
 	return std::to_string(v.x) + " " + std::to_string(v.y) + " " + std::to_string(v.z);
 }
 
+std::string ditheringModeToStr(DitheringMode mode)
+{
+	switch (mode)
+	{
+	case DitheringMode::LEHMER_RNG: return "Lehmer RNG";
+	case DitheringMode::BLUE_NOISE: return "blue noise";
+	case DitheringMode::ORDERED: return "ordered (Bayer)";
+	default: return "unknown";
+	}
+}
+
+std::string shadowModeToStr(ShadowMode mode)
+{
+	switch (mode)
+	{
+	case ShadowMode::FIXED_SUN: return "fixed sun map";
+	case ShadowMode::CASCADED: return "cascaded";
+	case ShadowMode::BAKED: return "baked lightmaps";
+	default: return "unknown";
+	}
+}
+
+std::string shadowPassToStr(ShadowPass pass)
+{
+	switch (pass)
+	{
+	case ShadowPass::INLINE: return "inline";
+	case ShadowPass::DEFERRED: return "deferred";
+	case ShadowPass::DEFERRED_HALF_RES: return "deferred, half resolution";
+	default: return "unknown";
+	}
+}
+
+std::string sectorCullingToStr(SectorCullingMode mode)
+{
+	switch (mode)
+	{
+	case SectorCullingMode::NONE: return "disabled";
+	case SectorCullingMode::BSP: return "BSP";
+	case SectorCullingMode::PORTALS: return "portals";
+	default: return "unknown";
+	}
+}
+
 std::string boolToStr(bool b)
 {
 	return b ? "enabled" : "disabled";
@@ -197,12 +263,29 @@ std::string boolToStr(bool b)
 
 void MainGame::draw()
 {
+	//the culling statistics are shown by the previous frame's window update, so they can only change once it's done
+	threadpool->waitUntilTaskCompletes(windowUpdateTaskId);
+	this->moveSectors();
 	std::vector<const Model*> modelPtrs;
 	int skyTextureMarker = textureManager.getTextureIndexByName("F_SKY1");
-	for (const auto& it : sceneModels) if (it.textureIndex != skyTextureMarker) modelPtrs.push_back(&it);
+	bool sectorsCulled = this->findVisibleSectors();
+	this->lastFrameSubmittedTriangleCount = 0;
+	for (size_t i = 0; i < sceneModels.size(); ++i)
+	{
+		if (sceneModels[i].textureIndex == skyTextureMarker) continue;
+		if (sectorsCulled && !visibleSectors[sceneModelSectors[i]]) continue;
+		modelPtrs.push_back(&sceneModels[i]);
+		this->lastFrameSubmittedTriangleCount += sceneModels[i].getTriangleCount();
+	}
+	this->lastFrameSubmittedModelCount = modelPtrs.size();
 	if (settings.skyRenderingMode == SkyRenderingMode::SPHERE) modelPtrs.push_back(&sky.getModel());
 
-	threadpool->waitUntilTaskCompletes(windowUpdateTaskId);
+	if (settings.shadowMode == ShadowMode::FIXED_SUN || settings.shadowMode == ShadowMode::BAKED)
+	{
+		this->continueFixedSunShadowBuild();
+		this->renderMovedGeometryShadows();
+	}
+	if (settings.shadowMode == ShadowMode::CASCADED) cascadedShadowMap.update(sceneModels, camera, wndSurf->w / real(wndSurf->h), settings, *threadpool, performanceMonitor.getFrameNumber());
 	renderer->drawScene(modelPtrs, wndSurf, settings, camera);
 
 	windowUpdateTaskId = threadpool->addTask([&, this]() {
@@ -217,7 +300,19 @@ void MainGame::draw()
 				{"Buffer cleaning", settings.bufferCleaningEnabled ? "enabled" : "disabled"},
 				{"FOV", std::to_string(2 * atan(1 / settings.fovMult) * 180 / M_PI) + " degrees"},
 				{"Fog", !settings.fogEnabled ? "disabled" : ("version " + std::to_string(int(settings.fogEffectVersion)) + ", intensity " + std::to_string(settings.fogIntensity))},
-				{"Dithering", settings.ditheringEnabled ? "enabled" : "disabled"},
+				{"Dithering", !settings.ditheringEnabled ? "disabled" : ditheringModeToStr(settings.ditheringMode)},
+				{"Direct surface output", settings.directSurfaceOutputEnabled ? "enabled" : "disabled"},
+				{"Shadow pass", shadowPassToStr(settings.shadowPass)},
+				{"Shadows", shadowModeToStr(settings.shadowMode) + (settings.shadowMode == ShadowMode::CASCADED ? ", " + std::to_string(cascadedShadowMap.getCascades().size()) + " cascades, " + std::to_string(cascadedShadowMap.getMemoryUsage() >> 20) + " MB" : "")
+					+ (settings.shadowMode != ShadowMode::CASCADED && !previewShadowMaps.empty() ? ", building sun map " + std::to_string(int(shadowMaps.front().getProgressiveRenderProgress() * 100)) + "%" : "")
+					+ (settings.shadowMode == ShadowMode::BAKED && !lightmaps.empty() ? ", " + std::to_string(lightmapMemoryUsage >> 20) + " MB" : "")},
+				{"Sector culling", sectorCullingToStr(settings.sectorCullingMode) + (settings.sectorCullingMode == SectorCullingMode::NONE || sceneModelSectors.empty() ? "" : !lastFrameSectorCulled ? ", nothing culled from here"
+					: settings.sectorCullingMode == SectorCullingMode::BSP ? ", " + std::to_string(bspCuller.getLastVisibleSectorCount()) + "/" + std::to_string(currentMap->sectors.size()) + " sectors, " + std::to_string(bspCuller.getLastVisitedSubsectorCount()) + " subsectors visited"
+					: ", " + std::to_string(portalCuller.getLastVisibleSectorCount()) + "/" + std::to_string(currentMap->sectors.size()) + " sectors, " + std::to_string(portalCuller.getLastPortalTraversalCount()) + " portals passed")},
+				{"REJECT culling", !settings.rejectCullingEnabled || sceneModelSectors.empty() ? "disabled" : currentMap->reject.empty() ? "no REJECT data in this map" : lastFrameRejectedSectorCount < 0 ? "camera outside of the level"
+					: std::to_string(lastFrameRejectedSectorCount) + " sectors rejected"},
+				{"Moving sectors", !settings.sectorAnimationEnabled || sceneModelSectors.empty() ? "disabled" : std::to_string(dynamicSectors.getLastMovedSectorCount()) + "/" + std::to_string(dynamicSectors.getMoverCount()) + " doors and lifts moved, " + std::to_string(dynamicSectors.getLastMovedVertexCount()) + " vertices updated"},
+				{"Triangles submitted", std::to_string(lastFrameSubmittedTriangleCount) + " in " + std::to_string(lastFrameSubmittedModelCount) + " models"},
 				{"Gamma", std::to_string(settings.gamma)},
 				{"Output resolution", std::to_string(wndSurf->w) + "x" + std::to_string(wndSurf->h)},
 
@@ -235,6 +330,65 @@ void MainGame::draw()
 	});
 }
 
+bool MainGame::findVisibleSectors()
+{
+	if (sceneModelSectors.empty()) return false;
+	real aspectRatio = wndSurf->w / real(wndSurf->h);
+	this->lastFrameSectorCulled = false;
+	if (settings.sectorCullingMode == SectorCullingMode::BSP) this->lastFrameSectorCulled = bspCuller.findVisibleSectors(camera, aspectRatio, settings.fovMult, visibleSectors);
+	if (settings.sectorCullingMode == SectorCullingMode::PORTALS) this->lastFrameSectorCulled = portalCuller.findVisibleSectors(camera, aspectRatio, settings.fovMult, settings.nearPlaneZ, visibleSectors);
+	this->lastFrameRejectedSectorCount = -1;
+
+	int cameraSector = -1;
+	if (settings.rejectCullingEnabled && !currentMap->reject.empty())
+	{
+		cameraSector = bspCuller.findCameraSector(camera.pos);
+		if (cameraSector < 0) cameraSector = portalCuller.findCameraSector(camera.pos); //maps with a broken BSP can still have REJECT
+	}
+	if (cameraSector >= 0)
+	{
+		//REJECT only ever removes sectors, so it narrows down whatever the culling mode found
+		if (!this->lastFrameSectorCulled) visibleSectors.assign(currentMap->sectors.size(), true);
+		this->lastFrameRejectedSectorCount = 0;
+		for (int nSector = 0; nSector < visibleSectors.size(); ++nSector)
+		{
+			if (nSector == cameraSector || currentMap->canSectorSeeSector(cameraSector, nSector)) continue;
+			this->lastFrameRejectedSectorCount += visibleSectors[nSector];
+			visibleSectors[nSector] = false;
+		}
+	}
+	return this->lastFrameSectorCulled || cameraSector >= 0;
+}
+
+void MainGame::moveSectors()
+{
+	if (!settings.sectorAnimationEnabled || !currentMap) return;
+	for (const auto& move : dynamicSectors.advanceMovers())
+	{
+		//shadows have to be redone both where the geometry was and where it ends up
+		auto markShadowsDirty = [&]() {
+			for (uint32_t nModel : dynamicSectors.getBoundModels(move.sector))
+			{
+				for (auto& it : this->shadowMaps) it.markDirty(sceneModels[nModel]);
+				for (auto& it : this->previewShadowMaps) it.markDirty(sceneModels[nModel]);
+			}
+		};
+		markShadowsDirty();
+		dynamicSectors.setSectorHeights(*currentMap, move, sceneModels, textureManager);
+		markShadowsDirty();
+	}
+}
+
+void MainGame::renderMovedGeometryShadows()
+{
+	//a full map that is still being built progressively keeps it's marks until it's done, it's triangles were set up before the geometry moved.
+	//Cascades are refit every few frames, so they pick moved geometry up on their own. Baked lightmaps stay as they were baked
+	std::vector<ShadowMap*> dirtyMaps;
+	for (auto& it : this->previewShadowMaps) if (it.hasDirtyRegions()) dirtyMaps.push_back(&it);
+	for (auto& it : this->shadowMaps) if (it.hasDirtyRegions() && !it.isProgressiveRenderInProgress()) dirtyMaps.push_back(&it);
+	if (!dirtyMaps.empty()) ShadowMap::renderDirtyRegions(dirtyMaps, sceneModels, this->settings, *threadpool, this->shadowMapRenderer);
+}
+
 void MainGame::endFrame()
 {
 }
@@ -252,24 +406,45 @@ bool debug = true;
 
 void MainGame::changeMapTo(std::string mapName)
 {
+	if (currentMap) dynamicSectors.restoreHeights(*currentMap); //so the map's geometry cache key stays the same next time
 	if (mapName != "MAP00")
 	{
-		currentMap = &maps.at(mapName);
-		auto sectorWorldModels = currentMap->getMapGeometryModels(textureManager);
+		currentMap = &wad.getMap(mapName);
+		uint64_t geometryKey = mapGeometryCache.computeKey(*currentMap);
+		auto sectorWorldModels = mapGeometryCache.tryLoad(geometryKey, textureManager).value_or(std::vector<SectorGeometry>());
+		if (sectorWorldModels.size() != currentMap->sectors.size())
+		{
+			bob::Timer timer;
+			sectorWorldModels = currentMap->getMapGeometryModels(textureManager, *threadpool);
+			std::cout << "Built map geometry in " << timer.getTime() << " s\n";
+			mapGeometryCache.store(geometryKey, sectorWorldModels, textureManager);
+		}
 		sceneModels.clear();
+		sceneModelSectors.clear();
+		std::vector<std::vector<VertexHeightBinding>> sceneModelHeightBindings;
 
 		for (int nSector = 0; nSector < sectorWorldModels.size(); ++nSector)
 		{
-			for (auto& model : sectorWorldModels[nSector])
+			auto& geometry = sectorWorldModels[nSector];
+			for (size_t i = 0; i < geometry.models.size(); ++i)
 			{
-				model.lightMult = currentMap->sectors[nSector].lightLevel / 256.0;
-				sceneModels.push_back(model);
+				geometry.models[i].lightMult = currentMap->sectors[nSector].lightLevel / 256.0;
+				sceneModels.push_back(geometry.models[i]);
+				sceneModelSectors.push_back(nSector);
+				sceneModelHeightBindings.push_back(std::move(geometry.heightBindings[i]));
 			}
 		}
+		bspCuller = BspCuller(*currentMap);
+		portalCuller = PortalCuller(*currentMap);
+		dynamicSectors = DynamicSectors(*currentMap, std::move(sceneModelHeightBindings));
 	}
 	else
 	{
 		currentMap = nullptr;
+		sceneModelSectors.clear();
+		bspCuller = BspCuller();
+		portalCuller = PortalCuller();
+		dynamicSectors = DynamicSectors();
 		AssetLoader loader;
 		//GLTF and FBX load fine
 		//sceneModels = loader.loadObj("scenes/Sponza/sponza.obj", textureManager, "H:/Sponza goodies/old_sponza/old_sponza.bmdl");
@@ -308,26 +483,108 @@ void MainGame::changeMapTo(std::string mapName)
 
 	size_t triangleCount = 0;
 	for (auto& it : sceneModels) triangleCount += it.getTriangleCount();
-	std::cout << "Total triangles loaded: " << triangleCount << "\n";
+	std::cout << "Total triangles loaded: " << triangleCount << " in " << sceneModels.size() << " models\n";
+	if (this->generatedPointLightCount) this->generatePointLights(this->generatedPointLightCount);
+
+	//Camera shadowMapPov = { .pos = Vec4(-1846, 2799, 568), .angle = Vec4(0, -1.2869, -0.6689) };
+	//Camera shadowMapPov = { .pos = Vec4(-288.22, 2493.0354, -519.728333), .angle = Vec4(0, 3.685142, -1.213774) };
+	this->sunPov = { .pos = Vec4(843.313965, 3009.328857, -55.578117), .angle = Vec4(0, -4.721983, -1.09903) };
+	this->shadowMaps.clear();
+	this->previewShadowMaps.clear();
+	for (auto& it : sceneModels) it.lightmap = nullptr;
+	this->lightmaps.clear();
+	this->cascadedShadowMap = CascadedShadowMap(this->sunPov, debug ? 2 : 4, debug ? 256 : 2048);
+	this->updateRendererShadows();
 
-	auto *r = dynamic_cast<RasterizationRenderer*>(this->renderer.get());
-	if (r)
+	performanceMonitor.reset();
+}
+
+void MainGame::updateRendererShadows()
+{
+	auto* r = dynamic_cast<RasterizationRenderer*>(this->renderer.get());
+	if (!r) return;
+
+	bool fixedSunMapNeeded = settings.shadowMode == ShadowMode::FIXED_SUN || settings.shadowMode == ShadowMode::BAKED;
+	if (fixedSunMapNeeded && this->shadowMaps.empty() && !this->sceneModels.empty())
 	{
-		r->removeShadowMaps();
 		int shadowMapW = debug ? 192 : 19200;
 		int shadowMapH = debug ? 108 : 10800;
-		//Camera shadowMapPov = { .pos = Vec4(-1846, 2799, 568), .angle = Vec4(0, -1.2869, -0.6689) };
-		//Camera shadowMapPov = { .pos = Vec4(-288.22, 2493.0354, -519.728333), .angle = Vec4(0, 3.685142, -1.213774) };
-		Camera shadowMapPov = { .pos = Vec4(843.313965, 3009.328857, -55.578117), .angle = Vec4(0, -4.721983, -1.09903) };
-		this->shadowMaps = { ShadowMap(shadowMapW,shadowMapH,shadowMapPov) };
+		this->shadowMaps = { ShadowMap(shadowMapW, shadowMapH, this->sunPov) };
 
+		//rendering the full map takes seconds, so unless it's cached, a low resolution one is rendered right away and used until the full one is done
+		std::vector<ShadowMap*> previewsToRender;
+		this->previewShadowMaps.reserve(this->shadowMaps.size()); //previewsToRender points into it
 		for (auto& it : shadowMaps)
 		{
-			it.render(sceneModels, this->settings, *threadpool);
-			r->addShadowMap(it);
-		}		
+			if (it.loadFromCache(sceneModels, this->settings, *threadpool, this->shadowMapCache)) continue;
+			it.beginProgressiveRender(sceneModels, this->settings);
+			ShadowMap& preview = this->previewShadowMaps.emplace_back(shadowMapW / fixedSunPreviewDownscale, shadowMapH / fixedSunPreviewDownscale, this->sunPov);
+			preview.depthBias = it.depthBias * fixedSunPreviewDownscale; //bigger texels need more bias against acne
+			previewsToRender.push_back(&preview);
+		}
+		ShadowMap::renderBatch(previewsToRender, sceneModels, this->settings, *threadpool, this->shadowMapRenderer);
 	}
-	performanceMonitor.reset();
+
+	this->updateLightmaps();
+
+	//baked lighting only needs the sun map for models without a lightmap, which are all of them until the bake is done
+	r->removeShadowMaps();
+	bool lightmapsReady = settings.shadowMode == ShadowMode::BAKED && !this->lightmaps.empty();
+	if (!lightmapsReady) for (auto& it : previewShadowMaps.empty() ? shadowMaps : previewShadowMaps) r->addShadowMap(it);
+	r->setShadowCascades(&this->cascadedShadowMap);
+}
+
+void MainGame::updateLightmaps()
+{
+	if (settings.shadowMode != ShadowMode::BAKED || !this->lightmaps.empty() || this->shadowMaps.empty()) return;
+
+	//the file is named after everything the sun map depends on, plus the lightmap's own parameters
+	const ShadowMap& sun = this->shadowMaps.front();
+	real texelSize = Lightmap::chooseTexelSize(this->sceneModels, minLightmapTexelSize, lightmapTexelBudget);
+	uint64_t key = this->shadowMapCache.computeKey(this->sceneModels, sun.pov, sun.fovMult, sun.depthBuffer, this->settings);
+	key = (key * 1099511628211ull) ^ std::bit_cast<uint32_t>(float(texelSize));
+	key = (key * 1099511628211ull) ^ Lightmap::formatVersion;
+	std::string path = this->shadowMapCache.getPath(key, ".lmc");
+
+	this->lightmaps = Lightmap::load(path, key, this->sceneModels);
+	if (this->lightmaps.empty())
+	{
+		if (!this->previewShadowMaps.empty()) return; //baking from the preview would store it's low resolution for good
+		bob::Timer timer;
+		this->lightmaps = Lightmap::bake(this->sceneModels, sun, texelSize, *threadpool);
+		std::cout << "Baked lightmaps in " << timer.getTime() << " s, " << texelSize << " units per texel\n";
+		Lightmap::save(path, key, this->lightmaps);
+	}
+
+	this->lightmapMemoryUsage = 0;
+	for (size_t i = 0; i < this->sceneModels.size(); ++i)
+	{
+		this->sceneModels[i].lightmap = &this->lightmaps[i];
+		this->lightmapMemoryUsage += this->lightmaps[i].getMemoryUsage();
+	}
+}
+
+void MainGame::continueFixedSunShadowBuild()
+{
+	if (this->previewShadowMaps.empty()) return;
+
+	bool allDone = true;
+	for (auto& it : shadowMaps)
+	{
+		if (!it.isProgressiveRenderInProgress()) continue;
+		if (!it.continueProgressiveRender(sceneModels, this->settings, *threadpool, fixedSunBuildBudgetPerFrame))
+		{
+			allDone = false;
+			continue;
+		}
+		//sectors that moved during the build were only marked, so they are rendered before the map is stored and lightmaps are baked from it
+		if (it.hasDirtyRegions()) ShadowMap::renderDirtyRegions({ &it }, sceneModels, this->settings, *threadpool, this->shadowMapRenderer);
+		it.storeToCache(sceneModels, this->settings, *threadpool, this->shadowMapCache);
+	}
+	if (!allDone) return;
+
+	this->previewShadowMaps.clear();
+	this->updateRendererShadows();
 }
 
 void MainGame::adjustSsaaMult(int newMult)
@@ -335,6 +592,33 @@ void MainGame::adjustSsaaMult(int newMult)
 	int w = wndSurf->w * newMult;
 	int h = wndSurf->h * newMult;
 	settings.ssaaMult = newMult;
-	this->renderer = std::make_unique<RasterizationRenderer>(w, h, *threadpool);
-	for (auto& it : shadowMaps) dynamic_cast<RasterizationRenderer*>(this->renderer.get())->addShadowMap(it);
+	auto rasterizationRenderer = std::make_unique<RasterizationRenderer>(w, h, *threadpool);
+	rasterizationRenderer->setPointLights(&this->pointLights);
+	this->renderer = std::move(rasterizationRenderer);
+	this->updateRendererShadows();
+}
+
+void MainGame::generatePointLights(size_t count)
+{
+	//lights are put a bit in front of random triangles, so they end up next to geometry instead of in the void around the level.
+	//The seed is fixed, so benchmark runs with the same count are comparable
+	const real lightRange = 256;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<real> channel(0, 1);
+	this->pointLights.clear();
+	for (size_t i = 0; i < count && !this->sceneModels.empty(); ++i)
+	{
+		const Model& model = this->sceneModels[rng() % this->sceneModels.size()];
+		if (!model.getTriangleCount()) continue;
+		const Triangle& triangle = model.getTriangles()[rng() % model.getTriangleCount()];
+		Vec4 normal = triangle.getNormalVector();
+		if (normal.len() > 0) normal /= normal.len();
+		Vec4 pos = (triangle.tv[0].spaceCoords + triangle.tv[1].spaceCoords + triangle.tv[2].spaceCoords) / 3 + normal * 32;
+
+		Vec4 color = Vec4(channel(rng), channel(rng), channel(rng), 1);
+		color /= std::max({ color.x, color.y, color.z, real(0.01) }); //the brightest channel is 1, so the intensity alone decides the range
+		color.w = 1;
+		this->pointLights.push_back({ pos, color, lightRange * lightRange * PointLight::cutoffBrightness });
+	}
+	std::cout << "Generated " << this->pointLights.size() << " point lights\n";
 }
\ No newline at end of file
@@ -25,6 +25,13 @@
 #include "../PointLight.h"
 #include "../misc/GameSettings.h"
 #include "../ShadowMap.h"
+#include "../CascadedShadowMap.h"
+#include "../ShadowMapCache.h"
+#include "../MapGeometryCache.h"
+#include "../Lightmap.h"
+#include "../BspCuller.h"
+#include "../PortalCuller.h"
+#include "../DynamicSectors.h"
 #include "../KeepApartVector.h"
 #include "../Camera.h"
 #include "../Renderers/RendererBase.h"
@@ -47,17 +54,38 @@ protected:
 	Threadpool* threadpool;
 
     std::vector<PointLight> pointLights;
+	size_t generatedPointLightCount = 0; //from --lights, replaces the default lights following the camera with that many static ones spread over the level
 
 	std::vector<Vec4> camPosAndAngArchieve;
 	int activeCamPosAndAngle = 2;
 	Camera camera;
 
-	std::vector<ShadowMap> shadowMaps;
+	Camera sunPov;
+	static constexpr int fixedSunPreviewDownscale = 8;
+	static constexpr std::chrono::milliseconds fixedSunBuildBudgetPerFrame{ 8 };
+	std::vector<ShadowMap> shadowMaps; //only built when shadowMode is FIXED_SUN
+	std::vector<ShadowMap> previewShadowMaps; //low resolution versions of shadowMaps, used while those are rendered progressively
+	ShadowMapRenderer shadowMapRenderer; //for previews and dirty regions, so it's job buffers survive between frames
+	static constexpr real minLightmapTexelSize = 8;
+	static constexpr size_t lightmapTexelBudget = 64 << 20;
+	std::vector<Lightmap> lightmaps; //one per scene model, baked from the full fixed sun map when shadowMode is BAKED
+	size_t lightmapMemoryUsage = 0;
+	CascadedShadowMap cascadedShadowMap;
+	ShadowMapCache shadowMapCache; //the fixed sun map is static, so it's kept on disk between runs and map changes
+	MapGeometryCache mapGeometryCache;
 
 	GameSettings settings;
 	PerformanceMonitor performanceMonitor;	
 
 	std::vector<Model> sceneModels;
+	std::vector<int> sceneModelSectors; //sector of every scene model, empty if the scene isn't a Doom map
+	BspCuller bspCuller;
+	PortalCuller portalCuller;
+	std::vector<bool> visibleSectors;
+	bool lastFrameSectorCulled = false; //whether sectorCullingMode could cull anything
+	int lastFrameRejectedSectorCount = -1; //sectors REJECT removed from the visible ones, -1 if it wasn't used this frame
+	DynamicSectors dynamicSectors;
+	size_t lastFrameSubmittedTriangleCount = 0, lastFrameSubmittedModelCount = 0;
 
 	TextureManager textureManager;
 
@@ -68,7 +96,7 @@ protected:
 
 	task_id windowUpdateTaskId = 0;
 
-	std::map<std::string, DoomMap> maps;
+	WadLoader wad; //owns the mapping currentMap points into
 	std::string defaultMap;
 	DoomMap* currentMap = nullptr;
 	std::string warpTo;
@@ -80,4 +108,11 @@ protected:
 	void changeMapTo(std::string mapName);
 
 	void adjustSsaaMult(int add);
+	void generatePointLights(size_t count);
+	void updateRendererShadows(); //starts building the fixed sun shadow map if it's needed and wasn't built yet, and hands the shadows over to the renderer
+	void continueFixedSunShadowBuild();
+	void updateLightmaps(); //loads or bakes the lightmaps if they are needed, and the fixed sun map they come from is complete
+	bool findVisibleSectors(); //fills visibleSectors from the enabled culling methods, false if none of them could cull anything this frame
+	void moveSectors(); //runs doors and lifts a frame further when sectorAnimationEnabled, and marks the shadows of the geometry they move
+	void renderMovedGeometryShadows();
 };
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "LargePageBuffer.h"
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <iomanip>
+#include <utility>
+
+#include "Threadpool.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+LargePageBuffer::LargePageBuffer(size_t bytes)
+{
+	this->allocate(bytes);
+}
+
+LargePageBuffer::LargePageBuffer(const LargePageBuffer& other)
+{
+	*this = other;
+}
+
+LargePageBuffer::LargePageBuffer(LargePageBuffer&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+LargePageBuffer& LargePageBuffer::operator=(const LargePageBuffer& other)
+{
+	if (this == &other) return *this;
+	this->release();
+	this->allocate(other.bytes);
+	if (other.bytes > 0) memcpy(this->pData, other.pData, other.bytes);
+	return *this;
+}
+
+LargePageBuffer& LargePageBuffer::operator=(LargePageBuffer&& other) noexcept
+{
+	if (this == &other) return *this;
+	this->release();
+	this->pData = std::exchange(other.pData, nullptr);
+	this->bytes = std::exchange(other.bytes, 0);
+	this->mappedBytes = std::exchange(other.mappedBytes, 0);
+	this->backing = std::exchange(other.backing, MemoryBacking::NONE);
+	return *this;
+}
+
+LargePageBuffer::~LargePageBuffer()
+{
+	this->release();
+}
+
+uint8_t* LargePageBuffer::data()
+{
+	return this->pData;
+}
+
+const uint8_t* LargePageBuffer::data() const
+{
+	return this->pData;
+}
+
+size_t LargePageBuffer::size() const
+{
+	return this->bytes;
+}
+
+MemoryBacking LargePageBuffer::getBacking() const
+{
+	return this->backing;
+}
+
+std::string LargePageBuffer::describe() const
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(1) << this->bytes / (1024.0 * 1024.0) << " MB, ";
+	switch (this->backing)
+	{
+	case MemoryBacking::NONE: ss << "not allocated"; break;
+	case MemoryBacking::REGULAR: ss << "regular pages"; break;
+	case MemoryBacking::TRANSPARENT_HUGE_PAGES: ss << "transparent huge pages"; break;
+	case MemoryBacking::HUGE_PAGES: ss << "huge pages"; break;
+	}
+	return ss.str();
+}
+
+void LargePageBuffer::firstTouch(Threadpool& threadpool, size_t planeCount)
+{
+	if (this->bytes == 0) return;
+	size_t planeBytes = this->bytes / planeCount;
+	size_t threadCount = threadpool.getThreadCount();
+
+	std::vector<task_id> tasks;
+	for (size_t tNum = 0; tNum < threadCount; ++tNum)
+	{
+		tasks.push_back(threadpool.addTask([=, this, &threadpool]() {
+			auto [lim1, lim2] = threadpool.getLimitsForThread(tNum, 0, planeBytes);
+			for (size_t plane = 0; plane < planeCount; ++plane)
+			{
+				uint8_t* planeStart = this->pData + plane * planeBytes;
+				memset(planeStart + size_t(lim1), 0, size_t(lim2) - size_t(lim1)); //the memory is already zeroed, but writing is what makes the OS actually back the pages
+			}
+		}));
+	}
+	threadpool.waitForMultipleTasks(tasks);
+}
+
+void LargePageBuffer::allocate(size_t bytes)
+{
+	this->bytes = bytes;
+	if (bytes == 0) return;
+
+	if (bytes < largeAllocationThreshold)
+	{
+		this->pData = static_cast<uint8_t*>(::operator new(bytes, std::align_val_t(64)));
+		memset(this->pData, 0, bytes);
+		this->mappedBytes = bytes;
+		this->backing = MemoryBacking::REGULAR;
+		return;
+	}
+
+#ifdef _WIN32
+	//large pages need the SeLockMemoryPrivilege, which regular users don't have by default, so failing here is expected
+	size_t largePageSize = GetLargePageMinimum();
+	if (largePageSize > 0)
+	{
+		this->mappedBytes = (bytes + largePageSize - 1) / largePageSize * largePageSize;
+		this->pData = static_cast<uint8_t*>(VirtualAlloc(nullptr, this->mappedBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+		this->backing = MemoryBacking::HUGE_PAGES;
+	}
+	if (!this->pData)
+	{
+		this->mappedBytes = bytes;
+		this->pData = static_cast<uint8_t*>(VirtualAlloc(nullptr, this->mappedBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+		this->backing = MemoryBacking::REGULAR;
+	}
+	if (!this->pData) throw std::bad_alloc();
+#else
+	constexpr size_t hugePageSize = 2 * 1024 * 1024;
+	this->mappedBytes = (bytes + hugePageSize - 1) / hugePageSize * hugePageSize;
+
+	//explicit huge pages only work if the admin has reserved some, so this usually fails
+	void* p = mmap(nullptr, this->mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED)
+	{
+		this->pData = static_cast<uint8_t*>(p);
+		this->backing = MemoryBacking::HUGE_PAGES;
+		return;
+	}
+
+	//the kernel can only use transparent huge pages for 2 MB aligned ranges, so map a bit more and cut off the unaligned ends
+	size_t overallocatedBytes = this->mappedBytes + hugePageSize;
+	p = mmap(nullptr, overallocatedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) throw std::bad_alloc();
+
+	uintptr_t start = reinterpret_cast<uintptr_t>(p);
+	uintptr_t alignedStart = (start + hugePageSize - 1) / hugePageSize * hugePageSize;
+	if (alignedStart > start) munmap(p, alignedStart - start);
+	size_t tailBytes = overallocatedBytes - (alignedStart - start) - this->mappedBytes;
+	if (tailBytes > 0) munmap(reinterpret_cast<void*>(alignedStart + this->mappedBytes), tailBytes);
+
+	this->pData = reinterpret_cast<uint8_t*>(alignedStart);
+	this->backing = madvise(this->pData, this->mappedBytes, MADV_HUGEPAGE) == 0 ? MemoryBacking::TRANSPARENT_HUGE_PAGES : MemoryBacking::REGULAR;
+#endif
+}
+
+void LargePageBuffer::release()
+{
+	if (!this->pData) return;
+
+	if (this->mappedBytes < largeAllocationThreshold) ::operator delete(this->pData, std::align_val_t(64));
+	else
+	{
+#ifdef _WIN32
+		VirtualFree(this->pData, 0, MEM_RELEASE);
+#else
+		munmap(this->pData, this->mappedBytes);
+#endif
+	}
+
+	this->pData = nullptr;
+	this->bytes = 0;
+	this->mappedBytes = 0;
+	this->backing = MemoryBacking::NONE;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Threadpool;
+
+enum class MemoryBacking
+{
+	NONE, //nothing allocated
+	REGULAR, //small allocations, or when nothing better was available
+	TRANSPARENT_HUGE_PAGES, //Linux only. Only advised to the kernel, which may still decide to use regular pages
+	HUGE_PAGES, //Linux MAP_HUGETLB or Windows large pages
+};
+
+//Zero-initialized, 64 byte aligned storage for big pixel buffers. Allocations of at least largeAllocationThreshold bytes are backed by huge pages when the OS allows it,
+//since scattered gathers into multi-hundred-MB buffers (shadow maps, SSAA frame buffers) are otherwise bound by TLB misses.
+class LargePageBuffer
+{
+public:
+	static constexpr size_t largeAllocationThreshold = 2 * 1024 * 1024;
+
+	LargePageBuffer() = default;
+	LargePageBuffer(size_t bytes);
+	LargePageBuffer(const LargePageBuffer& other);
+	LargePageBuffer(LargePageBuffer&& other) noexcept;
+	LargePageBuffer& operator=(const LargePageBuffer& other);
+	LargePageBuffer& operator=(LargePageBuffer&& other) noexcept;
+	~LargePageBuffer();
+
+	template<typename T> T* as();
+	template<typename T> const T* as() const;
+	uint8_t* data();
+	const uint8_t* data() const;
+	size_t size() const;
+
+	MemoryBacking getBacking() const;
+	std::string describe() const; //size and backing in human readable form, for the OSD
+
+	//Writes every page in parallel, so that page faults don't happen in the middle of rendering and pages land on the memory node of the worker that touched them.
+	//The buffer is split into planeCount equal planes, and every plane is split between workers the same way rendering splits rows
+	void firstTouch(Threadpool& threadpool, size_t planeCount = 1);
+private:
+	uint8_t* pData = nullptr;
+	size_t bytes = 0;
+	size_t mappedBytes = 0; //bytes actually reserved from the OS, rounded up to the page size
+	MemoryBacking backing = MemoryBacking::NONE;
+
+	void allocate(size_t bytes);
+	void release();
+};
+
+template<typename T>
+inline T* LargePageBuffer::as()
+{
+	return reinterpret_cast<T*>(this->pData);
+}
+
+template<typename T>
+inline const T* LargePageBuffer::as() const
+{
+	return reinterpret_cast<const T*>(this->pData);
+}
@@ -0,0 +1,292 @@
+#include "Lightmap.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "Model.h"
+#include "ShadowMap.h"
+#include "Threadpool.h"
+#include "MappedFile.h"
+
+int Lightmap::getW() const
+{
+	return this->w;
+}
+
+int Lightmap::getH() const
+{
+	return this->h;
+}
+
+size_t Lightmap::getMemoryUsage() const
+{
+	return this->texels.size() + this->triangleCoords.size() * sizeof(this->triangleCoords[0]);
+}
+
+const std::array<Vec2, 3>& Lightmap::getTriangleCoords(size_t triangleIndex) const
+{
+	return this->triangleCoords[triangleIndex];
+}
+
+FloatPack16 Lightmap::getVisibility16(const FloatPack16& u, const FloatPack16& v, Mask16 mask) const
+{
+	IntPack16 x = IntPack16(_mm512_cvttps_epi32(u)).clamp(0, this->w - 1);
+	IntPack16 y = IntPack16(_mm512_cvttps_epi32(v)).clamp(0, this->h - 1);
+	IntPack16 texelIndices = y * this->w + x;
+	IntPack16 texelValues = IntPack16(_mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, texelIndices, this->texels.data(), 1)) & IntPack16(0xFF);
+	return _mm512_cvtepi32_ps(texelValues) * (1.0f / 255);
+}
+
+Lightmap::TrianglePlane Lightmap::getTrianglePlane(const Triangle& triangle, real texelSize)
+{
+	TrianglePlane ret;
+	Vec4 p0 = triangle.tv[0].spaceCoords;
+	Vec4 edge1 = triangle.tv[1].spaceCoords - p0;
+	Vec4 edge2 = triangle.tv[2].spaceCoords - p0;
+	p0.w = 1;
+	edge1.w = 0;
+	edge2.w = 0;
+	Vec4 normal = edge1.cross3d(edge2);
+	normal.w = 0;
+
+	if (edge1.len() == 0 || normal.len() == 0)
+	{
+		//degenerate triangles can't show up on screen with any area, so a single texel is enough
+		ret.origin = p0;
+		ret.axisU = ret.axisV = Vec4(0, 0, 0, 0);
+		ret.localCoords.fill(Vec2(padding + 0.5, padding + 0.5));
+		ret.rectW = ret.rectH = 1 + 2 * padding;
+		return ret;
+	}
+
+	Vec4 axisU = edge1 / edge1.len();
+	Vec4 axisV = normal.cross3d(axisU);
+	axisV.w = 0;
+	axisV /= axisV.len();
+
+	Vec2 local[3] = { Vec2(0, 0), Vec2(edge1.len(), 0), Vec2(edge2.dot(axisU), edge2.dot(axisV)) };
+	real minU = std::min<real>(0, local[2].x), maxU = std::max<real>(local[1].x, local[2].x);
+	real minV = std::min<real>(0, local[2].y), maxV = std::max<real>(0, local[2].y);
+
+	ret.rectW = int(std::ceil((maxU - minU) / texelSize)) + 1 + 2 * padding;
+	ret.rectH = int(std::ceil((maxV - minV) / texelSize)) + 1 + 2 * padding;
+	for (int i = 0; i < 3; ++i) ret.localCoords[i] = Vec2((local[i].x - minU) / texelSize + padding, (local[i].y - minV) / texelSize + padding);
+	ret.axisU = axisU * texelSize;
+	ret.axisV = axisV * texelSize;
+	ret.origin = p0 + axisU * (minU - padding * texelSize) + axisV * (minV - padding * texelSize);
+	return ret;
+}
+
+void Lightmap::bakeTriangle(const TrianglePlane& plane, const Vec2& rectOrigin, const ShadowMap& sun)
+{
+	//samples are pushed half a texel off the surface towards the sun, else they'd be shadowed by the surface itself wherever the map's depth is rounded up
+	Vec4 normal = plane.axisU.cross3d(plane.axisV);
+	normal.w = 0;
+	if (normal.len() > 0) normal *= 0.5f * plane.axisU.len() / normal.len();
+	Vec4 toSun = sun.pov.pos - plane.origin;
+	if (normal.dot(toSun) < 0) normal = -normal;
+
+	int sunW = sun.depthBuffer.getW();
+	int sunH = sun.depthBuffer.getH();
+	auto isLit = [&](Vec4 p) {
+		p.w = 1;
+		Vec4 v = sun.ctr.rotateAndTranslate(p);
+		if (v.z >= 0) return false; //like lookups at runtime, everything outside of the map counts as shadowed
+		real zInv = sun.fovMult / v.z;
+		Vec4 pixel = sun.ctr.screenSpaceToPixels(v * zInv);
+		if (pixel.x < 0 || pixel.y < 0 || pixel.x >= sunW || pixel.y >= sunH) return false;
+		return !(sun.depthBuffer.getPixel(pixel.x, pixel.y) < zInv - sun.depthBias);
+	};
+
+	const real sampleOffsets[2] = { 0.25, 0.75 };
+	for (int y = 0; y < plane.rectH; ++y)
+	{
+		uint8_t* row = this->texels.data() + (size_t(rectOrigin.y) + y) * this->w + size_t(rectOrigin.x);
+		for (int x = 0; x < plane.rectW; ++x)
+		{
+			int litSamples = 0;
+			for (real sy : sampleOffsets)
+			{
+				for (real sx : sampleOffsets) litSamples += isLit(plane.origin + plane.axisU * (x + sx) + plane.axisV * (y + sy) + normal);
+			}
+			row[x] = uint8_t(litSamples * 255 / 4);
+		}
+	}
+}
+
+std::vector<Lightmap> Lightmap::bake(const std::vector<Model>& models, const ShadowMap& sun, real texelSize, Threadpool& threadpool)
+{
+	std::vector<Lightmap> ret(models.size());
+	std::vector<std::vector<TrianglePlane>> planes(models.size());
+	std::vector<std::vector<Vec2>> rectOrigins(models.size());
+	size_t threadCount = threadpool.getThreadCount();
+
+	//rectangles are packed into shelves by descending height, in an atlas about as wide as it is tall
+	std::vector<task_id> packingTasks;
+	for (size_t tNum = 0; tNum < threadCount; ++tNum)
+	{
+		packingTasks.push_back(threadpool.addTask([&, tNum]() {
+			for (size_t m = tNum; m < models.size(); m += threadCount)
+			{
+				const auto& triangles = models[m].getTriangles();
+				Lightmap& lightmap = ret[m];
+				planes[m].resize(triangles.size());
+				size_t totalArea = 0;
+				int widestRect = 1;
+				for (size_t i = 0; i < triangles.size(); ++i)
+				{
+					planes[m][i] = getTrianglePlane(triangles[i], texelSize);
+					totalArea += size_t(planes[m][i].rectW) * planes[m][i].rectH;
+					widestRect = std::max(widestRect, planes[m][i].rectW);
+				}
+				lightmap.w = std::max(widestRect, int(std::ceil(std::sqrt(real(totalArea)))));
+
+				std::vector<uint32_t> order(triangles.size());
+				std::iota(order.begin(), order.end(), 0);
+				std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return planes[m][a].rectH > planes[m][b].rectH; });
+				rectOrigins[m].resize(triangles.size());
+				int shelfX = 0, shelfY = 0, shelfH = 0;
+				for (uint32_t i : order)
+				{
+					const TrianglePlane& plane = planes[m][i];
+					if (shelfX + plane.rectW > lightmap.w)
+					{
+						shelfY += shelfH;
+						shelfX = 0;
+						shelfH = 0;
+					}
+					rectOrigins[m][i] = Vec2(shelfX, shelfY);
+					shelfX += plane.rectW;
+					shelfH = std::max(shelfH, plane.rectH);
+				}
+				lightmap.h = std::max(shelfY + shelfH, 1);
+				lightmap.texels.assign(size_t(lightmap.w) * lightmap.h + 3, 0);
+
+				lightmap.triangleCoords.resize(triangles.size());
+				for (size_t i = 0; i < triangles.size(); ++i)
+				{
+					for (int v = 0; v < 3; ++v) lightmap.triangleCoords[i][v] = Vec2(rectOrigins[m][i].x + planes[m][i].localCoords[v].x, rectOrigins[m][i].y + planes[m][i].localCoords[v].y);
+				}
+			}
+		}));
+	}
+	threadpool.waitForMultipleTasks(packingTasks);
+
+	//triangles own disjoint rectangles, so they can be baked in any order. Imported scenes have a few models with most of the triangles, so work is split by triangle ranges
+	struct BakeChunk
+	{
+		size_t model, begin, end;
+	};
+	constexpr size_t trianglesPerChunk = 1024;
+	std::vector<BakeChunk> chunks;
+	for (size_t m = 0; m < models.size(); ++m)
+	{
+		size_t triangleCount = planes[m].size();
+		for (size_t i = 0; i < triangleCount; i += trianglesPerChunk) chunks.push_back({ m, i, std::min(i + trianglesPerChunk, triangleCount) });
+	}
+	std::vector<task_id> bakeTasks;
+	for (size_t tNum = 0; tNum < threadCount; ++tNum)
+	{
+		bakeTasks.push_back(threadpool.addTask([&, tNum]() {
+			for (size_t c = tNum; c < chunks.size(); c += threadCount)
+			{
+				const BakeChunk& chunk = chunks[c];
+				for (size_t i = chunk.begin; i < chunk.end; ++i) ret[chunk.model].bakeTriangle(planes[chunk.model][i], rectOrigins[chunk.model][i], sun);
+			}
+		}));
+	}
+	threadpool.waitForMultipleTasks(bakeTasks);
+	return ret;
+}
+
+real Lightmap::chooseTexelSize(const std::vector<Model>& models, real minTexelSize, size_t texelBudget)
+{
+	//rectangles are about twice the area of their triangles
+	double totalArea = 0;
+	for (const auto& model : models)
+	{
+		for (const auto& triangle : model.getTriangles())
+		{
+			Vec4 normal = (triangle.tv[1].spaceCoords - triangle.tv[0].spaceCoords).cross3d(triangle.tv[2].spaceCoords - triangle.tv[0].spaceCoords);
+			normal.w = 0;
+			totalArea += normal.len();
+		}
+	}
+	return std::max<real>(minTexelSize, std::sqrt(totalArea / texelBudget));
+}
+
+bool Lightmap::save(const std::string& path, uint64_t key, const std::vector<Lightmap>& lightmaps)
+{
+	FileHeader header;
+	memcpy(header.magic, "LMC", 4);
+	header.version = formatVersion;
+	header.key = key;
+	header.lightmapCount = lightmaps.size();
+
+	//written under a temporary name and renamed, like shadow map cache files
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream f(tempPath, std::ios::binary);
+		f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const auto& it : lightmaps)
+		{
+			int32_t size[2] = { it.w, it.h };
+			uint64_t triangleCount = it.triangleCoords.size();
+			f.write(reinterpret_cast<const char*>(size), sizeof(size));
+			f.write(reinterpret_cast<const char*>(&triangleCount), sizeof(triangleCount));
+			f.write(reinterpret_cast<const char*>(it.triangleCoords.data()), triangleCount * sizeof(it.triangleCoords[0]));
+			f.write(reinterpret_cast<const char*>(it.texels.data()), size_t(it.w) * it.h);
+		}
+		if (!f)
+		{
+			std::cout << "Could not write lightmap file " << tempPath << "\n";
+			return false;
+		}
+	}
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec) std::cout << "Could not write lightmap file " << path << ": " << ec.message() << "\n";
+	return !ec;
+}
+
+std::vector<Lightmap> Lightmap::load(const std::string& path, uint64_t key, const std::vector<Model>& models)
+{
+	MappedFile file(path);
+	if (!file.isOpen() || file.size() < sizeof(FileHeader)) return {};
+
+	FileHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, "LMC", 4) != 0 || header.version != formatVersion || header.key != key || header.lightmapCount != models.size()) return {};
+
+	std::vector<Lightmap> ret(models.size());
+	const uint8_t* p = file.data() + sizeof(FileHeader);
+	const uint8_t* pEnd = file.data() + file.size();
+	for (size_t i = 0; i < models.size(); ++i)
+	{
+		int32_t size[2];
+		uint64_t triangleCount;
+		if (pEnd - p < ptrdiff_t(sizeof(size) + sizeof(triangleCount))) return {};
+		memcpy(size, p, sizeof(size));
+		memcpy(&triangleCount, p + sizeof(size), sizeof(triangleCount));
+		p += sizeof(size) + sizeof(triangleCount);
+
+		size_t coordBytes = triangleCount * sizeof(std::array<Vec2, 3>);
+		size_t texelBytes = size_t(size[0]) * size[1];
+		if (size[0] < 1 || size[1] < 1 || triangleCount != size_t(models[i].getTriangleCount()) || size_t(pEnd - p) < coordBytes + texelBytes) return {};
+
+		Lightmap& lightmap = ret[i];
+		lightmap.w = size[0];
+		lightmap.h = size[1];
+		lightmap.triangleCoords.resize(triangleCount);
+		memcpy(lightmap.triangleCoords.data(), p, coordBytes);
+		lightmap.texels.assign(p + coordBytes, p + coordBytes + texelBytes);
+		lightmap.texels.resize(texelBytes + 3, 0);
+		p += coordBytes + texelBytes;
+	}
+	return p == pEnd ? ret : std::vector<Lightmap>();
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <string>
+#include <cstdint>
+
+#include "Vec.h"
+#include "VectorPack.h"
+
+class Model;
+struct Triangle;
+class Threadpool;
+struct ShadowMap;
+
+//Sun visibility baked for every triangle of one model, so static scenes need one fetch per pixel instead of a shadow map lookup.
+//Every triangle gets it's own rectangle of texels, laid out in the triangle's plane with a texel of padding around it, and the rectangles are packed into rows of one atlas.
+//Texels store the lit fraction of 2x2 samples, so shadow edges come out slightly soft even with nearest filtering.
+class Lightmap
+{
+public:
+	static constexpr uint32_t formatVersion = 1;
+	static constexpr int padding = 1; //texels around each triangle's rectangle, extrapolated from it's plane, so nearest lookups at the edges never read a neighbour
+
+	int getW() const;
+	int getH() const;
+	size_t getMemoryUsage() const;
+	const std::array<Vec2, 3>& getTriangleCoords(size_t triangleIndex) const; //in texels
+	FloatPack16 getVisibility16(const FloatPack16& u, const FloatPack16& v, Mask16 mask) const; //0 is fully in shadow, 1 is fully lit
+
+	static std::vector<Lightmap> bake(const std::vector<Model>& models, const ShadowMap& sun, real texelSize, Threadpool& threadpool); //one lightmap per model
+	static real chooseTexelSize(const std::vector<Model>& models, real minTexelSize, size_t texelBudget); //the smallest texel size keeping the total texel count within budget
+	static bool save(const std::string& path, uint64_t key, const std::vector<Lightmap>& lightmaps);
+	static std::vector<Lightmap> load(const std::string& path, uint64_t key, const std::vector<Model>& models); //empty if the file is missing, stale or doesn't fit the models
+private:
+	int w = 0, h = 0;
+	std::vector<uint8_t> texels; //lit fraction times 255, padded by 3 bytes so 32 bit gathers of the last texel stay in bounds
+	std::vector<std::array<Vec2, 3>> triangleCoords;
+
+	struct TrianglePlane
+	{
+		Vec4 origin, axisU, axisV; //world position of local (0,0), and world offsets of one texel along each axis
+		std::array<Vec2, 3> localCoords; //in texels, relative to the rectangle's corner, padding included
+		int rectW, rectH;
+	};
+	static TrianglePlane getTrianglePlane(const Triangle& triangle, real texelSize);
+	void bakeTriangle(const TrianglePlane& plane, const Vec2& rectOrigin, const ShadowMap& sun);
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint64_t lightmapCount;
+	};
+};
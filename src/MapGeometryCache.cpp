@@ -0,0 +1,158 @@
+#include "MapGeometryCache.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <type_traits>
+
+#include "MappedFile.h"
+
+static_assert(std::is_trivially_copyable_v<Triangle>, "triangles are stored in memory layout");
+static_assert(std::is_trivially_copyable_v<VertexHeightBinding> && sizeof(VertexHeightBinding) == 32, "height bindings are stored in memory layout, without padding");
+
+MapGeometryCache::MapGeometryCache(std::string directory)
+{
+	this->directory = directory;
+}
+
+uint64_t MapGeometryCache::computeKey(const DoomMap& map) const
+{
+	//FNV-1a over the lumps the geometry is built from, the WAD structs are packed so they have no padding bytes
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&](const void* pData, size_t bytes) {
+		const uint8_t* p = static_cast<const uint8_t*>(pData);
+		for (size_t i = 0; i < bytes; ++i)
+		{
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+	};
+	auto addLump = [&](const auto& lump) {
+		uint64_t count = lump.size();
+		add(&count, sizeof(count));
+		add(lump.data(), lump.size() * sizeof(lump[0]));
+	};
+	add(&formatVersion, sizeof(formatVersion));
+	addLump(map.vertices);
+	addLump(map.linedefs);
+	addLump(map.sidedefs);
+	addLump(map.sectors);
+	return hash;
+}
+
+std::string MapGeometryCache::getPath(uint64_t key) const
+{
+	std::stringstream ss;
+	ss << this->directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".mgc";
+	return ss.str();
+}
+
+std::optional<std::vector<SectorGeometry>> MapGeometryCache::tryLoad(uint64_t key, TextureManager& textureManager) const
+{
+	MappedFile file(this->getPath(key));
+	if (!file.isOpen() || file.size() < sizeof(FileHeader)) return std::nullopt;
+
+	FileHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, "MGC", 4) != 0 || header.version != formatVersion || header.key != key) return std::nullopt;
+
+	const uint8_t* p = file.data() + sizeof(FileHeader);
+	const uint8_t* pEnd = file.data() + file.size();
+	std::vector<SectorGeometry> ret(header.sectorCount);
+	for (auto& sectorModels : ret)
+	{
+		uint64_t modelCount;
+		if (size_t(pEnd - p) < sizeof(modelCount)) return std::nullopt;
+		memcpy(&modelCount, p, sizeof(modelCount));
+		p += sizeof(modelCount);
+
+		for (uint64_t i = 0; i < modelCount; ++i)
+		{
+			ModelHeader modelHeader;
+			if (size_t(pEnd - p) < sizeof(modelHeader)) return std::nullopt;
+			memcpy(&modelHeader, p, sizeof(modelHeader));
+			p += sizeof(modelHeader);
+			if (size_t(pEnd - p) < modelHeader.textureNameLength || modelHeader.triangleCount == 0 || modelHeader.orientation >= uint32_t(SurfaceOrientation::COUNT)) return std::nullopt;
+			std::string textureName(reinterpret_cast<const char*>(p), modelHeader.textureNameLength);
+			p += modelHeader.textureNameLength;
+
+			//texture sizes are baked into the UVs, so a texture that was replaced since makes the whole file stale
+			int textureIndex = textureManager.getTextureIndexByName(textureName);
+			const Texture& texture = textureManager.getTextureByIndex(textureIndex);
+			if (texture.getName() != textureName || texture.getW() != modelHeader.textureW || texture.getH() != modelHeader.textureH) return std::nullopt;
+
+			size_t triangleBytes = modelHeader.triangleCount * sizeof(Triangle);
+			if (modelHeader.triangleCount > size_t(pEnd - p) / sizeof(Triangle)) return std::nullopt;
+			std::vector<Triangle> triangles(modelHeader.triangleCount);
+			memcpy(triangles.data(), p, triangleBytes);
+			p += triangleBytes;
+
+			size_t bindingCount = modelHeader.triangleCount * 3;
+			if (bindingCount > size_t(pEnd - p) / sizeof(VertexHeightBinding)) return std::nullopt;
+			std::vector<VertexHeightBinding> heightBindings(bindingCount);
+			memcpy(heightBindings.data(), p, bindingCount * sizeof(VertexHeightBinding));
+			p += bindingCount * sizeof(VertexHeightBinding);
+			for (const auto& it : heightBindings)
+			{
+				for (int32_t nSector : { it.height.sectors[0], it.height.sectors[1], it.textureAnchor.sectors[0], it.textureAnchor.sectors[1] })
+				{
+					if (nSector < 0 || nSector >= header.sectorCount) return std::nullopt;
+				}
+			}
+
+			Model& model = sectorModels.models.emplace_back(triangles, textureIndex, textureManager);
+			model.orientation = SurfaceOrientation(modelHeader.orientation);
+			sectorModels.heightBindings.push_back(std::move(heightBindings));
+		}
+	}
+	if (p != pEnd) return std::nullopt;
+	return ret;
+}
+
+void MapGeometryCache::store(uint64_t key, const std::vector<SectorGeometry>& sectorModels, const TextureManager& textureManager) const
+{
+	FileHeader header;
+	memcpy(header.magic, "MGC", 4);
+	header.version = formatVersion;
+	header.key = key;
+	header.sectorCount = sectorModels.size();
+
+	//written under a temporary name and renamed, like shadow map cache files
+	std::error_code ec;
+	std::filesystem::create_directories(this->directory, ec);
+	std::string path = this->getPath(key);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream f(tempPath, std::ios::binary);
+		f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const auto& geometry : sectorModels)
+		{
+			uint64_t modelCount = geometry.models.size();
+			f.write(reinterpret_cast<const char*>(&modelCount), sizeof(modelCount));
+			for (size_t i = 0; i < geometry.models.size(); ++i)
+			{
+				const Model& model = geometry.models[i];
+				const Texture& texture = textureManager.getTextureByIndex(model.textureIndex);
+				ModelHeader modelHeader;
+				modelHeader.textureW = texture.getW();
+				modelHeader.textureH = texture.getH();
+				modelHeader.orientation = uint32_t(model.orientation);
+				modelHeader.textureNameLength = texture.getName().size();
+				modelHeader.triangleCount = model.getTriangleCount();
+				f.write(reinterpret_cast<const char*>(&modelHeader), sizeof(modelHeader));
+				f.write(texture.getName().data(), texture.getName().size());
+				f.write(reinterpret_cast<const char*>(model.getTriangles().data()), model.getTriangleCount() * sizeof(Triangle));
+				f.write(reinterpret_cast<const char*>(geometry.heightBindings[i].data()), geometry.heightBindings[i].size() * sizeof(VertexHeightBinding));
+			}
+		}
+		if (!f)
+		{
+			std::cout << "Could not write map geometry cache file " << tempPath << "\n";
+			return;
+		}
+	}
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec) std::cout << "Could not write map geometry cache file " << path << ": " << ec.message() << "\n";
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+
+#include "Model.h"
+#include "DoomMap.h"
+#include "TextureManager.h"
+
+//Stores the triangulated geometry of Doom maps on disk, so changing maps doesn't run the polygon triangulator again.
+//Files are named by a hash of the map lumps the geometry is built from. Triangles are stored in memory layout, so loading is one mapping and a copy per model.
+//Models keep the file name and size of their texture, and a file whose textures don't match any more counts as stale
+class MapGeometryCache
+{
+public:
+	static constexpr uint32_t formatVersion = 4; //also bumped when the geometry built from the same lumps changes, like a new triangulator
+
+	MapGeometryCache(std::string directory = "map_cache");
+
+	uint64_t computeKey(const DoomMap& map) const;
+	std::optional<std::vector<SectorGeometry>> tryLoad(uint64_t key, TextureManager& textureManager) const; //models per sector, like DoomMap::getMapGeometryModels
+	void store(uint64_t key, const std::vector<SectorGeometry>& sectorModels, const TextureManager& textureManager) const; //failures are only reported to stdout, the cache is an optimization
+	std::string getPath(uint64_t key) const;
+private:
+	std::string directory;
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint64_t sectorCount;
+	};
+
+	struct ModelHeader
+	{
+		int32_t textureW, textureH;
+		uint32_t orientation;
+		uint32_t textureNameLength; //the name follows the header, then the triangles and their vertices' height bindings
+		uint64_t triangleCount;
+	};
+};
@@ -0,0 +1,110 @@
+#include "MappedFile.h"
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return;
+	}
+	void* p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!p)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+	this->fileHandle = file;
+	this->mappingHandle = mapping;
+	this->pData = static_cast<const uint8_t*>(p);
+	this->bytes = fileSize.QuadPart;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return;
+	}
+	void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file alive
+	if (p == MAP_FAILED) return;
+	this->pData = static_cast<const uint8_t*>(p);
+	this->bytes = st.st_size;
+#endif
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this == &other) return *this;
+	this->close();
+	this->pData = std::exchange(other.pData, nullptr);
+	this->bytes = std::exchange(other.bytes, 0);
+#ifdef _WIN32
+	this->fileHandle = std::exchange(other.fileHandle, nullptr);
+	this->mappingHandle = std::exchange(other.mappingHandle, nullptr);
+#endif
+	return *this;
+}
+
+MappedFile::~MappedFile()
+{
+	this->close();
+}
+
+bool MappedFile::isOpen() const
+{
+	return this->pData != nullptr;
+}
+
+const uint8_t* MappedFile::data() const
+{
+	return this->pData;
+}
+
+size_t MappedFile::size() const
+{
+	return this->bytes;
+}
+
+void MappedFile::close()
+{
+	if (!this->pData) return;
+#ifdef _WIN32
+	UnmapViewOfFile(this->pData);
+	CloseHandle(this->mappingHandle);
+	CloseHandle(this->fileHandle);
+	this->fileHandle = this->mappingHandle = nullptr;
+#else
+	munmap(const_cast<uint8_t*>(this->pData), this->bytes);
+#endif
+	this->pData = nullptr;
+	this->bytes = 0;
+}
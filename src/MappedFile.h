@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//Read only memory mapping of a whole file. Pages are only read from disk when they are touched, so parts of big files can be used without reading all of them.
+//If the file can't be opened or mapped, the object is empty: isOpen() returns false and data() returns nullptr
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const std::string& path);
+	MappedFile(const MappedFile& other) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(const MappedFile& other) = delete;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	~MappedFile();
+
+	bool isOpen() const;
+	const uint8_t* data() const;
+	size_t size() const;
+private:
+	const uint8_t* pData = nullptr;
+	size_t bytes = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+
+	void close();
+};
@@ -8,6 +8,19 @@ Model::Model(const std::vector<Triangle>& triangles, int textureIndex, const Tex
 	//assert(triangles.size() > 0);
 	this->textureIndex = textureIndex;
 
+	for (const auto& it : triangles)
+	{
+		this->triangles.push_back(it);
+	}
+	assert(this->triangles.size() > 0);
+	this->updateBoundingBox();
+
+	this->noBackfaceCulling = !textureManager.getTextureByIndex(textureIndex).hasOnlyOpaquePixels();
+	this->triangles.shrink_to_fit();
+}
+
+void Model::updateBoundingBox()
+{
 	std::function inf = std::numeric_limits<real>::infinity;
 	Vec4 min(inf(), inf(), inf()), max(-inf(), -inf(), -inf());
 	for (const auto& it : triangles)
@@ -34,15 +47,6 @@ Model::Model(const std::vector<Triangle>& triangles, int textureIndex, const Tex
 		Vec4(min.x, max.y, max.z),
 		Vec4(max.x, max.y, max.z),
 	};
-
-	for (const auto& it : triangles)
-	{
-		this->triangles.push_back(it);
-	}
-	assert(this->triangles.size() > 0);
-
-	this->noBackfaceCulling = !textureManager.getTextureByIndex(textureIndex).hasOnlyOpaquePixels();
-	this->triangles.shrink_to_fit();
 }
 
 int Model::getTriangleCount() const
@@ -55,11 +59,21 @@ Vec4 Model::getBoundingBoxMidPoint() const
 	return std::accumulate(boundingBox.begin(), boundingBox.end(), Vec4(0, 0, 0)) / boundingBox.size();
 }
 
+const std::array<Vec4, 8>& Model::getBoundingBox() const
+{
+	return boundingBox;
+}
+
 const std::vector<Triangle>& Model::getTriangles() const
 {
 	return triangles;
 }
 
+std::vector<Triangle>& Model::getTrianglesForUpdate()
+{
+	return triangles;
+}
+
 void Model::swapVertexOrder()
 {
 	for (auto& it : triangles) std::swap(it.tv[1], it.tv[2]);
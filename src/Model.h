@@ -2,6 +2,10 @@
 #include <vector>
 #include <array>
 #include "Triangle.h"
+#include "misc/Enums.h"
+
+class Lightmap;
+
 class Model
 {
 public:
@@ -9,12 +13,17 @@ public:
 	Model(const std::vector<Triangle>& triangles, int textureIndex, const TextureManager& textureManager);
 	int getTriangleCount() const;
 	Vec4 getBoundingBoxMidPoint() const;
+	const std::array<Vec4, 8>& getBoundingBox() const;
 	const std::vector<Triangle>& getTriangles() const;
+	std::vector<Triangle>& getTrianglesForUpdate(); //the triangle count must stay the same, and updateBoundingBox has to be called once they are changed
+	void updateBoundingBox();
 
 	void swapVertexOrder();
 	std::optional<real> lightMult;
 	int textureIndex;
 	bool noBackfaceCulling = false;
+	SurfaceOrientation orientation = SurfaceOrientation::ANY; //all triangles lie in planes of this orientation, so the renderer can use a kernel with fewer divisions
+	const Lightmap* lightmap = nullptr; //only used in BAKED shadow mode, must have coords for every triangle
 private:
 	std::vector<Triangle> triangles;	
 	std::array<Vec4, 8> boundingBox; //8 points to check clipping and collision against
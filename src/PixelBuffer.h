@@ -12,6 +12,7 @@
 #include "Vec.h"
 #include "helpers.h"
 #include "VectorPack.h"
+#include "LargePageBuffer.h"
 
 struct PixelBufferSize
 {
@@ -69,6 +70,8 @@ public:
 	const T& operator[](uint64_t i) const;
 
 	void saveToFile(const std::string& path) const;
+	const LargePageBuffer& getStorage() const;
+	void firstTouch(Threadpool& threadpool); //see LargePageBuffer::firstTouch
 	virtual Color toColor(T value) const; //cannot make this = 0: compiler complains about abstract class. However, if not used, it doesn't matter that this is undefined. Only children of this class may have this
 
 	void operator=(const PixelBufferBase<T>& other);
@@ -82,7 +85,7 @@ protected:
 	const T& at(int x, int y) const;
 	void assignSizes(int w, int h);
 
-	std::vector<T> store;
+	LargePageBuffer store;
 
 	//a bunch of precomputed and properly formatted values for SIMD
 	PixelBufferSize size;
@@ -94,8 +97,7 @@ inline PixelBufferBase<T>::PixelBufferBase() {};
 template<typename T>
 inline PixelBufferBase<T>::PixelBufferBase(int w, int h)
 {
-	store.resize(w * h);
-	store.shrink_to_fit();
+	store = LargePageBuffer(size_t(w) * h * sizeof(T));
 	this->assignSizes(w, h);
 }
 
@@ -222,19 +224,19 @@ inline T* PixelBufferBase<T>::getRawPixels()
 template<typename T>
 inline const T* PixelBufferBase<T>::getRawPixels() const
 {
-	return &store.front();
+	return store.as<T>();
 }
 
 template<typename T>
 inline T* PixelBufferBase<T>::begin()
 {
-	return &store.front();
+	return store.as<T>();
 }
 
 template<typename T>
 inline T* PixelBufferBase<T>::end()
 {
-	return &store.back() + 1;
+	return store.as<T>() + size_t(size.w) * size.h;
 }
 
 template<typename T>
@@ -246,7 +248,19 @@ inline T& PixelBufferBase<T>::operator[](uint64_t i)
 template<typename T>
 inline const T& PixelBufferBase<T>::operator[](uint64_t i) const
 {
-	return store[i];
+	return store.as<T>()[i];
+}
+
+template<typename T>
+inline const LargePageBuffer& PixelBufferBase<T>::getStorage() const
+{
+	return store;
+}
+
+template<typename T>
+inline void PixelBufferBase<T>::firstTouch(Threadpool& threadpool)
+{
+	store.firstTouch(threadpool);
 }
 
 template<typename T>
@@ -292,7 +306,6 @@ inline void PixelBufferBase<T>::operator=(const PixelBufferBase<T>& other)
 	//if (w != 0 && size.h != 0 && (w != other.w || size.h != other.h)) throw std::runtime_error("Attempted to assign pixel buffer of mismatched size");
 
 	this->store = other.store;
-	store.shrink_to_fit();
 
 	this->assignSizes(other.size.w, other.size.h);
 }
@@ -310,7 +323,7 @@ inline const T& PixelBufferBase<T>::at(int x, int y) const
 	assert(y >= 0);
 	assert(x < size.w);
 	assert(y < size.h);
-	return store[y * size.w + x];
+	return store.as<T>()[y * size.w + x];
 }
 
 template<typename T>
@@ -345,7 +358,7 @@ public:
 	}
 	__m512 gatherPixels16(__m512i indices, __mmask16 mask) const
 	{
-		return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, store.data(), 4);
+		return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, store.as<float>(), 4);
 	}
 	__m512 gatherPixels16(__m512i x, __m512i y, __mmask16 mask) const
 	{
@@ -354,7 +367,7 @@ public:
 
 	__m512 getPixels16(size_t indexStart, __mmask16 mask = 0xFFFF, __m512 fillerVal = _mm512_set1_ps(0)) const
 	{
-		return _mm512_mask_loadu_ps(fillerVal, mask, store.data()+indexStart);
+		return _mm512_mask_loadu_ps(fillerVal, mask, store.as<float>() + indexStart);
 	}
 	
 	__m512 getPixels16(size_t xStart, size_t y, __mmask16 mask = 0xFFFF, __m512 fillerVal = _mm512_set1_ps(0)) const
@@ -364,7 +377,7 @@ public:
 	void setPixels16(size_t indexStart, __m512 pixels, __mmask16 mask)
 	{
 		assert(indexStart < size_t(getW()) * getH());
-		_mm512_mask_store_ps(store.data()+indexStart, mask, pixels);
+		_mm512_mask_store_ps(store.as<float>() + indexStart, mask, pixels);
 	}
 
 	void setPixels16(size_t xStart, size_t y, __m512 pixels, __mmask16 mask)
@@ -379,7 +392,7 @@ public:
 
 	void scatterPixels16(__m512i x, __m512i y, __m512 pixels, __mmask16 mask = 0xFFFF)
 	{
-		_mm512_mask_i32scatter_ps(store.data(), mask, calcIndices(x, y), pixels, 4);
+		_mm512_mask_i32scatter_ps(store.as<float>(), mask, calcIndices(x, y), pixels, 4);
 	}
 };
 
@@ -391,7 +404,7 @@ public:
 
 	__m512i gatherPixels16(__m512i indices, __mmask16 mask = 0xFFFF, __m512i fillerVal = _mm512_set1_epi32(0)) const
 	{
-		return _mm512_mask_i32gather_epi32(fillerVal, mask, indices, this->store.data(), sizeof(Color));
+		return _mm512_mask_i32gather_epi32(fillerVal, mask, indices, this->store.as<Color>(), sizeof(Color));
 	}
 	
 	__m512i gatherPixels16(__m512i x, __m512i y, __mmask16 mask = 0xFFFF, __m512i fillerVal = _mm512_set1_epi32(0)) const
@@ -3,3 +3,12 @@
 //
 
 #include "PointLight.h"
+
+#include <algorithm>
+#include <cmath>
+
+real PointLight::getRange() const
+{
+    real brightestChannel = std::max({ this->color.x, this->color.y, this->color.z });
+    return std::sqrt(std::max<real>(brightestChannel * this->intensity, 0) / cutoffBrightness);
+}
@@ -4,6 +4,10 @@
 class PointLight
 {
 public:
+    static constexpr real cutoffBrightness = 1.f / 128; //light is faded out to nothing where it would fall below this, which gives every light a finite range
+
     Vec4 pos, color;
     real intensity;
+
+    real getRange() const;
 };
@@ -2,6 +2,9 @@
 #include <functional>
 #include <set>
 #include <unordered_set>
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
@@ -62,4 +65,630 @@ std::vector<Ved2> PolygonTriangulator::triangulate(Polygon polygon)
 	if (outVerts) free(outVerts);
 	if (outTris) free(outTris);
 	return ret;
-}
\ No newline at end of file
+}
+
+//The ear clipping follows mapbox's earcut (ISC license): holes are bridged into their outer ring, and rings that don't clip cleanly are filtered, cured of local self intersections, and finally split along a valid diagonal.
+//Rings are linked lists in Arena::nodes, outer rings run counter clockwise and holes clockwise
+namespace
+{
+	using Node = PolygonTriangulator::Arena::Node;
+	using Loop = PolygonTriangulator::Arena::Loop;
+	constexpr uint32_t noNode = std::numeric_limits<uint32_t>::max();
+
+	//negative for counter clockwise turns, the sign earcut uses
+	double area(const Node& p, const Node& q, const Node& r)
+	{
+		return (q.y - p.y) * (r.x - q.x) - (q.x - p.x) * (r.y - q.y);
+	}
+
+	bool equals(const Node& a, const Node& b)
+	{
+		return a.x == b.x && a.y == b.y;
+	}
+
+	bool pointInTriangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py)
+	{
+		return (cx - px) * (ay - py) >= (ax - px) * (cy - py) && (ax - px) * (by - py) >= (bx - px) * (ay - py) && (bx - px) * (cy - py) >= (cx - px) * (by - py);
+	}
+
+	uint32_t insertNode(std::vector<Node>& n, uint32_t vertex, const Ved2& pos, uint32_t last)
+	{
+		uint32_t i = n.size();
+		n.push_back({ pos.x, pos.y, vertex, i, i, 0, noNode, noNode });
+		if (last != noNode)
+		{
+			n[i].next = n[last].next;
+			n[i].prev = last;
+			n[n[last].next].prev = i;
+			n[last].next = i;
+		}
+		return i;
+	}
+
+	void removeNode(std::vector<Node>& n, uint32_t p)
+	{
+		n[n[p].next].prev = n[p].prev;
+		n[n[p].prev].next = n[p].next;
+		if (n[p].prevZ != noNode) n[n[p].prevZ].nextZ = n[p].nextZ;
+		if (n[p].nextZ != noNode) n[n[p].nextZ].prevZ = n[p].prevZ;
+	}
+
+	//links a with b by a two way bridge of duplicated vertices, returns the duplicate of b
+	uint32_t splitPolygon(std::vector<Node>& n, uint32_t a, uint32_t b)
+	{
+		Node aCopy = { n[a].x, n[a].y, n[a].vertex, 0, 0, 0, noNode, noNode };
+		Node bCopy = { n[b].x, n[b].y, n[b].vertex, 0, 0, 0, noNode, noNode };
+		uint32_t a2 = n.size();
+		n.push_back(aCopy);
+		uint32_t b2 = n.size();
+		n.push_back(bCopy);
+		uint32_t an = n[a].next, bp = n[b].prev;
+
+		n[a].next = b;
+		n[b].prev = a;
+		n[a2].next = an;
+		n[an].prev = a2;
+		n[b2].next = a2;
+		n[a2].prev = b2;
+		n[bp].next = b2;
+		n[b2].prev = bp;
+		return b2;
+	}
+
+	//removes duplicate and collinear points
+	uint32_t filterPoints(std::vector<Node>& n, uint32_t start, uint32_t end = noNode)
+	{
+		if (start == noNode) return start;
+		if (end == noNode) end = start;
+		uint32_t p = start;
+		bool again;
+		do {
+			again = false;
+			if (equals(n[p], n[n[p].next]) || area(n[n[p].prev], n[p], n[n[p].next]) == 0)
+			{
+				removeNode(n, p);
+				p = end = n[p].prev;
+				if (p == n[p].next) break;
+				again = true;
+			}
+			else p = n[p].next;
+		} while (again || p != end);
+		return end;
+	}
+
+	bool isEar(const std::vector<Node>& n, uint32_t ear)
+	{
+		const Node& a = n[n[ear].prev];
+		const Node& b = n[ear];
+		const Node& c = n[b.next];
+		if (area(a, b, c) >= 0) return false; //reflex
+
+		double x0 = std::min({ a.x, b.x, c.x }), y0 = std::min({ a.y, b.y, c.y });
+		double x1 = std::max({ a.x, b.x, c.x }), y1 = std::max({ a.y, b.y, c.y });
+		for (uint32_t p = c.next; p != b.prev; p = n[p].next)
+		{
+			const Node& pn = n[p];
+			if (pn.x >= x0 && pn.x <= x1 && pn.y >= y0 && pn.y <= y1 && !(pn.x == a.x && pn.y == a.y) &&
+				pointInTriangle(a.x, a.y, b.x, b.y, c.x, c.y, pn.x, pn.y) && area(n[pn.prev], pn, n[pn.next]) >= 0) return false;
+		}
+		return true;
+	}
+
+	//rings with more vertices than this are indexed on a z-order curve before clipping
+	constexpr size_t zOrderMinVertices = 80;
+
+	struct ZOrderGrid
+	{
+		double minX, minY, invSize; //invSize 0 turns z-order indexing off
+	};
+
+	uint32_t zOrder(double x, double y, const ZOrderGrid& grid)
+	{
+		uint32_t ix = uint32_t((x - grid.minX) * grid.invSize), iy = uint32_t((y - grid.minY) * grid.invSize);
+		ix = (ix | (ix << 8)) & 0x00FF00FF;
+		ix = (ix | (ix << 4)) & 0x0F0F0F0F;
+		ix = (ix | (ix << 2)) & 0x33333333;
+		ix = (ix | (ix << 1)) & 0x55555555;
+		iy = (iy | (iy << 8)) & 0x00FF00FF;
+		iy = (iy | (iy << 4)) & 0x0F0F0F0F;
+		iy = (iy | (iy << 2)) & 0x33333333;
+		iy = (iy | (iy << 1)) & 0x55555555;
+		return ix | (iy << 1);
+	}
+
+	//merge sort of the z list, which is open ended unlike the rings
+	void sortLinked(std::vector<Node>& n, uint32_t list)
+	{
+		size_t inSize = 1;
+		size_t mergeCount;
+		do {
+			uint32_t p = list;
+			uint32_t tail = noNode;
+			list = noNode;
+			mergeCount = 0;
+			while (p != noNode)
+			{
+				mergeCount++;
+				uint32_t q = p;
+				size_t pSize = 0;
+				for (size_t i = 0; i < inSize; ++i)
+				{
+					pSize++;
+					q = n[q].nextZ;
+					if (q == noNode) break;
+				}
+				size_t qSize = inSize;
+				while (pSize > 0 || (qSize > 0 && q != noNode))
+				{
+					uint32_t e;
+					if (pSize != 0 && (qSize == 0 || q == noNode || n[p].z <= n[q].z))
+					{
+						e = p;
+						p = n[p].nextZ;
+						pSize--;
+					}
+					else
+					{
+						e = q;
+						q = n[q].nextZ;
+						qSize--;
+					}
+					if (tail != noNode) n[tail].nextZ = e;
+					else list = e;
+					n[e].prevZ = tail;
+					tail = e;
+				}
+				p = q;
+			}
+			n[tail].nextZ = noNode;
+			inSize *= 2;
+		} while (mergeCount > 1);
+	}
+
+	void indexCurve(std::vector<Node>& n, uint32_t start, const ZOrderGrid& grid)
+	{
+		uint32_t p = start;
+		do {
+			n[p].z = zOrder(n[p].x, n[p].y, grid);
+			n[p].prevZ = n[p].prev;
+			n[p].nextZ = n[p].next;
+			p = n[p].next;
+		} while (p != start);
+		n[n[p].prevZ].nextZ = noNode;
+		n[p].prevZ = noNode;
+		sortLinked(n, p);
+	}
+
+	bool isEarHashed(const std::vector<Node>& n, uint32_t ear, const ZOrderGrid& grid)
+	{
+		uint32_t ia = n[ear].prev, ic = n[ear].next;
+		const Node& a = n[ia];
+		const Node& b = n[ear];
+		const Node& c = n[ic];
+		if (area(a, b, c) >= 0) return false; //reflex
+
+		double x0 = std::min({ a.x, b.x, c.x }), y0 = std::min({ a.y, b.y, c.y });
+		double x1 = std::max({ a.x, b.x, c.x }), y1 = std::max({ a.y, b.y, c.y });
+		uint32_t minZ = zOrder(x0, y0, grid), maxZ = zOrder(x1, y1, grid);
+		auto blocksEar = [&](uint32_t p) {
+			const Node& pn = n[p];
+			return pn.x >= x0 && pn.x <= x1 && pn.y >= y0 && pn.y <= y1 && p != ia && p != ic && !(pn.x == a.x && pn.y == a.y) &&
+				pointInTriangle(a.x, a.y, b.x, b.y, c.x, c.y, pn.x, pn.y) && area(n[pn.prev], pn, n[pn.next]) >= 0;
+		};
+
+		//look both ways from the ear along the curve until leaving the triangle's bounds
+		uint32_t p = b.prevZ, q = b.nextZ;
+		while (p != noNode && n[p].z >= minZ && q != noNode && n[q].z <= maxZ)
+		{
+			if (blocksEar(p) || blocksEar(q)) return false;
+			p = n[p].prevZ;
+			q = n[q].nextZ;
+		}
+		for (; p != noNode && n[p].z >= minZ; p = n[p].prevZ) if (blocksEar(p)) return false;
+		for (; q != noNode && n[q].z <= maxZ; q = n[q].nextZ) if (blocksEar(q)) return false;
+		return true;
+	}
+
+	int sign(double v)
+	{
+		return (v > 0) - (v < 0);
+	}
+
+	bool onSegment(const Node& p, const Node& q, const Node& r)
+	{
+		return q.x <= std::max(p.x, r.x) && q.x >= std::min(p.x, r.x) && q.y <= std::max(p.y, r.y) && q.y >= std::min(p.y, r.y);
+	}
+
+	bool intersects(const Node& p1, const Node& q1, const Node& p2, const Node& q2)
+	{
+		int o1 = sign(area(p1, q1, p2)), o2 = sign(area(p1, q1, q2)), o3 = sign(area(p2, q2, p1)), o4 = sign(area(p2, q2, q1));
+		if (o1 != o2 && o3 != o4) return true;
+		if (o1 == 0 && onSegment(p1, p2, q1)) return true;
+		if (o2 == 0 && onSegment(p1, q2, q1)) return true;
+		if (o3 == 0 && onSegment(p2, p1, q2)) return true;
+		if (o4 == 0 && onSegment(p2, q1, q2)) return true;
+		return false;
+	}
+
+	bool intersectsPolygon(const std::vector<Node>& n, uint32_t a, uint32_t b)
+	{
+		uint32_t p = a;
+		do {
+			const Node& pn = n[p];
+			const Node& next = n[pn.next];
+			if (pn.vertex != n[a].vertex && next.vertex != n[a].vertex && pn.vertex != n[b].vertex && next.vertex != n[b].vertex && intersects(pn, next, n[a], n[b])) return true;
+			p = pn.next;
+		} while (p != a);
+		return false;
+	}
+
+	bool locallyInside(const std::vector<Node>& n, uint32_t a, uint32_t b)
+	{
+		const Node& na = n[a];
+		const Node& nb = n[b];
+		if (area(n[na.prev], na, n[na.next]) < 0) return area(na, nb, n[na.next]) >= 0 && area(na, n[na.prev], nb) >= 0;
+		return area(na, nb, n[na.prev]) < 0 || area(na, n[na.next], nb) < 0;
+	}
+
+	bool middleInside(const std::vector<Node>& n, uint32_t a, uint32_t b)
+	{
+		double px = (n[a].x + n[b].x) / 2, py = (n[a].y + n[b].y) / 2;
+		bool inside = false;
+		uint32_t p = a;
+		do {
+			const Node& pn = n[p];
+			const Node& next = n[pn.next];
+			if ((pn.y > py) != (next.y > py) && next.y != pn.y && px < (next.x - pn.x) * (py - pn.y) / (next.y - pn.y) + pn.x) inside = !inside;
+			p = pn.next;
+		} while (p != a);
+		return inside;
+	}
+
+	bool isValidDiagonal(const std::vector<Node>& n, uint32_t a, uint32_t b)
+	{
+		const Node& na = n[a];
+		const Node& nb = n[b];
+		if (n[na.next].vertex == nb.vertex || n[na.prev].vertex == nb.vertex || intersectsPolygon(n, a, b)) return false;
+		bool locallyVisible = locallyInside(n, a, b) && locallyInside(n, b, a) && middleInside(n, a, b);
+		if (locallyVisible && (area(n[na.prev], na, n[nb.prev]) != 0 || area(na, n[nb.prev], nb) != 0)) return true;
+		return equals(na, nb) && area(n[na.prev], na, n[na.next]) > 0 && area(n[nb.prev], nb, n[nb.next]) > 0; //zero length diagonal
+	}
+
+	uint32_t cureLocalIntersections(std::vector<Node>& n, uint32_t start, std::vector<uint32_t>& out)
+	{
+		uint32_t p = start;
+		do {
+			uint32_t a = n[p].prev, b = n[n[p].next].next;
+			if (!equals(n[a], n[b]) && intersects(n[a], n[p], n[n[p].next], n[b]) && locallyInside(n, a, b) && locallyInside(n, b, a))
+			{
+				out.insert(out.end(), { n[a].vertex, n[p].vertex, n[b].vertex });
+				removeNode(n, p);
+				removeNode(n, n[p].next);
+				p = start = b;
+			}
+			p = n[p].next;
+		} while (p != start);
+		return filterPoints(n, p);
+	}
+
+	void earcutLinked(std::vector<Node>& n, uint32_t ear, std::vector<uint32_t>& out, const ZOrderGrid& grid, int pass);
+
+	void splitEarcut(std::vector<Node>& n, uint32_t start, std::vector<uint32_t>& out, const ZOrderGrid& grid)
+	{
+		uint32_t a = start;
+		do {
+			for (uint32_t b = n[n[a].next].next; b != n[a].prev; b = n[b].next)
+			{
+				if (n[a].vertex == n[b].vertex || !isValidDiagonal(n, a, b)) continue;
+				uint32_t c = splitPolygon(n, a, b);
+				a = filterPoints(n, a, n[a].next);
+				c = filterPoints(n, c, n[c].next);
+				earcutLinked(n, a, out, grid, 0);
+				earcutLinked(n, c, out, grid, 0);
+				return;
+			}
+			a = n[a].next;
+		} while (a != start);
+	}
+
+	void earcutLinked(std::vector<Node>& n, uint32_t ear, std::vector<uint32_t>& out, const ZOrderGrid& grid, int pass)
+	{
+		if (ear == noNode) return;
+		if (pass == 0 && grid.invSize != 0) indexCurve(n, ear, grid);
+		uint32_t stop = ear;
+		while (n[ear].prev != n[ear].next)
+		{
+			uint32_t prev = n[ear].prev, next = n[ear].next;
+			if (grid.invSize != 0 ? isEarHashed(n, ear, grid) : isEar(n, ear))
+			{
+				out.insert(out.end(), { n[prev].vertex, n[ear].vertex, n[next].vertex });
+				removeNode(n, ear);
+				ear = stop = n[next].next;
+				continue;
+			}
+			ear = next;
+			if (ear != stop) continue;
+
+			//went around without finding an ear, try harder on each pass
+			if (pass == 0) earcutLinked(n, filterPoints(n, ear), out, grid, 1);
+			else if (pass == 1) earcutLinked(n, cureLocalIntersections(n, filterPoints(n, ear), out), out, grid, 2);
+			else splitEarcut(n, ear, out, grid);
+			break;
+		}
+	}
+
+	bool sectorContainsSector(const std::vector<Node>& n, uint32_t m, uint32_t p)
+	{
+		return area(n[n[m].prev], n[m], n[n[p].prev]) < 0 && area(n[n[p].next], n[m], n[n[m].next]) < 0;
+	}
+
+	//a vertex of the outer ring the hole's leftmost vertex can be connected to without crossing anything
+	uint32_t findHoleBridge(const std::vector<Node>& n, uint32_t hole, uint32_t outerNode)
+	{
+		double hx = n[hole].x, hy = n[hole].y;
+		double qx = -std::numeric_limits<double>::infinity();
+		uint32_t m = noNode;
+		uint32_t p = outerNode;
+		do {
+			const Node& pn = n[p];
+			const Node& next = n[pn.next];
+			if (hy <= pn.y && hy >= next.y && next.y != pn.y)
+			{
+				double x = pn.x + (hy - pn.y) * (next.x - pn.x) / (next.y - pn.y);
+				if (x <= hx && x > qx)
+				{
+					qx = x;
+					m = pn.x < next.x ? p : pn.next;
+					if (x == hx) return m; //the hole touches the outer ring
+				}
+			}
+			p = pn.next;
+		} while (p != outerNode);
+		if (m == noNode) return noNode;
+
+		//a reflex vertex inside the triangle between the hole, the ray hit and m would block the bridge, the one with the smallest angle to the ray is connected instead
+		uint32_t stop = m;
+		double mx = n[m].x, my = n[m].y;
+		double tanMin = std::numeric_limits<double>::infinity();
+		p = m;
+		do {
+			const Node& pn = n[p];
+			if (hx >= pn.x && pn.x >= mx && hx != pn.x && pointInTriangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, pn.x, pn.y))
+			{
+				double tan = std::abs(hy - pn.y) / (hx - pn.x);
+				if (locallyInside(n, p, hole) && (tan < tanMin || (tan == tanMin && (pn.x > n[m].x || (pn.x == n[m].x && sectorContainsSector(n, m, p))))))
+				{
+					m = p;
+					tanMin = tan;
+				}
+			}
+			p = pn.next;
+		} while (p != stop);
+		return m;
+	}
+
+	uint32_t eliminateHole(std::vector<Node>& n, uint32_t hole, uint32_t outerNode)
+	{
+		uint32_t bridge = findHoleBridge(n, hole, outerNode);
+		if (bridge == noNode) return outerNode;
+		uint32_t bridgeReverse = splitPolygon(n, bridge, hole);
+		filterPoints(n, bridgeReverse, n[bridgeReverse].next);
+		return filterPoints(n, bridge, n[bridge].next);
+	}
+
+	uint32_t linkLoop(std::vector<Node>& n, const PolygonTriangulator::Arena& arena, const std::vector<Ved2>& vertices, const Loop& loop, bool counterClockwise)
+	{
+		uint32_t last = noNode;
+		size_t count = loop.end - loop.begin;
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint32_t vertex = arena.loopVertices[(loop.area > 0) == counterClockwise ? loop.begin + i : loop.end - 1 - i];
+			last = insertNode(n, vertex, vertices[vertex], last);
+		}
+		return last;
+	}
+
+	bool isPointInLoop(const Ved2& point, const PolygonTriangulator::Arena& arena, const std::vector<Ved2>& vertices, const Loop& loop)
+	{
+		bool inside = false;
+		for (uint32_t i = loop.begin, j = loop.end - 1; i < loop.end; j = i++)
+		{
+			const Ved2& a = vertices[arena.loopVertices[i]];
+			const Ved2& b = vertices[arena.loopVertices[j]];
+			if ((a.y > point.y) != (b.y > point.y) && point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x) inside = !inside;
+		}
+		return inside;
+	}
+}
+
+bool PolygonTriangulator::triangulateIndexed(const std::vector<Line>& lines, Arena& arena, IndexedTriangles& out)
+{
+	out.vertices.clear();
+	out.indices.clear();
+
+	//lines only share vertices by position
+	arena.endpoints.clear();
+	for (uint32_t i = 0; i < lines.size(); ++i)
+	{
+		arena.endpoints.push_back({ lines[i].start, 2 * i });
+		arena.endpoints.push_back({ lines[i].end, 2 * i + 1 });
+	}
+	std::sort(arena.endpoints.begin(), arena.endpoints.end(), [](const auto& a, const auto& b) { return a.first.x < b.first.x || (a.first.x == b.first.x && a.first.y < b.first.y); });
+	arena.edges.resize(lines.size());
+	for (size_t i = 0; i < arena.endpoints.size(); ++i)
+	{
+		if (i == 0 || !(arena.endpoints[i].first == arena.endpoints[i - 1].first)) out.vertices.push_back(arena.endpoints[i].first);
+		arena.edges[arena.endpoints[i].second / 2][arena.endpoints[i].second % 2] = out.vertices.size() - 1;
+	}
+
+	size_t vertexCount = out.vertices.size();
+	arena.edgeOffsets.assign(vertexCount + 1, 0);
+	for (const auto& e : arena.edges)
+	{
+		if (e[0] == e[1]) continue;
+		arena.edgeOffsets[e[0] + 1]++;
+		arena.edgeOffsets[e[1] + 1]++;
+	}
+	for (size_t i = 0; i < vertexCount; ++i) arena.edgeOffsets[i + 1] += arena.edgeOffsets[i];
+	arena.edgeCursors.assign(arena.edgeOffsets.begin(), arena.edgeOffsets.end() - 1);
+	arena.incidentEdges.resize(arena.edgeOffsets.back());
+	arena.edgeUsed.assign(arena.edges.size(), 0);
+	for (uint32_t i = 0; i < arena.edges.size(); ++i)
+	{
+		const auto& e = arena.edges[i];
+		if (e[0] == e[1])
+		{
+			arena.edgeUsed[i] = 1;
+			continue;
+		}
+		arena.incidentEdges[arena.edgeCursors[e[0]]++] = i;
+		arena.incidentEdges[arena.edgeCursors[e[1]]++] = i;
+	}
+
+	//split the edges into closed loops by walking unused edges, and cutting off a loop whenever the walk comes back to a vertex on it's path. Dead ends are backed out of
+	arena.pathPositions.assign(vertexCount, -1);
+	arena.loopVertices.clear();
+	arena.loops.clear();
+	for (uint32_t firstEdge = 0; firstEdge < arena.edges.size(); ++firstEdge)
+	{
+		if (arena.edgeUsed[firstEdge]) continue;
+		arena.path.assign(1, arena.edges[firstEdge][0]);
+		arena.pathPositions[arena.path[0]] = 0;
+		while (!arena.path.empty())
+		{
+			uint32_t current = arena.path.back();
+			uint32_t nextVertex = noNode;
+			for (uint32_t i = arena.edgeOffsets[current]; i < arena.edgeOffsets[current + 1]; ++i)
+			{
+				uint32_t e = arena.incidentEdges[i];
+				if (arena.edgeUsed[e]) continue;
+				arena.edgeUsed[e] = 1;
+				nextVertex = arena.edges[e][0] == current ? arena.edges[e][1] : arena.edges[e][0];
+				break;
+			}
+			if (nextVertex == noNode)
+			{
+				arena.pathPositions[current] = -1;
+				arena.path.pop_back();
+				continue;
+			}
+			if (arena.pathPositions[nextVertex] < 0)
+			{
+				arena.pathPositions[nextVertex] = arena.path.size();
+				arena.path.push_back(nextVertex);
+				continue;
+			}
+
+			size_t loopBegin = arena.pathPositions[nextVertex];
+			Loop loop = { uint32_t(arena.loopVertices.size()), 0, 0, 0, 0 };
+			for (size_t i = loopBegin; i < arena.path.size(); ++i)
+			{
+				arena.loopVertices.push_back(arena.path[i]);
+				if (i > loopBegin) arena.pathPositions[arena.path[i]] = -1;
+			}
+			loop.end = arena.loopVertices.size();
+			for (uint32_t i = loop.begin, j = loop.end - 1; i < loop.end; j = i++)
+			{
+				const Ved2& a = out.vertices[arena.loopVertices[j]];
+				const Ved2& b = out.vertices[arena.loopVertices[i]];
+				loop.area += (a.x * b.y - b.x * a.y) / 2;
+			}
+			if (std::abs(loop.area) > 1e-9) arena.loops.push_back(loop); //lines going there and back, like two sided linedefs within one sector, enclose nothing
+			else arena.loopVertices.resize(loop.begin);
+			arena.path.resize(loopBegin + 1);
+		}
+	}
+
+	//loops inside an odd number of others are holes of the smallest loop around them, one level up
+	auto getSamplePoint = [&](const Loop& loop) { //just inside the loop, so touching loops don't count as containing each other
+		const Ved2& a = out.vertices[arena.loopVertices[loop.begin]];
+		const Ved2& b = out.vertices[arena.loopVertices[loop.begin + 1]];
+		Ved2 inward = Ved2(a.y - b.y, b.x - a.x) * ((loop.area > 0 ? 1.0 : -1.0) / (b - a).len());
+		return (a + b) / 2.0 + inward * 1e-6;
+	};
+	for (Loop& loop : arena.loops)
+	{
+		Ved2 samplePoint = getSamplePoint(loop);
+		loop.depth = 0;
+		for (const Loop& other : arena.loops) loop.depth += &other != &loop && isPointInLoop(samplePoint, arena, out.vertices, other);
+	}
+	double expectedArea = 0;
+	for (Loop& loop : arena.loops)
+	{
+		loop.parent = noNode;
+		expectedArea += loop.depth % 2 == 0 ? std::abs(loop.area) : -std::abs(loop.area);
+		if (loop.depth % 2 == 0) continue;
+		Ved2 samplePoint = getSamplePoint(loop);
+		for (uint32_t i = 0; i < arena.loops.size(); ++i)
+		{
+			const Loop& other = arena.loops[i];
+			if (other.depth != loop.depth - 1 || !isPointInLoop(samplePoint, arena, out.vertices, other)) continue;
+			if (loop.parent == noNode || std::abs(other.area) < std::abs(arena.loops[loop.parent].area)) loop.parent = i;
+		}
+		if (loop.parent == noNode) return false;
+	}
+
+	for (uint32_t outer = 0; outer < arena.loops.size(); ++outer)
+	{
+		if (arena.loops[outer].depth % 2 != 0) continue;
+		arena.nodes.clear();
+		uint32_t outerNode = linkLoop(arena.nodes, arena, out.vertices, arena.loops[outer], true);
+
+		//holes are bridged from left to right, so later bridges can't cross earlier ones
+		arena.holeNodes.clear();
+		for (const Loop& hole : arena.loops)
+		{
+			if (hole.parent != outer) continue;
+			uint32_t p = linkLoop(arena.nodes, arena, out.vertices, hole, false);
+			uint32_t leftmost = p;
+			for (uint32_t q = arena.nodes[p].next; q != p; q = arena.nodes[q].next)
+			{
+				const Node& n = arena.nodes[q];
+				if (n.x < arena.nodes[leftmost].x || (n.x == arena.nodes[leftmost].x && n.y < arena.nodes[leftmost].y)) leftmost = q;
+			}
+			arena.holeNodes.push_back(leftmost);
+		}
+		std::sort(arena.holeNodes.begin(), arena.holeNodes.end(), [&](uint32_t a, uint32_t b) {
+			const Node& na = arena.nodes[a];
+			const Node& nb = arena.nodes[b];
+			return na.x < nb.x || (na.x == nb.x && na.y < nb.y);
+		});
+		for (uint32_t hole : arena.holeNodes) outerNode = eliminateHole(arena.nodes, hole, outerNode);
+
+		ZOrderGrid grid = { 0, 0, 0 };
+		if (arena.nodes.size() > zOrderMinVertices)
+		{
+			double maxX = -std::numeric_limits<double>::infinity(), maxY = -std::numeric_limits<double>::infinity();
+			grid.minX = grid.minY = std::numeric_limits<double>::infinity();
+			const Loop& loop = arena.loops[outer];
+			for (uint32_t i = loop.begin; i < loop.end; ++i)
+			{
+				const Ved2& v = out.vertices[arena.loopVertices[i]];
+				grid.minX = std::min(grid.minX, v.x);
+				grid.minY = std::min(grid.minY, v.y);
+				maxX = std::max(maxX, v.x);
+				maxY = std::max(maxY, v.y);
+			}
+			double size = std::max(maxX - grid.minX, maxY - grid.minY);
+			grid.invSize = size != 0 ? 32767 / size : 0;
+		}
+		earcutLinked(arena.nodes, outerNode, out.indices, grid, 0);
+	}
+
+	//whatever earcut couldn't make sense of shows up as missing or extra area
+	double triangulatedArea = 0;
+	for (size_t i = 0; i < out.indices.size(); i += 3)
+	{
+		const Ved2& a = out.vertices[out.indices[i]];
+		const Ved2& b = out.vertices[out.indices[i + 1]];
+		const Ved2& c = out.vertices[out.indices[i + 2]];
+		triangulatedArea += std::abs((b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y)) / 2;
+	}
+	if (std::abs(triangulatedArea - expectedArea) > 1e-6 * std::max(expectedArea, 1.0))
+	{
+		out.vertices.clear();
+		out.indices.clear();
+		return false;
+	}
+	return true;
+}
@@ -2,6 +2,7 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <cstdint>
 
 #include "PixelBuffer.h"
 #include "Vec.h"
@@ -9,9 +10,47 @@
 
 class PolygonBitmap;
 
+struct IndexedTriangles
+{
+	std::vector<Ved2> vertices;
+	std::vector<uint32_t> indices; //3 per triangle, counter clockwise
+};
+
 class PolygonTriangulator
 {
 public:
-	static std::vector<Ved2> triangulate(Polygon polygon);
-private:
-};
\ No newline at end of file
+	//scratch memory of triangulateIndexed. Keeping one per thread means triangulating doesn't allocate once it has grown to fit the biggest polygon
+	struct Arena
+	{
+		struct Node //vertex of a ring being clipped
+		{
+			double x, y;
+			uint32_t vertex;
+			uint32_t prev, next;
+			uint32_t z; //position on a z-order curve, big rings look for points inside ears only between the ear's bounds on it
+			uint32_t prevZ, nextZ;
+		};
+		struct Loop
+		{
+			uint32_t begin, end; //range in loopVertices
+			double area; //positive for counter clockwise
+			int depth; //number of other loops it's inside of, odd for holes
+			uint32_t parent; //the outer loop a hole belongs to
+		};
+
+		std::vector<std::pair<Ved2, uint32_t>> endpoints;
+		std::vector<std::array<uint32_t, 2>> edges;
+		std::vector<uint32_t> edgeOffsets, edgeCursors, incidentEdges;
+		std::vector<uint8_t> edgeUsed;
+		std::vector<int32_t> pathPositions;
+		std::vector<uint32_t> path, loopVertices;
+		std::vector<Loop> loops;
+		std::vector<Node> nodes;
+		std::vector<uint32_t> holeNodes;
+	};
+
+	static std::vector<Ved2> triangulate(Polygon polygon); //GLU tessellator with the nonzero winding rule, 3 vertices per triangle
+	//ear clipping with holes bridged into their outer loop, with the even-odd rule. Lines don't need any order or direction, and lines not closing a loop are ignored.
+	//False if the polygon is too broken for it, out is empty then
+	static bool triangulateIndexed(const std::vector<Line>& lines, Arena& arena, IndexedTriangles& out);
+};
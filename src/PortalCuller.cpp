@@ -0,0 +1,151 @@
+#include "PortalCuller.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "helpers.h"
+
+PortalCuller::PortalCuller(const DoomMap& map)
+{
+	this->map = &map;
+	this->sectorPortals.resize(map.sectors.size());
+	for (const Sector& sector : map.sectors) this->skyCeilings.push_back(wadStrToStd(sector.ceilingTexture) == "F_SKY1");
+
+	for (const Linedef& linedef : map.linedefs)
+	{
+		if (linedef.frontSidedef == -1 || linedef.backSidedef == -1) continue;
+		int frontSector = map.sidedefs[linedef.frontSidedef].facingSector;
+		int backSector = map.sidedefs[linedef.backSidedef].facingSector;
+		if (frontSector == backSector) continue;
+
+		const Vertex& v1 = map.vertices[linedef.startVertex];
+		const Vertex& v2 = map.vertices[linedef.endVertex];
+		this->sectorPortals[frontSector].push_back({ double(v1.x), double(v1.y), double(v2.x), double(v2.y), backSector });
+		this->sectorPortals[backSector].push_back({ double(v2.x), double(v2.y), double(v1.x), double(v1.y), frontSector });
+	}
+}
+
+bool PortalCuller::findVisibleSectors(const Camera& pov, real aspectRatio, real fovMult, real nearPlaneZ, std::vector<bool>& visibleSectors)
+{
+	int cameraSector = this->findCameraSector(pov.pos);
+	if (cameraSector < 0) return false;
+
+	this->ctr.prepare(pov.pos, pov.angle);
+	this->viewPos = pov.pos;
+	this->fovMult = fovMult;
+	this->nearPlaneZ = nearPlaneZ;
+	//openings closer than the near plane's corners may be clipped away entirely while the camera looks right through them
+	real halfHeightPerDistance = 1 / (2 * fovMult);
+	real halfWidthPerDistance = halfHeightPerDistance * aspectRatio;
+	this->nearPlaneCornerDistance = -nearPlaneZ * std::sqrt(1 + halfWidthPerDistance * halfWidthPerDistance + halfHeightPerDistance * halfHeightPerDistance);
+
+	this->processedWindows.assign(this->map->sectors.size(), {});
+	this->lastPortalTraversalCount = 0;
+	std::vector<bool> reachedSectors(this->map->sectors.size(), false);
+	BoundingBox screen = { -aspectRatio / 2, -0.5, aspectRatio / 2, 0.5 }; //in screen space, before the shift to pixels
+	if (!this->visitSector(cameraSector, screen, reachedSectors)) return false;
+
+	visibleSectors = std::move(reachedSectors);
+	this->lastVisibleSectorCount = std::count(visibleSectors.begin(), visibleSectors.end(), true);
+	return true;
+}
+
+int PortalCuller::findCameraSector(const Vec4& pos) const
+{
+	if (!this->map) return -1;
+	//the closest linedef crossed by a ray going right from the camera bounds the camera's sector, on the side facing the camera
+	double closestDistance = std::numeric_limits<double>::infinity();
+	int ret = -1;
+	for (const Linedef& linedef : this->map->linedefs)
+	{
+		const Vertex& v1 = this->map->vertices[linedef.startVertex];
+		const Vertex& v2 = this->map->vertices[linedef.endVertex];
+		if ((v1.y <= pos.z) == (v2.y <= pos.z)) continue;
+		double crossingX = v1.x + (pos.z - v1.y) * (v2.x - v1.x) / double(v2.y - v1.y);
+		if (crossingX <= pos.x || crossingX - pos.x >= closestDistance) continue;
+
+		closestDistance = crossingX - pos.x;
+		bool onFrontSide = double(v2.x - v1.x) * (pos.z - v1.y) - double(v2.y - v1.y) * (pos.x - v1.x) < 0;
+		int sidedef = onFrontSide ? linedef.frontSidedef : linedef.backSidedef;
+		ret = sidedef == -1 ? -1 : this->map->sidedefs[sidedef].facingSector;
+	}
+
+	if (ret < 0) return -1;
+	const Sector& sector = this->map->sectors[ret];
+	if (pos.y <= sector.floorHeight || pos.y >= sector.ceilingHeight) return -1;
+	return ret;
+}
+
+size_t PortalCuller::getLastPortalTraversalCount() const
+{
+	return this->lastPortalTraversalCount;
+}
+
+size_t PortalCuller::getLastVisibleSectorCount() const
+{
+	return this->lastVisibleSectorCount;
+}
+
+bool PortalCuller::visitSector(int sector, const BoundingBox& window, std::vector<bool>& visibleSectors)
+{
+	//windows only shrink along a path, so coming back to a sector through a window it was already flooded from can't reach anything new. This also ends cycles
+	for (const BoundingBox& it : this->processedWindows[sector])
+	{
+		if (it.minX <= window.minX && it.minY <= window.minY && it.maxX >= window.maxX && it.maxY >= window.maxY) return true;
+	}
+	this->processedWindows[sector].push_back(window);
+	visibleSectors[sector] = true;
+
+	for (const Portal& portal : this->sectorPortals[sector])
+	{
+		std::optional<BoundingBox> portalWindow = this->getPortalWindow(portal, sector, window);
+		if (!portalWindow) continue;
+		if (++this->lastPortalTraversalCount > maxPortalTraversals) return false;
+		if (!this->visitSector(portal.toSector, portalWindow.value(), visibleSectors)) return false;
+	}
+	return true;
+}
+
+std::optional<BoundingBox> PortalCuller::getPortalWindow(const Portal& portal, int fromSector, const BoundingBox& window) const
+{
+	const Sector& from = this->map->sectors[fromSector];
+	const Sector& to = this->map->sectors[portal.toSector];
+	real bottom = std::max(from.floorHeight, to.floorHeight);
+	real top = std::min(from.ceilingHeight, to.ceilingHeight);
+	if (this->skyCeilings[fromSector] && this->skyCeilings[portal.toSector]) top = std::max(from.ceilingHeight, to.ceilingHeight); //sky isn't drawn, so the higher sector's walls show above the lower sky
+	if (top <= bottom) return std::nullopt; //closed door or lift
+
+	double cx = this->viewPos.x, cy = this->viewPos.z;
+	double dx = portal.x2 - portal.x1, dy = portal.y2 - portal.y1;
+	double t = std::clamp(((cx - portal.x1) * dx + (cy - portal.y1) * dy) / (dx * dx + dy * dy), 0.0, 1.0);
+	if (std::hypot(portal.x1 + t * dx - cx, portal.y1 + t * dy - cy) <= this->nearPlaneCornerDistance) return window;
+	if (dx * (cy - portal.y1) - dy * (cx - portal.x1) >= 0) return std::nullopt; //seen from behind, it leads back to where the flood came from
+
+	Vec4 corners[4] = {
+		Vec4(portal.x1, bottom, portal.y1, 1),
+		Vec4(portal.x2, bottom, portal.y2, 1),
+		Vec4(portal.x2, top, portal.y2, 1),
+		Vec4(portal.x1, top, portal.y1, 1),
+	};
+	Vec4 clipped[8];
+	int clippedCount = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		Vec4 a = this->ctr.rotateAndTranslate(corners[i]);
+		Vec4 b = this->ctr.rotateAndTranslate(corners[(i + 1) % 4]);
+		bool aInside = a.z <= this->nearPlaneZ, bInside = b.z <= this->nearPlaneZ;
+		if (aInside) clipped[clippedCount++] = a;
+		if (aInside != bInside) clipped[clippedCount++] = a + (b - a) * ((this->nearPlaneZ - a.z) / (b.z - a.z));
+	}
+	if (!clippedCount) return std::nullopt;
+
+	BoundingBox ret = { std::numeric_limits<real>::infinity(), std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity() };
+	for (int i = 0; i < clippedCount; ++i)
+	{
+		Vec4 p = clipped[i] * (this->fovMult / clipped[i].z);
+		ret = { std::min(ret.minX, p.x), std::min(ret.minY, p.y), std::max(ret.maxX, p.x), std::max(ret.maxY, p.y) };
+	}
+	ret = { std::max(ret.minX, window.minX), std::max(ret.minY, window.minY), std::min(ret.maxX, window.maxX), std::min(ret.maxY, window.maxY) };
+	if (ret.minX > ret.maxX || ret.minY > ret.maxY) return std::nullopt;
+	return ret;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <optional>
+
+#include "DoomMap.h"
+#include "Camera.h"
+#include "CoordinateTransformer.h"
+
+//Finds the sectors that may be visible by flooding from the camera's sector through the openings of two sided linedefs.
+//Every opening passed on the way clips the screen space window the next sector is seen through, and openings outside the current window are not followed.
+//Needs only linedefs, sidedefs and sectors, so it works on maps without BSP or REJECT data. Windows are rectangles, which keeps it conservative
+class PortalCuller
+{
+public:
+	static constexpr size_t maxPortalTraversals = 1 << 16; //some levels have so many cycles of openings that flooding takes longer than drawing everything, it gives up then
+
+	PortalCuller() = default;
+	PortalCuller(const DoomMap& map); //the map must outlive the culler. Sector heights are read on every call, so moving sectors are fine
+
+	bool findVisibleSectors(const Camera& pov, real aspectRatio, real fovMult, real nearPlaneZ, std::vector<bool>& visibleSectors); //false if nothing can be culled from here, visibleSectors is left untouched then
+	int findCameraSector(const Vec4& pos) const; //-1 if the camera is outside the level, or above or below it's sector
+	size_t getLastPortalTraversalCount() const;
+	size_t getLastVisibleSectorCount() const;
+private:
+	struct Portal
+	{
+		double x1, y1, x2, y2; //the owning sector is on the front side, to the right
+		int toSector;
+	};
+
+	const DoomMap* map = nullptr;
+	std::vector<std::vector<Portal>> sectorPortals;
+	std::vector<bool> skyCeilings;
+
+	CoordinateTransformer ctr;
+	Vec4 viewPos;
+	real fovMult = 1, nearPlaneZ = -1, nearPlaneCornerDistance = 1;
+	std::vector<std::vector<BoundingBox>> processedWindows; //windows every sector was already flooded from, per sector
+	size_t lastPortalTraversalCount = 0, lastVisibleSectorCount = 0;
+
+	bool visitSector(int sector, const BoundingBox& window, std::vector<bool>& visibleSectors); //false once maxPortalTraversals is exceeded
+	std::optional<BoundingBox> getPortalWindow(const Portal& portal, int fromSector, const BoundingBox& window) const; //the part of window seen through the portal, if any
+};
@@ -0,0 +1,153 @@
+#include "LightClusters.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void LightClusters::build(const std::vector<PointLight>& lights, const CoordinateTransformer& ctr, int w, int h, real fovMult, real nearPlaneZ)
+{
+	this->tilesX = (w + tileSize - 1) / tileSize;
+	this->tilesY = (h + tileSize - 1) / tileSize;
+	size_t clusterCount = size_t(this->tilesX) * this->tilesY * sliceCount;
+
+	struct ClusterRange
+	{
+		int minTileX, minTileY, maxTileX, maxTileY, minSlice, maxSlice;
+	};
+	std::vector<ClusterRange> ranges;
+	this->lights.clear();
+
+	for (const PointLight& light : lights)
+	{
+		real range = light.getRange();
+		if (range <= 0) continue;
+		Vec4 center = light.pos;
+		center.w = 1;
+		center = ctr.rotateAndTranslate(center);
+
+		//view distance is -z, the same thing pixels compare against, so no sqrt is involved
+		real minDistance = -center.z - range;
+		real maxDistance = -center.z + range;
+		if (maxDistance <= -nearPlaneZ) continue; //entirely behind the camera
+
+		ClusterRange r = { 0, 0, this->tilesX - 1, this->tilesY - 1, getSlice(std::max<real>(minDistance, 0)), getSlice(maxDistance) };
+		if (minDistance > -nearPlaneZ)
+		{
+			//the bounding cube of the sphere is fully in front of the camera, so the projection of it's corners bounds the sphere on screen.
+			//Spheres crossing the near plane can cover any part of the screen
+			real minX = std::numeric_limits<real>::infinity(), minY = minX, maxX = -minX, maxY = -minX;
+			for (int corner = 0; corner < 8; ++corner)
+			{
+				Vec4 v = center + Vec4(corner & 1 ? range : -range, corner & 2 ? range : -range, corner & 4 ? range : -range, 0);
+				Vec4 p = ctr.screenSpaceToPixels(v * (fovMult / v.z));
+				minX = std::min(minX, p.x);
+				minY = std::min(minY, p.y);
+				maxX = std::max(maxX, p.x);
+				maxY = std::max(maxY, p.y);
+			}
+			if (maxX < 0 || maxY < 0 || minX > w - 1 || minY > h - 1) continue;
+			r.minTileX = std::max(int(minX) / tileSize, 0);
+			r.minTileY = std::max(int(minY) / tileSize, 0);
+			r.maxTileX = std::min(int(maxX) / tileSize, this->tilesX - 1);
+			r.maxTileY = std::min(int(maxY) / tileSize, this->tilesY - 1);
+		}
+
+		Vec4 power = light.color * light.intensity;
+		power.w = 0;
+		Vec4 pos = light.pos;
+		pos.w = 1;
+		this->lights.push_back({ pos, power, 1 / (range * range) });
+		ranges.push_back(r);
+	}
+
+	//counted first, then filled in, so all lists live in one flat array
+	this->clusterOffsets.assign(clusterCount + 1, 0);
+	auto forEachCluster = [&](const ClusterRange& r, auto func) {
+		for (int tileY = r.minTileY; tileY <= r.maxTileY; ++tileY)
+		{
+			for (int tileX = r.minTileX; tileX <= r.maxTileX; ++tileX)
+			{
+				for (int slice = r.minSlice; slice <= r.maxSlice; ++slice) func((size_t(tileY) * this->tilesX + tileX) * sliceCount + slice);
+			}
+		}
+	};
+	for (const auto& r : ranges) forEachCluster(r, [&](size_t cluster) { this->clusterOffsets[cluster + 1]++; });
+	for (size_t i = 0; i < clusterCount; ++i) this->clusterOffsets[i + 1] += this->clusterOffsets[i];
+
+	this->clusterLightIndices.resize(this->clusterOffsets.back());
+	std::vector<uint32_t> fillPositions(this->clusterOffsets.begin(), this->clusterOffsets.end() - 1);
+	for (uint32_t i = 0; i < ranges.size(); ++i) forEachCluster(ranges[i], [&](size_t cluster) { this->clusterLightIndices[fillPositions[cluster]++] = i; });
+}
+
+VectorPack16 LightClusters::getLightColors16(const FloatPack16& x, int y, const VectorPack16& worldCoords, const FloatPack16& viewDistance, Mask16 mask) const
+{
+	IntPack16 tileX = (IntPack16(_mm512_cvttps_epi32(x)) >> tileSizeShift).clamp(0, this->tilesX - 1);
+	IntPack16 clusters = (tileX + std::min(y / tileSize, this->tilesY - 1) * this->tilesX) * sliceCount + getSlices16(viewDistance);
+
+	//a pack nearly always falls into one or two clusters, so it loops over each distinct one with only the lanes inside it
+	VectorPack16 ret = 0;
+	Mask16 remainingLanes = mask;
+	while (remainingLanes)
+	{
+		uint32_t cluster = clusters[_tzcnt_u32(remainingLanes)];
+		Mask16 clusterLanes = remainingLanes & clusters == IntPack16(cluster);
+		ret += this->getClusterLightColors16(cluster, worldCoords, clusterLanes);
+		remainingLanes &= ~clusterLanes;
+	}
+	return ret;
+}
+
+VectorPack16 LightClusters::getClusterLightColors16(uint32_t cluster, const VectorPack16& worldCoords, Mask16 mask) const
+{
+	VectorPack16 ret = 0;
+	for (uint32_t i = this->clusterOffsets[cluster]; i < this->clusterOffsets[cluster + 1]; ++i)
+	{
+		const ClusteredLight& light = this->lights[this->clusterLightIndices[i]];
+		FloatPack16 distSquared = (worldCoords - VectorPack16(light.pos)).lenSq3d();
+		//inverse square falloff, windowed to reach exactly 0 at the light's range
+		FloatPack16 fade = (FloatPack16(1.0f) - distSquared * distSquared * (light.rcpRangeSq * light.rcpRangeSq)).clamp(0, 1);
+		FloatPack16 attenuation = fade * fade / _mm512_max_ps(distSquared, _mm512_set1_ps(1));
+		ret += VectorPack16(light.power) * attenuation;
+	}
+	ret.x = _mm512_maskz_mov_ps(mask, ret.x);
+	ret.y = _mm512_maskz_mov_ps(mask, ret.y);
+	ret.z = _mm512_maskz_mov_ps(mask, ret.z);
+	ret.w = _mm512_maskz_mov_ps(mask, ret.w);
+	return ret;
+}
+
+bool LightClusters::isEmpty() const
+{
+	return this->lights.empty();
+}
+
+size_t LightClusters::getLightCount() const
+{
+	return this->lights.size();
+}
+
+size_t LightClusters::getMaxLightsPerCluster() const
+{
+	size_t ret = 0;
+	for (size_t i = 0; i + 1 < this->clusterOffsets.size(); ++i) ret = std::max<size_t>(ret, this->clusterOffsets[i + 1] - this->clusterOffsets[i]);
+	return ret;
+}
+
+real LightClusters::getAverageLightsPerOccupiedCluster() const
+{
+	size_t occupied = 0;
+	for (size_t i = 0; i + 1 < this->clusterOffsets.size(); ++i) occupied += this->clusterOffsets[i + 1] != this->clusterOffsets[i];
+	return occupied ? real(this->clusterLightIndices.size()) / occupied : 0;
+}
+
+int LightClusters::getSlice(real viewDistance)
+{
+	if (viewDistance < 1) return 0;
+	return std::clamp(std::ilogb(viewDistance) - firstSliceExponent, 0, sliceCount - 1);
+}
+
+IntPack16 LightClusters::getSlices16(const FloatPack16& viewDistance)
+{
+	//getexp gives floor(log2(x)) as a float, the same as ilogb. Distances below 1 can only be in slice 0 anyway
+	FloatPack16 exponents = _mm512_getexp_ps(_mm512_max_ps(viewDistance, _mm512_set1_ps(1)));
+	return (IntPack16(_mm512_cvttps_epi32(exponents)) - firstSliceExponent).clamp(0, sliceCount - 1);
+}
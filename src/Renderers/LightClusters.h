@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "../PointLight.h"
+#include "../CoordinateTransformer.h"
+#include "../VectorPack.h"
+#include "../IntPack16.h"
+
+//Assigns point lights to clusters: screen tiles split further into slices of view distance, so each pixel only loops over the lights that can reach it.
+//Slices are a power of 2 deep each, which keeps them thin near the camera and lets pixels find theirs from the float exponent alone.
+//Every light fades out to nothing at it's range, so a light missing from a cluster is exactly the same as a light contributing nothing there.
+class LightClusters
+{
+public:
+	static constexpr int tileSizeShift = 6;
+	static constexpr int tileSize = 1 << tileSizeShift;
+	static constexpr int sliceCount = 16;
+	static constexpr int firstSliceExponent = 4; //slice 0 is everything closer than 2^(firstSliceExponent+1), the last one everything beyond it's start
+
+	void build(const std::vector<PointLight>& lights, const CoordinateTransformer& ctr, int w, int h, real fovMult, real nearPlaneZ);
+	VectorPack16 getLightColors16(const FloatPack16& x, int y, const VectorPack16& worldCoords, const FloatPack16& viewDistance, Mask16 mask) const; //summed contributions of all lights, 0 for lanes outside of mask
+
+	bool isEmpty() const;
+	size_t getLightCount() const;
+	size_t getMaxLightsPerCluster() const;
+	real getAverageLightsPerOccupiedCluster() const;
+private:
+	struct ClusteredLight
+	{
+		Vec4 pos;
+		Vec4 power; //color times intensity
+		real rcpRangeSq;
+	};
+
+	int tilesX = 0, tilesY = 0;
+	std::vector<ClusteredLight> lights;
+	std::vector<uint32_t> clusterOffsets; //lights of cluster i are clusterLightIndices[clusterOffsets[i]..clusterOffsets[i+1]-1]
+	std::vector<uint32_t> clusterLightIndices;
+
+	static int getSlice(real viewDistance);
+	static IntPack16 getSlices16(const FloatPack16& viewDistance);
+	VectorPack16 getClusterLightColors16(uint32_t cluster, const VectorPack16& worldCoords, Mask16 mask) const;
+};
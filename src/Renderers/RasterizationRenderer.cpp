@@ -4,23 +4,27 @@
 #include "../Statsman.h"
 #include "../shaders/MainFragmentRenderShader.h"
 #include "../blitting.h"
+#include "../DitherTable.h"
 #include <sstream>
+#include <cfloat>
 #include "../ShadowMap.h"
+#include "../CascadedShadowMap.h"
+#include "../Lightmap.h"
 
-RasterizationRenderer::RasterizationRenderer(int w, int h, Threadpool& threadpool, bool depthOnly)
+RasterizationRenderer::RasterizationRenderer(int w, int h, Threadpool& threadpool, bool depthOnly, DepthFormat depthFormat)
 {
-	this->zBuffer = { w,h };
-	if (!depthOnly)
-	{
-		this->frameBuf = { w,h };
-		this->pixelWorldPosBuf = { w,h };
-	}
+	this->zBuffer = ZBuffer(w, h, depthFormat);
+	this->zBuffer.firstTouch(threadpool); //color buffers are allocated on first use, since depth only and direct output rendering don't need them
+	if (!depthOnly) DitherTable::getBlueNoise(); //generate the table now rather than stalling the first frame
 	this->threadpool = &threadpool;
 	this->ctr = { w,h };
 
 	this->renderJobs.resize(threadpool.getThreadCount());
 	this->rngSources.resize(threadpool.getThreadCount());
 	this->filteredJobIndices.resize(threadpool.getThreadCount());
+	this->lightSpaceVertices.resize(threadpool.getThreadCount());
+	this->deferredShadowScratch.resize(threadpool.getThreadCount());
+	this->columnDepthScratch.resize(threadpool.getThreadCount());
 	for (auto& it : this->filteredJobIndices) it.resize(threadpool.getThreadCount());
 }
 
@@ -32,12 +36,24 @@ void RasterizationRenderer::drawScene(const std::vector<const Model*>& models, S
 void RasterizationRenderer::drawScene(const std::vector<const Model*>& models, SDL_Surface* dstSurf, const GameSettings& gameSettings, const Camera& pov, bool depthOnly)
 {
 	this->currFrameGameSettings = gameSettings; 
+	this->frameNumber++;
+	if (this->frameNumber > 1) this->zBuffer.beginNewGeneration(); //Z buffer has to be cleared, else only pixels closer than previous frame will draw. A fresh one is already clear
 	size_t threadCount = threadpool->getThreadCount();
 	std::vector<ModelSlice> distributedSlices = this->distributeTrianglesForWorkers(models, threadCount);
 	this->ctr.prepare(pov.pos, pov.angle);
 	std::array<uint32_t, 4> surfaceShifts;
 	if (dstSurf) surfaceShifts = this->getShiftsForSurface(dstSurf);
 
+	this->prepareShadowMapsForFrame(depthOnly);
+	this->currFramePointLights = !depthOnly && gameSettings.pointLightsEnabled && this->pointLights && !this->pointLights->empty();
+	if (this->currFramePointLights) this->lightClusters.build(*this->pointLights, this->ctr, this->zBuffer.getW(), this->zBuffer.getH(), gameSettings.fovMult, gameSettings.nearPlaneZ);
+	this->currFrameDeferredPointLights = this->currFramePointLights && this->currFrameDeferredShadows;
+	bool directOutput = this->canOutputDirectlyInto(dstSurf, depthOnly);
+	this->currFrameDirectOutput = directOutput;
+	this->currFrameDstSurf = dstSurf;
+	this->currFrameSurfaceShifts = surfaceShifts;
+	if (!depthOnly) this->prepareColorBuffers(directOutput);
+
 	std::vector<task_id> transformTasks, drawTasks;
 	for (int tNum = 0; tNum < threadCount; ++tNum)
 	{
@@ -57,37 +73,39 @@ void RasterizationRenderer::drawScene(const std::vector<const Model*>& models, S
 		//It is, however, assumed that renderJobs vector remains in a valid state until all tasks are completed.
 		taskfunc_t f = [=]() {
 			int ssaaMult = this->currFrameGameSettings.ssaaMult;
-			int outputHeight = (depthOnly ? this->zBuffer.getH() : this->frameBuf.getH()) / ssaaMult;
+			int outputHeight = this->zBuffer.getH() / ssaaMult;
 			auto lim = threadpool->getLimitsForThread(tNum, 0, outputHeight);
 			int outputMinY = lim.first; //truncate limits to avoid fighting
 			int outputMaxY = lim.second;
 			int renderMinY = outputMinY * ssaaMult; //it is essential to caclulate rendering zone limits like this, to ensure there are no intersections in different threads
 			int renderMaxY = outputMaxY * ssaaMult;
 
-			this->zBuffer.clearRows(renderMinY, renderMaxY); //Z buffer has to be cleared, else only pixels closer than previous frame will draw
-			if (this->currFrameGameSettings.bufferCleaningEnabled)
-			{
-				//this->zBuffer.clearRows(renderMinY, renderMaxY);
-				//this->zBuffer.clearRows(renderMinY, renderMaxY, 1);
-			}
-
 			BoundingBox threadBox;
 			threadBox.minX = 0;
 			threadBox.minY = renderMinY;
-			threadBox.maxX = (depthOnly ? this->zBuffer.getW() : this->frameBuf.getW()) - 1;
+			threadBox.maxX = this->zBuffer.getW() - 1;
 			threadBox.maxY = renderMaxY - 1;
 
 			for (int giverThread = 0; giverThread < threadCount; ++giverThread)
 			{
 				for (const auto& rjIndex : this->filteredJobIndices[giverThread][tNum])
 				{
-					this->drawRenderJobSlice(this->renderJobs[giverThread][rjIndex], threadBox, depthOnly);
+					const RenderJob& rj = this->renderJobs[giverThread][rjIndex];
+					const Vec4* lightSpaceVertices = this->currFrameShadowMaps.empty() || this->currFrameDeferredShadows ? nullptr : &this->lightSpaceVertices[giverThread][rj.lightSpaceVerticesIndex];
+					this->drawRenderJobSlice(rj, lightSpaceVertices, threadBox, tNum, depthOnly);
 				}
 			}
 
+			//Z buffer tiles are cleared on first touch while drawing, so only the untouched ones are left to deal with.
+			//Done before the deferred shadows, since the half resolution pass resolves the lazy clears and every tile looks touched after
+			if (depthOnly) this->zBuffer.resolveLazyClears(renderMinY, renderMaxY);
+			else if (this->currFrameGameSettings.bufferCleaningEnabled) this->clearUntouchedColorTiles(renderMinY, renderMaxY);
+
+			if (this->currFrameDeferredShadows) this->applyDeferredShadows(renderMinY, renderMaxY, tNum);
+
 			//if (this->currFrameGameSettings.fogEnabled) blitting::applyFog(*ctx.frameBuffer, *ctx.pixelWorldPos, camPos, settings.fogIntensity / settings.fovMult, Vec4(0.7, 0.7, 0.7, 1), renderMinY, renderMaxY, settings.fogEffectVersion); //divide by fovMult to prevent FOV setting from messing with fog intensity
 			//threadpool->waitUntilTaskCompletes(windowUpdateTaskId);
-			if (dstSurf) blitting::frameBufferIntoSurface(this->frameBuf, dstSurf, outputMinY, outputMaxY, surfaceShifts, this->currFrameGameSettings.ditheringEnabled, ssaaMult, rngSources[tNum]);
+			if (dstSurf && !directOutput) blitting::frameBufferIntoSurface(this->frameBuf, dstSurf, outputMinY, outputMaxY, surfaceShifts, ssaaMult, this->getDitheringContext(tNum));
 		};
 
 		drawTasks.push_back(threadpool->addTask(f));
@@ -96,12 +114,19 @@ void RasterizationRenderer::drawScene(const std::vector<const Model*>& models, S
 	threadpool->waitForMultipleTasks(drawTasks);
 	for (auto& it : this->renderJobs) it.clear();
 	for (auto& it : this->filteredJobIndices) for (auto& it2 : it) it2.clear();
+	for (auto& it : this->lightSpaceVertices) it.clear();
 }
 
 std::vector<std::pair<std::string, std::string>> RasterizationRenderer::getAdditionalOSDInfo()
 {
 	return {
-		{"Render resolution", (std::stringstream() << this->frameBuf.getW() << "x" << this->frameBuf.getH() << " (" << this->currFrameGameSettings.ssaaMult << "x)").str()}
+		{"Render resolution", (std::stringstream() << this->zBuffer.getW() << "x" << this->zBuffer.getH() << " (" << this->currFrameGameSettings.ssaaMult << "x)").str()},
+		{"Surface output", this->currFrameDirectOutput ? "direct" : "through frame buffer"},
+		{"Depth buffer memory", this->zBuffer.getStorage().describe()},
+		{"Frame buffer memory", this->frameBuf.getStorage().describe()},
+		{"Shadow map memory", this->shadowMaps.empty() ? "none" : this->shadowMaps[0]->depthBuffer.getStorage().describe()},
+		{"Point lights", !this->currFramePointLights ? "disabled" : (std::stringstream() << this->lightClusters.getLightCount() << " in view, up to " << this->lightClusters.getMaxLightsPerCluster()
+			<< " per cluster, " << this->lightClusters.getAverageLightsPerOccupiedCluster() << " on average").str()},
 	};
 }
 
@@ -109,8 +134,9 @@ void RasterizationRenderer::saveBuffers()
 {
 	std::string s = std::to_string(__rdtsc());
 	//this->frameBuf.saveToFile("screenshots/" + s + "_framebuf.png");
+	this->zBuffer.resolveLazyClears(0, this->zBuffer.getH());
 	this->zBuffer.saveToFile("screenshots/" + s + "_zbuf.png");
-	this->shadowMaps[0]->depthBuffer.saveToFile("screenshots/" + s + "_shadow_map.png");
+	if (!this->currFrameShadowMaps.empty()) this->currFrameShadowMaps[0]->depthBuffer.saveToFile("screenshots/" + s + "_shadow_map.png");
 }
 
 const ZBuffer& RasterizationRenderer::getDepthBuffer() const
@@ -272,6 +298,20 @@ void RasterizationRenderer::addTriangleRangeToRenderQueue(const Triangle* pBegin
 			rj.boundingBox.minY = floor(screenMinY);
 			rj.boundingBox.maxY = ceil(screenMaxY);
 			rj.pModel = pModel;
+			rj.kernel = this->chooseRasterKernel(t, *pModel, rj.boundingBox);
+
+			//light space positions are linear in world space, so they can be divided by camera z once here and interpolated just like UVs
+			auto& lightSpace = this->lightSpaceVertices[workerNumber];
+			rj.lightSpaceVerticesIndex = lightSpace.size();
+			if (!this->currFrameDeferredShadows) for (const ShadowMap* shadowMap : this->currFrameShadowMaps)
+			{
+				for (int v = 0; v < 3; ++v)
+				{
+					Vec4 dividedWorldCoords = t.tv[v].worldCoords;
+					dividedWorldCoords.w = t.tv[v].textureCoords.z;
+					lightSpace.push_back(shadowMap->ctr.rotateAndTranslate(dividedWorldCoords));
+				}
+			}
 
 			BoundingBox clipped = this->clampBoundingBox(rj.boundingBox, screenBox);
 			int firstWorker = int(clipped.minY) * rcpPerThread;
@@ -296,6 +336,16 @@ int RasterizationRenderer::doWorldTransformationsAndClipping(const Triangle& tri
 		rotated.tv[i].textureCoords = triangle.tv[i].textureCoords;
 		rotated.tv[i].worldCoords = triangle.tv[i].spaceCoords;
 	}
+	if (this->currFrameBakedLighting && model.lightmap)
+	{
+		//the w components aren't used by UVs or world coords, so they carry the lightmap coords through clipping and perspective division
+		const auto& lightmapCoords = model.lightmap->getTriangleCoords(&triangle - model.getTriangles().data());
+		for (int i = 0; i < 3; ++i)
+		{
+			rotated.tv[i].textureCoords.w = lightmapCoords[i].x;
+			rotated.tv[i].worldCoords.w = lightmapCoords[i].y;
+		}
+	}
 
 	if (currFrameGameSettings.backfaceCullingEnabled && !model.noBackfaceCulling)
 	{
@@ -333,6 +383,42 @@ std::optional<Triangle> RasterizationRenderer::transformToScreenSpace(const Tria
 	return screenSpaceTriangle;
 }
 
+struct AttributePlane
+{
+	Vec4 origin, dx, dy; //value at pixel (0, 0), and it's change per pixel along each axis
+};
+
+static AttributePlane getAttributePlane(const Triangle& screenSpaceTriangle, Vec4 TexVertex::* attribute)
+{
+	const auto& tv = screenSpaceTriangle.tv;
+	Vec4 d1 = tv[1].spaceCoords - tv[0].spaceCoords;
+	Vec4 d2 = tv[2].spaceCoords - tv[0].spaceCoords;
+	Vec4 e1 = tv[1].*attribute - tv[0].*attribute;
+	Vec4 e2 = tv[2].*attribute - tv[0].*attribute;
+	real rcpDet = 1 / (d1.x * d2.y - d2.x * d1.y);
+
+	AttributePlane ret;
+	ret.dx = (e1 * d2.y - e2 * d1.y) * rcpDet;
+	ret.dy = (e2 * d1.x - e1 * d2.x) * rcpDet;
+	ret.origin = tv[0].*attribute - ret.dx * tv[0].spaceCoords.x - ret.dy * tv[0].spaceCoords.y;
+	return ret;
+}
+
+RasterizationRenderer::RasterKernel RasterizationRenderer::chooseRasterKernel(const Triangle& screenSpaceTriangle, const Model& model, const BoundingBox& boundingBox) const
+{
+	if (model.orientation == SurfaceOrientation::ANY) return RasterKernel::GENERIC;
+
+	//the orientation only says which kernel may fit, the camera decides whether depth is really constant along that axis.
+	//Depth that varies less than this over the whole triangle changes UVs by far less than a texel
+	constexpr real maxRelativeDepthChange = 1e-5;
+	const auto& tv = screenSpaceTriangle.tv;
+	AttributePlane depth = getAttributePlane(screenSpaceTriangle, &TexVertex::textureCoords);
+	real minDepth = std::min({ std::abs(tv[0].textureCoords.z), std::abs(tv[1].textureCoords.z), std::abs(tv[2].textureCoords.z) });
+	if (model.orientation == SurfaceOrientation::HORIZONTAL && std::abs(depth.dx.z) * (boundingBox.maxX - boundingBox.minX + 1) <= maxRelativeDepthChange * minDepth) return RasterKernel::CONSTANT_DEPTH_ROWS;
+	if (model.orientation == SurfaceOrientation::VERTICAL && std::abs(depth.dy.z) * (boundingBox.maxY - boundingBox.minY + 1) <= maxRelativeDepthChange * minDepth) return RasterKernel::CONSTANT_DEPTH_COLUMNS;
+	return RasterKernel::GENERIC;
+}
+
 std::array<uint32_t, 4> RasterizationRenderer::getShiftsForSurface(const SDL_Surface* surf) const
 {
 	//this is a stupid fix for everything becoming way too blue in debug mode specifically.
@@ -353,6 +439,69 @@ std::array<uint32_t, 4> RasterizationRenderer::getShiftsForSurface(const SDL_Sur
 	return shifts;
 }
 
+blitting::DitheringContext RasterizationRenderer::getDitheringContext(size_t workerNumber)
+{
+	blitting::DitheringContext ret;
+	ret.enabled = this->currFrameGameSettings.ditheringEnabled;
+	ret.mode = this->currFrameGameSettings.ditheringMode;
+	ret.rngSource = &this->rngSources[workerNumber];
+	ret.table = ret.mode == DitheringMode::ORDERED ? &DitherTable::getOrdered() : &DitherTable::getBlueNoise();
+	ret.frameNumber = this->frameNumber;
+	return ret;
+}
+
+bool RasterizationRenderer::canOutputDirectlyInto(const SDL_Surface* surf, bool depthOnly) const
+{
+	//direct output is only possible when every render pixel maps to exactly one surface pixel and nothing needs the float colors after rasterization
+	if (!surf || depthOnly || !this->currFrameGameSettings.directSurfaceOutputEnabled) return false;
+	if (this->currFrameGameSettings.ssaaMult != 1 || this->currFrameGameSettings.fogEnabled || this->currFrameDeferredShadows) return false;
+	if (surf->format->BytesPerPixel != 4 || surf->pitch != surf->w * 4) return false;
+	return surf->w == this->zBuffer.getW() && surf->h == this->zBuffer.getH();
+}
+
+void RasterizationRenderer::prepareColorBuffers(bool directOutput)
+{
+	int w = this->zBuffer.getW();
+	int h = this->zBuffer.getH();
+	if (!directOutput && this->frameBuf.getW() != w)
+	{
+		this->frameBuf = { w,h };
+		this->frameBuf.firstTouch(*this->threadpool);
+	}
+	if (this->currFrameGameSettings.fogEnabled && this->pixelWorldPosBuf.getW() != w)
+	{
+		this->pixelWorldPosBuf = { w,h };
+		this->pixelWorldPosBuf.firstTouch(*this->threadpool);
+	}
+	if (this->currFrameDeferredPointLights && this->pointLightBuf.getW() != w)
+	{
+		this->pointLightBuf = { w,h };
+		this->pointLightBuf.firstTouch(*this->threadpool);
+	}
+}
+
+void RasterizationRenderer::clearUntouchedColorTiles(int minY, int maxY)
+{
+	//pixels in tiles that weren't touched this frame still hold whatever was drawn during previous frames
+	constexpr int tileW = ZBuffer::lazyClearTileW;
+	int w = this->zBuffer.getW();
+	for (int y = minY; y < maxY; ++y)
+	{
+		for (int tileX = 0; tileX < this->zBuffer.getTilesPerRow(); ++tileX)
+		{
+			if (this->zBuffer.isTileTouched(tileX, y)) continue;
+			int xBegin = tileX * tileW;
+			int xEnd = std::min(xBegin + tileW, w);
+			if (this->currFrameDirectOutput)
+			{
+				uint32_t* rowStart = static_cast<uint32_t*>(this->currFrameDstSurf->pixels) + size_t(y) * w;
+				std::fill(rowStart + xBegin, rowStart + xEnd, 0);
+			}
+			else this->frameBuf.clearSpan(y, xBegin, xEnd);
+		}
+	}
+}
+
 BoundingBox RasterizationRenderer::clampBoundingBox(const BoundingBox& clampFrom, const BoundingBox& clampBy) const
 {
 	assert(offsetof(clampFrom, minX) == 0);
@@ -382,7 +531,206 @@ BoundingBox RasterizationRenderer::clampBoundingBox(const BoundingBox& clampFrom
 	return ret;
 }
 
-void RasterizationRenderer::drawRenderJobSlice(const RenderJob& renderJob, const BoundingBox& threadBox, bool depthOnly)
+void RasterizationRenderer::prepareShadowMapsForFrame(bool depthOnly)
+{
+	this->currFrameShadowMaps.clear();
+	this->currFrameShadowMapFarDistances.clear();
+	this->currFrameShadowsCascaded = !depthOnly && this->currFrameGameSettings.shadowMode == ShadowMode::CASCADED && this->shadowCascades;
+	this->currFrameBakedLighting = !depthOnly && this->currFrameGameSettings.shadowMode == ShadowMode::BAKED;
+	this->currFrameDeferredShadows = false;
+	if (depthOnly) return;
+
+	if (this->currFrameShadowsCascaded)
+	{
+		const auto& cascades = this->shadowCascades->getCascades();
+		for (size_t i = 0; i < cascades.size(); ++i)
+		{
+			this->currFrameShadowMaps.push_back(&cascades[i]);
+			this->currFrameShadowMapFarDistances.push_back(this->shadowCascades->getCascadeFarDistance(i));
+		}
+	}
+	else this->currFrameShadowMaps = this->shadowMaps;
+
+	//without shadow maps the inline path is trivial, and sampling per pixel would gain nothing.
+	//Baked lighting only looks at the maps for models without a lightmap, which a pass over all pixels can't tell apart
+	this->currFrameDeferredShadows = this->currFrameGameSettings.shadowPass != ShadowPass::INLINE && !this->currFrameShadowMaps.empty() && !this->currFrameBakedLighting;
+	this->currFrameCameraToLightSpace.clear();
+	if (this->currFrameDeferredShadows)
+	{
+		Matrix4 cameraToWorld = this->ctr.getCurrentInverseTransformationMatrix();
+		for (const ShadowMap* it : this->currFrameShadowMaps) this->currFrameCameraToLightSpace.push_back(it->ctr.getCurrentTransformationMatrix() * cameraToWorld);
+	}
+}
+
+template<typename LightSpaceGetter>
+FloatPack16 RasterizationRenderer::getShadowLightMults(LightSpaceGetter getDividedLightSpaceCoords, const FloatPack16& zInv, Mask16 mask) const
+{
+	const real litMult = sunLitMult;
+	const real shadowMult = sunShadowMult;
+
+	if (this->currFrameShadowsCascaded)
+	{
+		//every lane picks the first cascade that covers it's distance from the camera. Lanes beyond the last cascade stay lit
+		FloatPack16 viewDistance = FloatPack16(-this->currFrameGameSettings.fovMult) / zInv;
+		Mask16 remainingLanes = mask;
+		Mask16 pointsInShadow = 0;
+		for (size_t i = 0; i < this->currFrameShadowMaps.size() && remainingLanes; ++i)
+		{
+			Mask16 cascadeLanes = remainingLanes & viewDistance < this->currFrameShadowMapFarDistances[i];
+			if (cascadeLanes) pointsInShadow |= this->getPointsInShadow(*this->currFrameShadowMaps[i], getDividedLightSpaceCoords(i), zInv, cascadeLanes, false);
+			remainingLanes &= ~cascadeLanes;
+		}
+		return _mm512_mask_blend_ps(pointsInShadow, FloatPack16(litMult), FloatPack16(shadowMult));
+	}
+
+	if (this->currFrameShadowMaps.empty()) return litMult;
+	FloatPack16 ret = 0.0f;
+	for (size_t i = 0; i < this->currFrameShadowMaps.size(); ++i)
+	{
+		Mask16 pointsInShadow = this->getPointsInShadow(*this->currFrameShadowMaps[i], getDividedLightSpaceCoords(i), zInv, mask, true);
+		ret += _mm512_mask_blend_ps(pointsInShadow, FloatPack16(litMult), FloatPack16(shadowMult));
+	}
+	return ret;
+}
+
+FloatPack16 RasterizationRenderer::getDeferredShadowLightMults(const FloatPack16& x, const FloatPack16& y, const FloatPack16& zInv, Mask16 mask) const
+{
+	//rasterized attributes are camera space coords multiplied by zInv, so screen space x and y, fovMult and zInv itself are exactly that
+	VectorPack16 dividedCameraSpace = this->ctr.pixelsToScreenSpace16(VectorPack16(x, y, 0.0, 0.0));
+	dividedCameraSpace.z = this->currFrameGameSettings.fovMult;
+	dividedCameraSpace.w = zInv;
+
+	return this->getShadowLightMults([&](size_t i) { return this->currFrameCameraToLightSpace[i] * dividedCameraSpace; }, zInv, mask);
+}
+
+void RasterizationRenderer::applyDeferredShadows(int minY, int maxY, size_t workerNumber)
+{
+	if (this->currFrameGameSettings.shadowPass == ShadowPass::DEFERRED_HALF_RES) return this->applyHalfResDeferredShadows(minY, maxY, workerNumber);
+
+	int w = this->zBuffer.getW();
+	for (int y = minY; y < maxY; ++y)
+	{
+		for (int x = 0; x < w; x += 16)
+		{
+			if (!this->zBuffer.isTileTouched(x / ZBuffer::lazyClearTileW, y)) continue; //nothing was drawn there this frame
+			FloatPack16 xCoords = FloatPack16::sequence() + x;
+			FloatPack16 zInv = this->zBuffer.getPixels16(x, y);
+			Mask16 drawnPixelsMask = xCoords < w & zInv < 0.0f;
+			if (!drawnPixelsMask) continue;
+
+			FloatPack16 lightMults = this->getDeferredShadowLightMults(xCoords, y, zInv, drawnPixelsMask);
+			this->applyDeferredShadowLightMults16(x, y, lightMults, drawnPixelsMask);
+		}
+	}
+}
+
+void RasterizationRenderer::applyDeferredShadowLightMults16(int x, int y, const FloatPack16& lightMults, Mask16 drawnPixelsMask)
+{
+	//only the sun's part of the pixel is shadowed, point lights are added on top afterwards like inline shading has them
+	VectorPack16 pixels = this->frameBuf.getPixels16(x, y);
+	pixels.r *= lightMults;
+	pixels.g *= lightMults;
+	pixels.b *= lightMults;
+	if (this->currFrameDeferredPointLights)
+	{
+		VectorPack16 pointLightPixels = this->pointLightBuf.getPixels16(x, y);
+		pixels.r += pointLightPixels.r;
+		pixels.g += pointLightPixels.g;
+		pixels.b += pointLightPixels.b;
+	}
+	this->frameBuf.setPixels16(x, y, pixels, drawnPixelsMask);
+}
+
+void RasterizationRenderer::applyHalfResDeferredShadows(int minY, int maxY, size_t workerNumber)
+{
+	//the low resolution grid is local to the band, so neighbouring bands that are still drawing are never read
+	this->zBuffer.resolveLazyClears(minY, maxY);
+	int w = this->zBuffer.getW();
+	int lowW = (w + 1) / 2;
+	int lowH = (maxY - minY + 1) / 2;
+	size_t lowPixelCount = size_t(lowW) * lowH;
+	auto& scratch = this->deferredShadowScratch[workerNumber];
+	scratch.resize(lowPixelCount * 2 + 16); //light mults, then depths. Padding for the last store
+	float* lowLightMults = scratch.data();
+	float* lowDepths = scratch.data() + lowPixelCount;
+
+	for (int ly = 0; ly < lowH; ++ly)
+	{
+		int y = minY + ly * 2;
+		for (int lx = 0; lx < lowW; lx += 16)
+		{
+			FloatPack16 lowXCoords = FloatPack16::sequence() + lx;
+			Mask16 inRowMask = lowXCoords < lowW;
+			FloatPack16 xCoords = lowXCoords * 2;
+			FloatPack16 zInv = this->zBuffer.gatherPixels16(_mm512_cvttps_epi32(xCoords), _mm512_set1_epi32(y), inRowMask);
+			Mask16 drawnPixelsMask = inRowMask & zInv < 0.0f;
+
+			FloatPack16 lightMults = 1.0f;
+			if (drawnPixelsMask) lightMults = _mm512_mask_mov_ps(lightMults, drawnPixelsMask, this->getDeferredShadowLightMults(xCoords, y, zInv, drawnPixelsMask));
+			_mm512_mask_storeu_ps(lowLightMults + ly * lowW + lx, inRowMask, lightMults);
+			_mm512_mask_storeu_ps(lowDepths + ly * lowW + lx, inRowMask, zInv);
+		}
+	}
+
+	//every pixel takes the mult of the closest depth among the up to 4 low resolution samples around it, so shadows don't bleed across depth edges
+	for (int y = minY; y < maxY; ++y)
+	{
+		int lowY0 = (y - minY) / 2;
+		int lowY1 = std::min(lowY0 + ((y - minY) & 1), lowH - 1);
+		for (int x = 0; x < w; x += 16)
+		{
+			FloatPack16 zInv = this->zBuffer.getPixels16(x, y);
+			IntPack16 xCoords = IntPack16::sequence() + x;
+			Mask16 drawnPixelsMask = xCoords < w & zInv < 0.0f;
+			if (!drawnPixelsMask) continue;
+
+			IntPack16 lowX0 = xCoords >> 1;
+			IntPack16 lowX1 = _mm512_min_epi32(lowX0 + (xCoords & 1), _mm512_set1_epi32(lowW - 1));
+			IntPack16 candidates[4] = { lowX0 + lowY0 * lowW, lowX1 + lowY0 * lowW, lowX0 + lowY1 * lowW, lowX1 + lowY1 * lowW };
+
+			FloatPack16 bestDepthDifference = FLT_MAX;
+			FloatPack16 lightMults = 1.0f;
+			for (const auto& it : candidates)
+			{
+				FloatPack16 candidateDepth = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), drawnPixelsMask, it, lowDepths, 4);
+				FloatPack16 depthDifference = _mm512_abs_ps(candidateDepth - zInv);
+				Mask16 closerMask = drawnPixelsMask & depthDifference < bestDepthDifference;
+				bestDepthDifference = _mm512_mask_mov_ps(bestDepthDifference, closerMask, depthDifference);
+				lightMults = _mm512_mask_i32gather_ps(lightMults, closerMask, it, lowLightMults, 4);
+			}
+
+			this->applyDeferredShadowLightMults16(x, y, lightMults, drawnPixelsMask);
+		}
+	}
+}
+
+Mask16 RasterizationRenderer::getPointsInShadow(const ShadowMap& shadowMap, const VectorPack16& dividedLightSpaceCoords, const FloatPack16& zInv, Mask16 mask, bool outOfBoundsIsShadow) const
+{
+	//both light space coords are divided by the same camera z, so it cancels out in the projection and only comes back for the depth
+	FloatPack16 projectionMult = FloatPack16(shadowMap.fovMult) / dividedLightSpaceCoords.z;
+	VectorPack16 sunScreenPositions = shadowMap.ctr.screenSpaceToPixels(dividedLightSpaceCoords * projectionMult);
+	sunScreenPositions.z = projectionMult * zInv;
+
+	Mask16 inShadowMapBounds = shadowMap.depthBuffer.checkBounds(sunScreenPositions.x, sunScreenPositions.y);
+	Mask16 shadowMapDepthGatherMask = inShadowMapBounds & mask;
+
+	FloatPack16 shadowMapDepths = shadowMap.depthBuffer.gatherPixels16(_mm512_cvttps_epi32(sunScreenPositions.x), _mm512_cvttps_epi32(sunScreenPositions.y), shadowMapDepthGatherMask);
+	Mask16 occluded = shadowMapDepthGatherMask & shadowMapDepths < (sunScreenPositions.z - shadowMap.depthBias);
+	return outOfBoundsIsShadow ? (occluded | (mask & ~inShadowMapBounds)) : occluded;
+}
+
+void RasterizationRenderer::drawRenderJobSlice(const RenderJob& renderJob, const Vec4* lightSpaceVertices, const BoundingBox& threadBox, size_t workerNumber, bool depthOnly)
+{
+	switch (renderJob.kernel)
+	{
+	case RasterKernel::CONSTANT_DEPTH_ROWS: return this->drawRenderJobSliceWithKernel<RasterKernel::CONSTANT_DEPTH_ROWS>(renderJob, lightSpaceVertices, threadBox, workerNumber, depthOnly);
+	case RasterKernel::CONSTANT_DEPTH_COLUMNS: return this->drawRenderJobSliceWithKernel<RasterKernel::CONSTANT_DEPTH_COLUMNS>(renderJob, lightSpaceVertices, threadBox, workerNumber, depthOnly);
+	default: return this->drawRenderJobSliceWithKernel<RasterKernel::GENERIC>(renderJob, lightSpaceVertices, threadBox, workerNumber, depthOnly);
+	}
+}
+
+template<RasterizationRenderer::RasterKernel kernel>
+void RasterizationRenderer::drawRenderJobSliceWithKernel(const RenderJob& renderJob, const Vec4* lightSpaceVertices, const BoundingBox& threadBox, size_t workerNumber, bool depthOnly)
 {
 	BoundingBox clampedBox = this->clampBoundingBox(renderJob.boundingBox, threadBox);
 	real yBeg = clampedBox.minY;
@@ -393,10 +741,50 @@ void RasterizationRenderer::drawRenderJobSlice(const RenderJob& renderJob, const
 	const Texture& texture = this->currFrameGameSettings.textureManager->getTextureByIndex(renderJob.pModel->textureIndex, false);
 	const auto& tv = renderJob.transformedTriangle.tv;
 	real adjustedLight = renderJob.pModel->lightMult ? powf(renderJob.pModel->lightMult.value(), this->currFrameGameSettings.gamma) : this->currFrameGameSettings.gamma;
+	blitting::DitheringContext dithering = this->getDitheringContext(workerNumber);
+	bool worldCoordsNeeded = this->currFramePointLights || this->currFrameGameSettings.fogEnabled;
+
+	//depth is still interpolated per pixel by every kernel, only the divisions of the other attributes are hoisted out
+	AttributePlane texturePlane, worldPlane;
+	if constexpr (kernel != RasterKernel::GENERIC)
+	{
+		texturePlane = getAttributePlane(renderJob.transformedTriangle, &TexVertex::textureCoords);
+		worldPlane = getAttributePlane(renderJob.transformedTriangle, &TexVertex::worldCoords);
+	}
+	const float* columnDepths = nullptr;
+	if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_COLUMNS)
+	{
+		auto& scratch = this->columnDepthScratch[workerNumber];
+		scratch.resize((size_t(xEnd - xBeg) + 16 + 15) / 16 * 16); //padded, so a whole pack can be loaded from the last column
+		real midY = (yBeg + yEnd) / 2;
+		for (size_t i = 0; i < scratch.size(); i += 16)
+		{
+			FloatPack16 columnZInv = FloatPack16::sequence() * texturePlane.dx.z + (texturePlane.origin.z + texturePlane.dx.z * (xBeg + i) + texturePlane.dy.z * midY);
+			_mm512_storeu_ps(&scratch[i], FloatPack16(1.0f) / columnZInv);
+		}
+		columnDepths = scratch.data();
+	}
 
 	for (real y = yBeg; y <= yEnd; ++y)
 	{
 		size_t yInt = y;
+		//ROWS: attributes at x = 0 of this row, and their step per pixel, already divided by the row's depth. COLUMNS: still divided by depth, with only x left to add
+		Vec4 rowTexture, rowTextureStep, rowWorld, rowWorldStep;
+		real rowDepth;
+		if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_ROWS)
+		{
+			rowDepth = 1 / (texturePlane.origin.z + texturePlane.dx.z * ((xBeg + xEnd) / 2) + texturePlane.dy.z * y);
+			rowTexture = (texturePlane.origin + texturePlane.dy * y) * rowDepth;
+			rowTextureStep = texturePlane.dx * rowDepth;
+			rowWorld = (worldPlane.origin + worldPlane.dy * y) * rowDepth;
+			rowWorldStep = worldPlane.dx * rowDepth;
+		}
+		if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_COLUMNS)
+		{
+			rowTexture = texturePlane.origin + texturePlane.dy * y;
+			rowWorld = worldPlane.origin + worldPlane.dy * y;
+		}
+
 		//the loop increment section is fairly busy because it's body can be interrupted at various steps, but all increments must always happen
 		for (FloatPack16 x = FloatPack16::sequence() + xBeg; Mask16 loopBoundsMask = x <= xEnd; x += 16)
 		{
@@ -407,58 +795,77 @@ void RasterizationRenderer::drawRenderJobSlice(const RenderJob& renderJob, const
 			Mask16 pointsInsideTriangleMask = loopBoundsMask & alpha >= 0.0 & beta >= 0.0 & gamma >= 0.0;
 			if (!pointsInsideTriangleMask) continue;
 
-			VectorPack16 interpolatedDividedUv = VectorPack16(tv[0].textureCoords) * alpha + VectorPack16(tv[1].textureCoords) * beta + VectorPack16(tv[2].textureCoords) * gamma;
+			this->zBuffer.ensureTilesCleared16(xInt, yInt);
+			FloatPack16 zInv = alpha * tv[0].textureCoords.z + beta * tv[1].textureCoords.z + gamma * tv[2].textureCoords.z;
 			FloatPack16 currDepthValues = this->zBuffer.getPixels16(xInt, yInt);
-			Mask16 visiblePointsMask = pointsInsideTriangleMask & currDepthValues > interpolatedDividedUv.z;
+			Mask16 visiblePointsMask = pointsInsideTriangleMask & currDepthValues > zInv;
 			if (!visiblePointsMask) continue; //if all points are occluded, then skip
 
-			VectorPack16 uvCorrected = interpolatedDividedUv / interpolatedDividedUv.z;
+			//.w of both carries the lightmap coords
+			VectorPack16 uvCorrected;
+			FloatPack16 depth; //the reciprocal of zInv
+			auto getCorrectedWorldCoords = [&]() {
+				if constexpr (kernel == RasterKernel::GENERIC) return (VectorPack16(tv[0].worldCoords) * alpha + VectorPack16(tv[1].worldCoords) * beta + VectorPack16(tv[2].worldCoords) * gamma) * depth;
+				if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_ROWS) return VectorPack16(rowWorld) + VectorPack16(rowWorldStep) * x;
+				if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_COLUMNS) return (VectorPack16(rowWorld) + VectorPack16(worldPlane.dx) * x) * depth;
+			};
+			if constexpr (kernel == RasterKernel::GENERIC)
+			{
+				depth = FloatPack16(1.0f) / zInv;
+				uvCorrected = (VectorPack16(tv[0].textureCoords) * alpha + VectorPack16(tv[1].textureCoords) * beta + VectorPack16(tv[2].textureCoords) * gamma) * depth;
+			}
+			if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_ROWS)
+			{
+				depth = rowDepth;
+				uvCorrected = VectorPack16(rowTexture) + VectorPack16(rowTextureStep) * x;
+			}
+			if constexpr (kernel == RasterKernel::CONSTANT_DEPTH_COLUMNS)
+			{
+				depth = FloatPack16(columnDepths + (xInt - size_t(xBeg)));
+				uvCorrected = (VectorPack16(rowTexture) + VectorPack16(texturePlane.dx) * x) * depth;
+			}
 			VectorPack16 texturePixels = texture.gatherPixels512(uvCorrected.x, uvCorrected.y, visiblePointsMask);
 			Mask16 opaquePixelsMask = visiblePointsMask & texturePixels.a > 0.0f;
 
 			if (!depthOnly)
 			{
-				VectorPack16 worldCoords = VectorPack16(tv[0].worldCoords) * alpha + VectorPack16(tv[1].worldCoords) * beta + VectorPack16(tv[2].worldCoords) * gamma;
-				worldCoords /= interpolatedDividedUv.z;
+				bool lightmapped = this->currFrameBakedLighting && renderJob.pModel->lightmap;
+				VectorPack16 worldCoords;
+				if (worldCoordsNeeded || lightmapped) worldCoords = getCorrectedWorldCoords();
+				FloatPack16 lightmapV = worldCoords.w;
 				worldCoords.w = 1;
 
 				VectorPack16 dynaLight = 0;
-				/*/
-				if (false)
+				if (this->currFramePointLights)
 				{
-					for (const auto& it : *context.pointLights)
-					{
-						FloatPack16 distSquared = (worldCoords - it.pos).lenSq3d();
-						Vec4 power = it.color * it.intensity;
-						dynaLight += VectorPack16(power) / distSquared;
-					}
-				}*/
-
-				Vec4 shadowLightColorMults = Vec4(1, 1, 1) * 1.5;
-				Vec4 shadowDarkColorMults = shadowLightColorMults * 0.2;
-				VectorPack16 shadowColorMults = 0;
-
-				for (const auto& it :  this->shadowMaps)
+					FloatPack16 viewDistance = depth * -this->currFrameGameSettings.fovMult;
+					dynaLight = this->lightClusters.getLightColors16(x, yInt, worldCoords, viewDistance, opaquePixelsMask);
+				}
+
+				//with deferred shadows the mults are applied to frameBuf once the band's depth is final
+				FloatPack16 shadowLightMults = 1.0f;
+				if (lightmapped)
+				{
+					FloatPack16 visibility = renderJob.pModel->lightmap->getVisibility16(uvCorrected.w, lightmapV, opaquePixelsMask);
+					shadowLightMults = visibility * (sunLitMult - sunShadowMult) + sunShadowMult;
+				}
+				else if (!this->currFrameDeferredShadows)
 				{
-					const auto& currentShadowMap = *it;
-					VectorPack16 sunWorldPositions = currentShadowMap.ctr.getCurrentTransformationMatrix() * worldCoords;
-					FloatPack16 zInv = FloatPack16(currentShadowMap.fovMult) / sunWorldPositions.z;
-					VectorPack16 sunScreenPositions = currentShadowMap.ctr.screenSpaceToPixels(sunWorldPositions * zInv);
-					sunScreenPositions.z = zInv;
-
-					Mask16 inShadowMapBounds = currentShadowMap.depthBuffer.checkBounds(sunScreenPositions.x, sunScreenPositions.y);
-					Mask16 shadowMapDepthGatherMask = inShadowMapBounds & opaquePixelsMask;
-
-					FloatPack16 shadowMapDepths = currentShadowMap.depthBuffer.gatherPixels16(_mm512_cvttps_epi32(sunScreenPositions.x), _mm512_cvttps_epi32(sunScreenPositions.y), shadowMapDepthGatherMask);
-					float shadowMapBias = 1.f / 10e6;
-					//float shadowMapBias = 0;
-					Mask16 pointsInShadow = ~inShadowMapBounds | shadowMapDepths < (sunScreenPositions.z - shadowMapBias);
-					shadowColorMults.r += _mm512_mask_blend_ps(pointsInShadow, FloatPack16(shadowLightColorMults.x), FloatPack16(shadowDarkColorMults.x));
-					shadowColorMults.g += _mm512_mask_blend_ps(pointsInShadow, FloatPack16(shadowLightColorMults.y), FloatPack16(shadowDarkColorMults.y));
-					shadowColorMults.b += _mm512_mask_blend_ps(pointsInShadow, FloatPack16(shadowLightColorMults.z), FloatPack16(shadowDarkColorMults.z));
+					shadowLightMults = this->getShadowLightMults([&](size_t shadowMapIndex) {
+						const Vec4* v = lightSpaceVertices + shadowMapIndex * 3;
+						return VectorPack16(v[0]) * alpha + VectorPack16(v[1]) * beta + VectorPack16(v[2]) * gamma;
+					}, zInv, opaquePixelsMask);
 				}
+				VectorPack16 shadowColorMults = VectorPack16(shadowLightMults, shadowLightMults, shadowLightMults, 0.0f);
 
-				texturePixels = (texturePixels * adjustedLight) * (dynaLight + shadowColorMults);
+				texturePixels = texturePixels * adjustedLight;
+				if (this->currFrameDeferredPointLights)
+				{
+					//stored apart, so the deferred shadow mult only scales the sun's part
+					this->pointLightBuf.setPixels16(xInt, yInt, texturePixels * dynaLight, opaquePixelsMask);
+					texturePixels = texturePixels * shadowColorMults;
+				}
+				else texturePixels = texturePixels * (dynaLight + shadowColorMults);
 				if (this->currFrameGameSettings.wireframeEnabled)
 				{
 					Mask16 visibleEdgeMaskAlpha = visiblePointsMask & alpha <= 0.01;
@@ -473,11 +880,17 @@ void RasterizationRenderer::drawRenderJobSlice(const RenderJob& renderJob, const
 					//lightMult = _mm512_mask_blend_ps(visibleEdgeMask, lightMult, _mm512_set1_ps(1));
 				}
 
-				this->frameBuf.setPixels16(xInt, yInt, texturePixels, opaquePixelsMask);
+				if (this->currFrameDirectOutput)
+				{
+					IntPack16 surfacePixels = blitting::packPixels16(texturePixels * 255, this->currFrameSurfaceShifts, dithering, xInt, yInt);
+					uint32_t* surfacePixelsStart = static_cast<uint32_t*>(this->currFrameDstSurf->pixels) + yInt * this->currFrameDstSurf->w + xInt;
+					_mm512_mask_storeu_epi32(surfacePixelsStart, opaquePixelsMask, surfacePixels); //x packs start at arbitrary columns, so the store can't be aligned
+				}
+				else this->frameBuf.setPixels16(xInt, yInt, texturePixels, opaquePixelsMask);
 				if (this->currFrameGameSettings.fogEnabled) this->pixelWorldPosBuf.setPixels16(xInt, yInt, worldCoords, opaquePixelsMask);
 			}
 
-			this->zBuffer.setPixels16(xInt, yInt, interpolatedDividedUv.z, opaquePixelsMask);
+			this->zBuffer.setPixels16(xInt, yInt, zInv, opaquePixelsMask);
 		}
 	}
 }
@@ -491,3 +904,13 @@ void RasterizationRenderer::removeShadowMaps()
 {
 	this->shadowMaps.clear();
 }
+
+void RasterizationRenderer::setShadowCascades(const CascadedShadowMap* cascades)
+{
+	this->shadowCascades = cascades;
+}
+
+void RasterizationRenderer::setPointLights(const std::vector<PointLight>* lights)
+{
+	this->pointLights = lights;
+}
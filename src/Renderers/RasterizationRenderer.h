@@ -1,21 +1,21 @@
+#pragma once
 #include "RendererBase.h"
 #include "../ShadowMap.h"
 #include "../Lehmer.h"
+#include "../blitting.h"
+#include "LightClusters.h"
 
 class Threadpool;
 
-struct BoundingBox
-{
-	real minX, minY, maxX, maxY;
-};
-
-
 class ShadowMap;
+class CascadedShadowMap;
+
+int doTriangleClipping(const Triangle& triangleToClip, real clippingZ, Triangle* trianglesOut, int* outsideVertexCount); //clips against the near plane, returns the number of triangles written to trianglesOut (at most 2)
 
 class RasterizationRenderer : public RendererBase
 {
 public:
-	RasterizationRenderer(int w, int h, Threadpool& threadpool, bool depthOnly = false);
+	RasterizationRenderer(int w, int h, Threadpool& threadpool, bool depthOnly = false, DepthFormat depthFormat = DepthFormat::FLOAT32);
 	virtual void drawScene(const std::vector<const Model*>& models, SDL_Surface* dstSurf, const GameSettings& gameSettings, const Camera& pov);
 	virtual void drawScene(const std::vector<const Model*>& models, SDL_Surface* dstSurf, const GameSettings& gameSettings, const Camera& pov, bool depthOnly);
 	virtual std::vector<std::pair<std::string, std::string>> getAdditionalOSDInfo();
@@ -24,17 +24,51 @@ public:
 	const ZBuffer& getDepthBuffer() const;
 	void addShadowMap(const ShadowMap& m);
 	void removeShadowMaps();
+	void setShadowCascades(const CascadedShadowMap* cascades); //used instead of shadow maps when shadowMode is CASCADED
+	void setPointLights(const std::vector<PointLight>* lights); //the vector is read every frame, so it can be changed in place
+	static constexpr real sunLitMult = 1.5;
+	static constexpr real sunShadowMult = sunLitMult * 0.2;
 private:
 	Threadpool* threadpool;
 
 	ZBuffer zBuffer;
 	FloatColorBuffer frameBuf;
 	FloatColorBuffer pixelWorldPosBuf;
+	FloatColorBuffer pointLightBuf; //point light part of every pixel, kept out of frameBuf while deferred shadows still have to scale the sun's part
 
 	GameSettings currFrameGameSettings;
 	CoordinateTransformer ctr;
 
+	//when direct surface output is active, fragments are packed and written straight into the destination surface rows, skipping frameBuf entirely
+	bool currFrameDirectOutput = false;
+	SDL_Surface* currFrameDstSurf = nullptr;
+	std::array<uint32_t, 4> currFrameSurfaceShifts;
+	uint32_t frameNumber = 0; //used to shift dither tables every frame
+
 	std::vector<const ShadowMap*> shadowMaps;
+	const CascadedShadowMap* shadowCascades = nullptr;
+
+	//shadow maps sampled this frame: either the fixed ones or the cascades. Far distances are only filled in for cascades
+	std::vector<const ShadowMap*> currFrameShadowMaps;
+	std::vector<real> currFrameShadowMapFarDistances;
+	bool currFrameShadowsCascaded = false;
+	bool currFrameDeferredShadows = false; //shadows are applied to frameBuf after each band's depth is final, instead of per fragment
+	bool currFrameDeferredPointLights = false; //point lights go to pointLightBuf and are added after the deferred shadows
+	bool currFrameBakedLighting = false; //models with a lightmap take sun visibility from it, the rest fall back to currFrameShadowMaps
+	std::vector<Matrix4> currFrameCameraToLightSpace; //per shadow map, only filled in for deferred shadows
+	std::vector<std::vector<float>> deferredShadowScratch; //per worker, low resolution shadow mults and depths for DEFERRED_HALF_RES
+	std::vector<std::vector<float>> columnDepthScratch; //per worker, inverted depth of every column of the job slice being drawn with CONSTANT_DEPTH_COLUMNS
+
+	const std::vector<PointLight>* pointLights = nullptr;
+	LightClusters lightClusters; //rebuilt every frame from pointLights
+	bool currFramePointLights = false;
+
+	enum class RasterKernel
+	{
+		GENERIC, //attributes are interpolated and divided by depth for every pixel
+		CONSTANT_DEPTH_ROWS, //depth is the same along each row, so attributes are divided once per row and stepped linearly along it
+		CONSTANT_DEPTH_COLUMNS, //depth is the same along each column, so it's inverted once per column and reused by all rows
+	};
 
 	struct RenderJob
 	{
@@ -44,6 +78,8 @@ private:
 		real rcpSignedArea;
 
 		BoundingBox boundingBox;
+		size_t lightSpaceVerticesIndex; //first of the 3 * currFrameShadowMaps.size() vertices in the giver worker's lightSpaceVertices
+		RasterKernel kernel;
 
 		RenderJob() {};
 	};
@@ -57,6 +93,7 @@ private:
 
 	std::vector<std::vector<RenderJob>> renderJobs;
 	std::vector<std::vector<std::vector<size_t>>> filteredJobIndices;
+	std::vector<std::vector<Vec4>> lightSpaceVertices; //per worker. Vertices in every shadow map's space, divided by camera space z like all other interpolated attributes
 	std::vector<LehmerRNG> rngSources;
 
 	std::vector<ModelSlice> distributeTrianglesForWorkers(const std::vector<const Model*>& sceneModels, size_t threadCount);
@@ -64,9 +101,22 @@ private:
 
 	int doWorldTransformationsAndClipping(const Triangle& triangle, const Model& model, Triangle* trianglesOut) const;
 	std::optional<Triangle> transformToScreenSpace(const Triangle& t) const;
+	RasterKernel chooseRasterKernel(const Triangle& screenSpaceTriangle, const Model& model, const BoundingBox& boundingBox) const;
 
 	std::array<uint32_t, 4> getShiftsForSurface(const SDL_Surface* surf) const;
+	blitting::DitheringContext getDitheringContext(size_t workerNumber);
+	bool canOutputDirectlyInto(const SDL_Surface* surf, bool depthOnly) const;
+	void prepareColorBuffers(bool directOutput);
+	void clearUntouchedColorTiles(int minY, int maxY);
 
 	BoundingBox clampBoundingBox(const BoundingBox& clampFrom, const BoundingBox& clampBy) const;
-	void drawRenderJobSlice(const RenderJob& renderJob, const BoundingBox& threadBox, bool depthOnly = false);
+	void prepareShadowMapsForFrame(bool depthOnly);
+	template<typename LightSpaceGetter> FloatPack16 getShadowLightMults(LightSpaceGetter getDividedLightSpaceCoords, const FloatPack16& zInv, Mask16 mask) const;
+	FloatPack16 getDeferredShadowLightMults(const FloatPack16& x, const FloatPack16& y, const FloatPack16& zInv, Mask16 mask) const;
+	void applyDeferredShadows(int minY, int maxY, size_t workerNumber);
+	void applyHalfResDeferredShadows(int minY, int maxY, size_t workerNumber);
+	void applyDeferredShadowLightMults16(int x, int y, const FloatPack16& lightMults, Mask16 drawnPixelsMask); //scales the sun's part of 16 pixels and adds their point light part
+	Mask16 getPointsInShadow(const ShadowMap& shadowMap, const VectorPack16& dividedLightSpaceCoords, const FloatPack16& zInv, Mask16 mask, bool outOfBoundsIsShadow) const;
+	void drawRenderJobSlice(const RenderJob& renderJob, const Vec4* lightSpaceVertices, const BoundingBox& threadBox, size_t workerNumber, bool depthOnly = false);
+	template<RasterKernel kernel> void drawRenderJobSliceWithKernel(const RenderJob& renderJob, const Vec4* lightSpaceVertices, const BoundingBox& threadBox, size_t workerNumber, bool depthOnly);
 };
\ No newline at end of file
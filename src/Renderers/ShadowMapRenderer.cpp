@@ -0,0 +1,268 @@
+#include "ShadowMapRenderer.h"
+#include <cassert>
+#include <limits>
+#include "../Threadpool.h"
+#include "../shaders/MainFragmentRenderShader.h"
+
+void ShadowMapRenderer::render(const std::vector<const Model*>& models, ZBuffer& depthBuffer, const CoordinateTransformer& ctr, const GameSettings& gameSettings, Threadpool& threadpool)
+{
+	this->renderBatch(models, { Target{ &depthBuffer, &ctr, gameSettings.fovMult } }, gameSettings, threadpool);
+}
+
+void ShadowMapRenderer::renderBatch(const std::vector<const Model*>& models, const std::vector<Target>& targets, const GameSettings& gameSettings, Threadpool& threadpool)
+{
+	this->setupBatch(models, targets, gameSettings, threadpool);
+
+	//bands are much shorter than the per thread ones of the main renderer, so a few dense bands don't leave the other workers idle.
+	//Bands of all targets go into the same pool, so small maps in the batch don't serialize behind big ones
+	std::vector<BinRange> binRanges;
+	for (size_t t = 0; t < targets.size(); ++t)
+	{
+		BoundingBox area = getRenderArea(targets[t]);
+		binRanges.push_back({ t, int(area.minY) / binH, int(area.maxY) / binH });
+	}
+	this->rasterizeBins(binRanges, threadpool);
+}
+
+void ShadowMapRenderer::setupBatch(const std::vector<const Model*>& models, const std::vector<Target>& targets, const GameSettings& gameSettings, Threadpool& threadpool)
+{
+	assert(targets.size() <= maxTargets);
+	this->targets = targets;
+	size_t threadCount = threadpool.getThreadCount();
+
+	this->jobs.resize(targets.size());
+	this->binnedJobIndices.resize(targets.size());
+	for (size_t t = 0; t < targets.size(); ++t)
+	{
+		int binCount = (targets[t].depthBuffer->getH() + binH - 1) / binH;
+		this->jobs[t].resize(threadCount);
+		this->binnedJobIndices[t].resize(threadCount);
+		for (auto& it : this->jobs[t]) it.clear();
+		for (auto& it : this->binnedJobIndices[t])
+		{
+			it.resize(binCount);
+			for (auto& bin : it) bin.clear();
+		}
+	}
+
+	this->chunks.clear();
+	this->lastCulledModelCount = 0;
+	for (const Model* model : models)
+	{
+		uint64_t visibleToTargets = 0;
+		for (size_t t = 0; t < targets.size(); ++t)
+		{
+			if (this->isModelInFrustum(*model, targets[t], gameSettings.nearPlaneZ)) visibleToTargets |= uint64_t(1) << t;
+		}
+		if (!visibleToTargets)
+		{
+			this->lastCulledModelCount++;
+			continue;
+		}
+		size_t triangleCount = model->getTriangleCount();
+		for (size_t i = 0; i < triangleCount; i += trianglesPerChunk) this->chunks.push_back({ model, i, std::min(i + trianglesPerChunk, triangleCount), visibleToTargets });
+	}
+
+	std::vector<task_id> setupTasks;
+	for (size_t tNum = 0; tNum < threadCount; ++tNum)
+	{
+		setupTasks.push_back(threadpool.addTask([&, tNum]() {
+			for (size_t i = tNum; i < this->chunks.size(); i += threadCount) this->setupTriangles(this->chunks[i], tNum, targets, gameSettings);
+		}));
+	}
+	threadpool.waitForMultipleTasks(setupTasks);
+}
+
+void ShadowMapRenderer::rasterizeRows(size_t target, int minY, int maxY, Threadpool& threadpool)
+{
+	this->rasterizeBins({ BinRange{ target, minY / binH, maxY / binH } }, threadpool);
+}
+
+void ShadowMapRenderer::rasterizeBins(const std::vector<BinRange>& binRanges, Threadpool& threadpool)
+{
+	size_t threadCount = threadpool.getThreadCount();
+	std::vector<task_id> rasterTasks;
+	for (const BinRange& range : binRanges)
+	{
+		size_t t = range.target;
+		ZBuffer& depthBuffer = *this->targets[t].depthBuffer;
+		for (int bin = range.firstBin; bin <= range.lastBin; ++bin)
+		{
+			rasterTasks.push_back(threadpool.addTask([&, t, bin]() {
+				int binMinY = bin * binH;
+				int binMaxY = std::min(binMinY + binH, depthBuffer.getH());
+				for (size_t giverThread = 0; giverThread < threadCount; ++giverThread)
+				{
+					for (uint32_t jobIndex : this->binnedJobIndices[t][giverThread][bin]) this->rasterizeJob(this->jobs[t][giverThread][jobIndex], depthBuffer, binMinY, binMaxY);
+				}
+				depthBuffer.resolveLazyClears(binMinY, binMaxY);
+			}));
+		}
+	}
+	threadpool.waitForMultipleTasks(rasterTasks);
+}
+
+size_t ShadowMapRenderer::getLastJobCount() const
+{
+	size_t ret = 0;
+	for (const auto& target : this->jobs) for (const auto& it : target) ret += it.size();
+	return ret;
+}
+
+size_t ShadowMapRenderer::getLastCulledModelCount() const
+{
+	return this->lastCulledModelCount;
+}
+
+BoundingBox ShadowMapRenderer::getRenderArea(const Target& target)
+{
+	if (target.scissor) return target.scissor.value();
+	return { 0, 0, real(target.depthBuffer->getW() - 1), real(target.depthBuffer->getH() - 1) };
+}
+
+bool ShadowMapRenderer::isModelInFrustum(const Model& model, const Target& target, real nearPlaneZ) const
+{
+	real halfHeightPerDistance = 1 / (2 * target.fovMult);
+	real halfWidthPerDistance = halfHeightPerDistance * target.depthBuffer->getW() / target.depthBuffer->getH();
+	//the model is culled only if all of it's bounding box corners are outside the same frustum plane, which is conservative for boxes crossing a corner of the frustum
+	bool allBehind = true, allLeft = true, allRight = true, allBelow = true, allAbove = true;
+	for (Vec4 corner : model.getBoundingBox())
+	{
+		corner.w = 1;
+		Vec4 v = target.ctr->rotateAndTranslate(corner);
+		real xLimit = -v.z * halfWidthPerDistance;
+		real yLimit = -v.z * halfHeightPerDistance;
+		allBehind &= v.z > nearPlaneZ;
+		allLeft &= v.x < -xLimit;
+		allRight &= v.x > xLimit;
+		allBelow &= v.y < -yLimit;
+		allAbove &= v.y > yLimit;
+	}
+	if (allBehind || allLeft || allRight || allBelow || allAbove) return false;
+	if (!target.scissor) return true;
+
+	//against a scissor, the box is projected. Boxes crossing the near plane can't be projected and are assumed to overlap
+	BoundingBox projected = { std::numeric_limits<real>::infinity(), std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity() };
+	for (Vec4 corner : model.getBoundingBox())
+	{
+		corner.w = 1;
+		Vec4 v = target.ctr->rotateAndTranslate(corner);
+		if (v.z >= nearPlaneZ) return true;
+		Vec4 p = target.ctr->screenSpaceToPixels(v * (target.fovMult / v.z));
+		projected = { std::min(projected.minX, p.x), std::min(projected.minY, p.y), std::max(projected.maxX, p.x), std::max(projected.maxY, p.y) };
+	}
+	const BoundingBox& scissor = target.scissor.value();
+	return projected.maxX >= scissor.minX - 1 && projected.minX <= scissor.maxX + 1 && projected.maxY >= scissor.minY - 1 && projected.minY <= scissor.maxY + 1;
+}
+
+void ShadowMapRenderer::setupTriangles(const TriangleChunk& chunk, size_t workerNumber, const std::vector<Target>& targets, const GameSettings& gameSettings)
+{
+	const auto& triangles = chunk.pModel->getTriangles();
+	const Texture& texture = gameSettings.textureManager->getTextureByIndex(chunk.pModel->textureIndex, false);
+	const Texture* alphaTestedTexture = texture.hasOnlyOpaquePixels() ? nullptr : &texture;
+	bool backfaceCulling = gameSettings.backfaceCullingEnabled && !chunk.pModel->noBackfaceCulling;
+
+	for (size_t i = chunk.begin; i < chunk.end; ++i)
+	{
+		for (size_t t = 0; t < targets.size(); ++t)
+		{
+			if (!(chunk.visibleToTargets & (uint64_t(1) << t))) continue;
+			const CoordinateTransformer& ctr = *targets[t].ctr;
+			real fovMult = targets[t].fovMult;
+			BoundingBox area = getRenderArea(targets[t]);
+
+			Triangle rotated;
+			for (int v = 0; v < 3; ++v)
+			{
+				Vec4 spaceCopy = triangles[i].tv[v].spaceCoords;
+				spaceCopy.w = 1;
+				rotated.tv[v].spaceCoords = ctr.rotateAndTranslate(spaceCopy);
+				rotated.tv[v].textureCoords = triangles[i].tv[v].textureCoords;
+			}
+
+			if (backfaceCulling)
+			{
+				Vec4 normal = rotated.getNormalVector();
+				if (rotated.tv[0].spaceCoords.dot(normal) >= 0) continue;
+			}
+
+			Triangle clipped[2];
+			int outsideVertexCount;
+			int nTrianglesOut = doTriangleClipping(rotated, gameSettings.nearPlaneZ, clipped, &outsideVertexCount);
+			for (int c = 0; c < nTrianglesOut; ++c)
+			{
+				ShadowJob job;
+				for (int v = 0; v < 3; ++v)
+				{
+					real zInv = fovMult / clipped[c].tv[v].spaceCoords.z;
+					job.screenCoords[v] = ctr.screenSpaceToPixels(clipped[c].tv[v].spaceCoords * zInv);
+					job.screenCoords[v].z = zInv;
+					job.dividedUv[v] = clipped[c].tv[v].textureCoords * zInv;
+					job.dividedUv[v].z = zInv;
+				}
+
+				const Vec4& r1 = job.screenCoords[0];
+				const Vec4& r2 = job.screenCoords[1];
+				const Vec4& r3 = job.screenCoords[2];
+				real signedArea = (r1 - r3).cross2d(r2 - r3);
+				if (signedArea == 0.0) continue;
+
+				BoundingBox box;
+				box.minX = std::max(std::floor(std::min({ r1.x, r2.x, r3.x })), area.minX);
+				box.maxX = std::min(std::ceil(std::max({ r1.x, r2.x, r3.x })), area.maxX);
+				box.minY = std::max(std::floor(std::min({ r1.y, r2.y, r3.y })), area.minY);
+				box.maxY = std::min(std::ceil(std::max({ r1.y, r2.y, r3.y })), area.maxY);
+				if (box.minX > box.maxX || box.minY > box.maxY) continue; //entirely off the map or the scissor
+
+				job.alphaTestedTexture = alphaTestedTexture;
+				job.rcpSignedArea = 1.0 / signedArea;
+				job.boundingBox = box;
+
+				auto& targetJobs = this->jobs[t][workerNumber];
+				auto& targetBins = this->binnedJobIndices[t][workerNumber];
+				uint32_t jobIndex = targetJobs.size();
+				targetJobs.push_back(job);
+				for (int bin = int(box.minY) / binH; bin <= int(box.maxY) / binH; ++bin) targetBins[bin].push_back(jobIndex);
+			}
+		}
+	}
+}
+
+void ShadowMapRenderer::rasterizeJob(const ShadowJob& job, ZBuffer& depthBuffer, int binMinY, int binMaxY) const
+{
+	real yBeg = std::max(job.boundingBox.minY, real(binMinY));
+	real yEnd = std::min(job.boundingBox.maxY, real(binMaxY - 1));
+	real xBeg = job.boundingBox.minX;
+	real xEnd = job.boundingBox.maxX;
+	const Vec4* r = job.screenCoords;
+
+	for (real y = yBeg; y <= yEnd; ++y)
+	{
+		size_t yInt = y;
+		for (FloatPack16 x = FloatPack16::sequence() + xBeg; Mask16 loopBoundsMask = x <= xEnd; x += 16)
+		{
+			size_t xInt = x[0];
+			VectorPack16 p = VectorPack16(x, y, 0.0, 0.0);
+			auto [alpha, beta, gamma] = RenderHelpers::calculateBarycentricCoordinates(p, r[0], r[1], r[2], job.rcpSignedArea);
+
+			Mask16 pointsInsideTriangleMask = loopBoundsMask & alpha >= 0.0 & beta >= 0.0 & gamma >= 0.0;
+			if (!pointsInsideTriangleMask) continue;
+
+			depthBuffer.ensureTilesCleared16(xInt, yInt);
+			FloatPack16 zInv = alpha * r[0].z + beta * r[1].z + gamma * r[2].z;
+			if (!job.alphaTestedTexture)
+			{
+				depthBuffer.testAndSet16(xInt, yInt, zInv, pointsInsideTriangleMask);
+				continue;
+			}
+
+			//only textures with holes need to be looked at, and only where the triangle isn't occluded already
+			Mask16 visiblePointsMask = depthBuffer.testAndSet16(xInt, yInt, zInv, pointsInsideTriangleMask, false);
+			if (!visiblePointsMask) continue;
+			VectorPack16 uv = VectorPack16(job.dividedUv[0]) * alpha + VectorPack16(job.dividedUv[1]) * beta + VectorPack16(job.dividedUv[2]) * gamma;
+			uv /= zInv;
+			VectorPack16 texturePixels = job.alphaTestedTexture->gatherPixels512(uv.x, uv.y, visiblePointsMask);
+			depthBuffer.testAndSet16(xInt, yInt, zInv, visiblePointsMask & texturePixels.a > 0.0f);
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <optional>
+
+#include "RasterizationRenderer.h"
+
+class Threadpool;
+class Texture;
+
+//Depth only rasterizer for shadow maps. Unlike a depth only RasterizationRenderer, it culls whole models against the light frustum,
+//only fetches textures that have transparent pixels, splits the map into many small bands instead of one per thread, and renders straight into the target buffer.
+//Several maps can be rendered in one batch: the geometry is read once, every triangle is set up for each map whose frustum it's model touches,
+//and the bands of all maps are rasterized by the same pool of tasks. The job buffers are kept between renders, so reusing one instance avoids reallocating them.
+class ShadowMapRenderer
+{
+public:
+	static constexpr int binH = 64; //rows per band, each band is rasterized by one task
+	static constexpr size_t trianglesPerChunk = 4096; //granularity of distributing triangle setup between workers
+	static constexpr size_t maxTargets = 64; //targets a chunk is visible to are stored as a bitmask
+
+	struct Target
+	{
+		ZBuffer* depthBuffer;
+		const CoordinateTransformer* ctr;
+		real fovMult;
+		std::optional<BoundingBox> scissor; //if set, only pixels inside it are rendered, and they must be cleared beforehand. Targets sharing a depth buffer must not share rows
+	};
+
+	void render(const std::vector<const Model*>& models, ZBuffer& depthBuffer, const CoordinateTransformer& ctr, const GameSettings& gameSettings, Threadpool& threadpool);
+	void renderBatch(const std::vector<const Model*>& models, const std::vector<Target>& targets, const GameSettings& gameSettings, Threadpool& threadpool); //fovMult of gameSettings is ignored, each target has it's own
+	//renderBatch in two steps: triangles are set up and binned once, then rows can be rasterized a few at a time, until the next setup
+	void setupBatch(const std::vector<const Model*>& models, const std::vector<Target>& targets, const GameSettings& gameSettings, Threadpool& threadpool);
+	void rasterizeRows(size_t target, int minY, int maxY, Threadpool& threadpool); //inclusive, whole bins are rasterized, so the range should be aligned to binH
+	size_t getLastJobCount() const;
+	size_t getLastCulledModelCount() const; //models outside of all targets' frustums
+private:
+	struct ShadowJob
+	{
+		Vec4 screenCoords[3]; //x and y in pixels, z is zInv
+		Vec4 dividedUv[3]; //only used when alphaTestedTexture is set
+		const Texture* alphaTestedTexture;
+		real rcpSignedArea;
+		BoundingBox boundingBox;
+	};
+	struct TriangleChunk
+	{
+		const Model* pModel;
+		size_t begin, end;
+		uint64_t visibleToTargets; //bit i is set if the model's bounding box touches the frustum of target i
+	};
+	struct BinRange
+	{
+		size_t target;
+		int firstBin, lastBin; //inclusive
+	};
+
+	std::vector<std::vector<std::vector<ShadowJob>>> jobs; //[target][worker]
+	std::vector<std::vector<std::vector<std::vector<uint32_t>>>> binnedJobIndices; //[target][worker][bin]
+	std::vector<TriangleChunk> chunks;
+	std::vector<Target> targets; //of the last setup
+	size_t lastCulledModelCount = 0;
+
+	static BoundingBox getRenderArea(const Target& target);
+	bool isModelInFrustum(const Model& model, const Target& target, real nearPlaneZ) const;
+	void setupTriangles(const TriangleChunk& chunk, size_t workerNumber, const std::vector<Target>& targets, const GameSettings& gameSettings);
+	void rasterizeBins(const std::vector<BinRange>& binRanges, Threadpool& threadpool); //bins of all ranges go into the same pool of tasks
+	void rasterizeJob(const ShadowJob& job, ZBuffer& depthBuffer, int binMinY, int binMaxY) const;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "DoomStructs.h"
+#include "Model.h"
+
+//Where a vertex of Doom map geometry takes it's height from. Flats follow their own sector, and wall pieces span between the lower or higher
+//floor or ceiling of the sectors on both sides of their linedef, so they stay right whichever of the two moves
+struct SectorHeightSource
+{
+	int32_t sectors[2]; //the same sector twice for flats and one sided walls
+	uint8_t isCeiling;
+	uint8_t takesHigher;
+	uint8_t padding[2] = {}; //stored in map geometry cache files as is
+
+	real getHeight(const std::vector<Sector>& sectors) const
+	{
+		real h0 = this->isCeiling ? sectors[this->sectors[0]].ceilingHeight : sectors[this->sectors[0]].floorHeight;
+		real h1 = this->isCeiling ? sectors[this->sectors[1]].ceilingHeight : sectors[this->sectors[1]].floorHeight;
+		return this->takesHigher ? std::max(h0, h1) : std::min(h0, h1);
+	}
+};
+
+struct VertexHeightBinding
+{
+	SectorHeightSource height;
+	SectorHeightSource textureAnchor; //wall textures hang from the top of their piece, so texture v depends on the distance to it
+	float textureAnchorV; //texture v at the anchor
+	uint32_t movesTexture; //0 for flats, which are textured in the horizontal plane
+};
+
+//models of one sector, with a height binding for each of their vertices so moving sectors can update them in place
+struct SectorGeometry
+{
+	std::vector<Model> models;
+	std::vector<std::vector<VertexHeightBinding>> heightBindings; //per model, 3 per triangle in the same order as the vertices
+};
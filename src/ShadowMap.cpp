@@ -1,21 +1,235 @@
 #include "ShadowMap.h"
 #include "Threadpool.h"
-#include "shaders/MainFragmentRenderShader.h"
-#include "Renderers/RasterizationRenderer.h"
+#include "Renderers/ShadowMapRenderer.h"
+#include "ShadowMapCache.h"
 
-ShadowMap::ShadowMap(int w, int h, const Camera& cam)
+ShadowMap::ShadowMap(int w, int h, const Camera& cam, DepthFormat depthFormat)
 {
-	this->depthBuffer = { w,h };
+	this->depthBuffer = ZBuffer(w, h, depthFormat);
 	this->pov = cam;
 	this->ctr = { w,h };
 	this->ctr.prepare(cam.pos, cam.angle);
 }
 
+void ShadowMap::setPov(const Camera& pov, real fovMult)
+{
+	this->pov = pov;
+	this->fovMult = fovMult;
+	this->ctr.prepare(pov.pos, pov.angle);
+}
+
 void ShadowMap::render(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool)
-{	
-	RasterizationRenderer rend(this->depthBuffer.getW(), this->depthBuffer.getH(), threadpool, true);
+{
+	ShadowMapRenderer renderer;
+	this->render(models, gameSettings, threadpool, renderer);
+}
+
+void ShadowMap::render(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, ShadowMapRenderer& renderer)
+{
+	ShadowMap::renderBatch({ this }, models, gameSettings, threadpool, renderer);
+}
+
+void ShadowMap::renderBatch(const std::vector<ShadowMap*>& shadowMaps, const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, ShadowMapRenderer& renderer, const ShadowMapCache* cache)
+{
+	std::vector<const Model*> modelPtrs = getShadowCastingModels(models);
+
+	std::vector<ShadowMapRenderer::Target> targets;
+	std::vector<ShadowMap*> mapsToStore;
+	for (ShadowMap* it : shadowMaps)
+	{
+		if (cache)
+		{
+			if (it->loadFromCache(models, gameSettings, threadpool, *cache)) continue;
+			mapsToStore.push_back(it);
+		}
+		it->prepareForFullRender(modelPtrs, gameSettings);
+		targets.push_back({ &it->depthBuffer, &it->ctr, it->fovMult });
+	}
+
+	for (size_t i = 0; i < targets.size(); i += ShadowMapRenderer::maxTargets)
+	{
+		std::vector<ShadowMapRenderer::Target> batch(targets.begin() + i, targets.begin() + std::min(i + ShadowMapRenderer::maxTargets, targets.size()));
+		renderer.renderBatch(modelPtrs, batch, gameSettings, threadpool);
+	}
+	for (ShadowMap* it : mapsToStore) it->storeToCache(models, gameSettings, threadpool, *cache);
+}
+
+bool ShadowMap::loadFromCache(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, const ShadowMapCache& cache)
+{
+	uint64_t key = cache.computeKey(models, this->pov, this->fovMult, this->depthBuffer, gameSettings);
+	if (!cache.tryLoad(key, this->depthBuffer, threadpool)) return false;
+	this->hasBeenRendered = true;
+	this->progressiveNextRow.reset();
+	this->progressiveRenderer.reset();
+	return true;
+}
+
+void ShadowMap::storeToCache(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, const ShadowMapCache& cache) const
+{
+	cache.store(cache.computeKey(models, this->pov, this->fovMult, this->depthBuffer, gameSettings), this->depthBuffer, threadpool);
+}
+
+void ShadowMap::beginProgressiveRender(const std::vector<Model>& models, const GameSettings& gameSettings)
+{
+	this->prepareForFullRender(getShadowCastingModels(models), gameSettings);
+	this->progressiveNextRow = 0;
+}
+
+bool ShadowMap::continueProgressiveRender(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, std::chrono::microseconds timeBudget)
+{
+	static_assert(progressiveBandH % ShadowMapRenderer::binH == 0);
+	if (!this->progressiveNextRow) return true;
+
+	auto start = std::chrono::steady_clock::now();
+	if (!this->progressiveRenderer)
+	{
+		//the whole map is set up and binned once, so every band after only rasterizes it's own bins
+		this->progressiveRenderer = std::make_shared<ShadowMapRenderer>();
+		this->progressiveRenderer->setupBatch(getShadowCastingModels(models), { ShadowMapRenderer::Target{ &this->depthBuffer, &this->ctr, this->fovMult } }, gameSettings, threadpool);
+	}
+
+	//bands span whole rows, so every lazily cleared tile in them gets resolved by the renderer
+	int h = this->depthBuffer.getH();
+	while (this->progressiveNextRow.value() < h && std::chrono::steady_clock::now() - start < timeBudget)
+	{
+		int minY = this->progressiveNextRow.value();
+		int maxY = std::min(minY + progressiveBandH, h) - 1;
+		this->progressiveRenderer->rasterizeRows(0, minY, maxY, threadpool);
+		this->progressiveNextRow = maxY + 1;
+	}
+	if (this->progressiveNextRow.value() < h) return false;
+	this->progressiveNextRow.reset();
+	this->progressiveRenderer.reset();
+	return true;
+}
+
+bool ShadowMap::isProgressiveRenderInProgress() const
+{
+	return this->progressiveNextRow.has_value();
+}
+
+real ShadowMap::getProgressiveRenderProgress() const
+{
+	if (!this->progressiveNextRow) return this->hasBeenRendered ? 1 : 0;
+	return real(this->progressiveNextRow.value()) / this->depthBuffer.getH();
+}
+
+std::vector<const Model*> ShadowMap::getShadowCastingModels(const std::vector<Model>& models)
+{
 	std::vector<const Model*> modelPtrs;
 	for (const auto& it : models) if (it.textureIndex != 0) modelPtrs.push_back(&it); //TODO: remove this hardcode (sky textured level geometry in DOOM)
-	rend.drawScene(modelPtrs, nullptr, gameSettings, this->pov, true);
-	this->depthBuffer = rend.getDepthBuffer();
+	return modelPtrs;
+}
+
+void ShadowMap::prepareForFullRender(const std::vector<const Model*>& models, const GameSettings& gameSettings)
+{
+	GameSettings shadowMapSettings = gameSettings;
+	shadowMapSettings.fovMult = this->fovMult; //lookups use the map's own FOV, so rendering must too
+
+	this->depthBuffer.setDepthRange(this->findClosestZInv(models, shadowMapSettings));
+	if (this->hasBeenRendered) this->depthBuffer.beginNewGeneration(); //renderer clears tiles lazily, so this is the whole clear
+	this->hasBeenRendered = true;
+	this->dirtyRegions.clear();
+	this->progressiveNextRow.reset();
+	this->progressiveRenderer.reset();
+}
+
+void ShadowMap::markDirty(const Model& model)
+{
+	this->markDirty(model.getBoundingBox());
+}
+
+void ShadowMap::markDirty(const std::array<Vec4, 8>& worldBoundingBox)
+{
+	BoundingBox fullMap = { 0, 0, real(this->depthBuffer.getW() - 1), real(this->depthBuffer.getH() - 1) };
+	BoundingBox region = { std::numeric_limits<real>::infinity(), std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity(), -std::numeric_limits<real>::infinity() };
+	for (Vec4 corner : worldBoundingBox)
+	{
+		corner.w = 1;
+		Vec4 v = this->ctr.rotateAndTranslate(corner);
+		if (v.z >= 0)
+		{
+			//can't be projected, but anything near the light can shadow a big part of the map
+			region = fullMap;
+			break;
+		}
+		Vec4 p = this->ctr.screenSpaceToPixels(v * (this->fovMult / v.z));
+		region = { std::min(region.minX, p.x), std::min(region.minY, p.y), std::max(region.maxX, p.x), std::max(region.maxY, p.y) };
+	}
+	//one extra pixel, rasterization rounds bounding boxes outwards
+	region.minX = std::max(std::floor(region.minX) - 1, fullMap.minX);
+	region.minY = std::max(std::floor(region.minY) - 1, fullMap.minY);
+	region.maxX = std::min(std::ceil(region.maxX) + 1, fullMap.maxX);
+	region.maxY = std::min(std::ceil(region.maxY) + 1, fullMap.maxY);
+	if (region.minX > region.maxX || region.minY > region.maxY) return; //doesn't cast a shadow onto the map
+
+	//regions sharing rows are merged, two targets in one batch must not rasterize the same bands concurrently
+	for (size_t i = 0; i < this->dirtyRegions.size();)
+	{
+		const BoundingBox& it = this->dirtyRegions[i];
+		if (it.maxY < region.minY || it.minY > region.maxY)
+		{
+			++i;
+			continue;
+		}
+		region = { std::min(region.minX, it.minX), std::min(region.minY, it.minY), std::max(region.maxX, it.maxX), std::max(region.maxY, it.maxY) };
+		this->dirtyRegions.erase(this->dirtyRegions.begin() + i);
+		i = 0; //the grown region may touch ones that were checked already
+	}
+	this->dirtyRegions.push_back(region);
+}
+
+bool ShadowMap::hasDirtyRegions() const
+{
+	return !this->dirtyRegions.empty();
+}
+
+void ShadowMap::renderDirtyRegions(const std::vector<ShadowMap*>& shadowMaps, const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, ShadowMapRenderer& renderer)
+{
+	std::vector<ShadowMap*> mapsToRenderFully;
+	std::vector<ShadowMapRenderer::Target> targets;
+	for (ShadowMap* it : shadowMaps)
+	{
+		if (!it->hasBeenRendered) mapsToRenderFully.push_back(it);
+		else
+		{
+			//the depth range is kept, so the rest of the map stays valid. Geometry moved closer than the old closest depth gets clamped to it
+			for (const BoundingBox& region : it->dirtyRegions)
+			{
+				for (int y = region.minY; y <= region.maxY; ++y) it->depthBuffer.clearSpan(y, region.minX, region.maxX + 1);
+				targets.push_back({ &it->depthBuffer, &it->ctr, it->fovMult, region });
+			}
+		}
+		it->dirtyRegions.clear();
+	}
+	if (!mapsToRenderFully.empty()) ShadowMap::renderBatch(mapsToRenderFully, models, gameSettings, threadpool, renderer);
+	if (targets.empty()) return;
+
+	std::vector<const Model*> modelPtrs = getShadowCastingModels(models);
+	for (size_t i = 0; i < targets.size(); i += ShadowMapRenderer::maxTargets)
+	{
+		std::vector<ShadowMapRenderer::Target> batch(targets.begin() + i, targets.begin() + std::min(i + ShadowMapRenderer::maxTargets, targets.size()));
+		renderer.renderBatch(modelPtrs, batch, gameSettings, threadpool);
+	}
+}
+
+real ShadowMap::findClosestZInv(const std::vector<const Model*>& models, const GameSettings& gameSettings) const
+{
+	//the sun is usually far away from everything, so using the near plane as the closest depth would waste almost all of the precision.
+	//Instead, find the closest bounding box corner in front of the camera. Models that are fully behind it get culled anyway
+	real closestZ = -std::numeric_limits<real>::infinity();
+	for (const auto& model : models)
+	{
+		real minZ = std::numeric_limits<real>::infinity(), maxZ = -std::numeric_limits<real>::infinity();
+		for (Vec4 corner : model->getBoundingBox())
+		{
+			corner.w = 1;
+			real z = this->ctr.rotateAndTranslate(corner).z;
+			minZ = std::min(minZ, z);
+			maxZ = std::max(maxZ, z);
+		}
+		if (minZ < gameSettings.nearPlaneZ) closestZ = std::max(closestZ, std::min(maxZ, gameSettings.nearPlaneZ));
+	}
+	if (closestZ == -std::numeric_limits<real>::infinity()) closestZ = gameSettings.nearPlaneZ;
+	return gameSettings.fovMult / closestZ;
 }
@@ -1,4 +1,7 @@
 #pragma once
+#include <chrono>
+#include <optional>
+#include <memory>
 #include "ZBuffer.h"
 #include "CoordinateTransformer.h"
 #include "Triangle.h"
@@ -6,6 +9,8 @@
 #include "Camera.h"
 
 class Threadpool;
+class ShadowMapRenderer;
+class ShadowMapCache;
 struct ShadowMapTriangleAddendum
 {
 	std::array<Vec4, 3> screenCoords;
@@ -14,11 +19,44 @@ struct ShadowMapTriangleAddendum
 
 struct ShadowMap
 {
+	static constexpr int progressiveBandH = 256; //rows rendered at a time by a progressive render, small enough to stop close to the time budget
+
 	CoordinateTransformer ctr;
 	ZBuffer depthBuffer;	
 	real fovMult = 1;
+	real depthBias = 1.f / 10e6; //in zInv units, so it has to be adjusted together with fovMult and distance to the scene
 	Camera pov;
 
-	ShadowMap(int w, int h, const Camera& pov);
+	ShadowMap(int w, int h, const Camera& pov, DepthFormat depthFormat = DepthFormat::UNORM16);
+	void setPov(const Camera& pov, real fovMult);
 	void render(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool);
+	void render(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, ShadowMapRenderer& renderer); //reuses the renderer's job buffers
+	//renders all maps in one pass over the geometry. With a cache, maps found in it are loaded instead, and the rest are stored after rendering
+	static void renderBatch(const std::vector<ShadowMap*>& shadowMaps, const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, ShadowMapRenderer& renderer, const ShadowMapCache* cache = nullptr);
+
+	//a map with cached depth is loaded instead of rendered, and a rendered one is stored
+	bool loadFromCache(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, const ShadowMapCache& cache);
+	void storeToCache(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, const ShadowMapCache& cache) const;
+
+	//renders the map in bands of rows over several calls, so a huge map doesn't stall a frame. The map must not be used for lookups until it's done.
+	//Triangles are set up once on the first call, so geometry that moves meanwhile has to be marked dirty and rendered again after
+	void beginProgressiveRender(const std::vector<Model>& models, const GameSettings& gameSettings);
+	bool continueProgressiveRender(const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, std::chrono::microseconds timeBudget); //returns true once the whole map is rendered
+	bool isProgressiveRenderInProgress() const;
+	real getProgressiveRenderProgress() const; //0 to 1
+
+	//geometry that changed has to be marked both where it was and where it is now, so the shadow it left behind is removed too
+	void markDirty(const Model& model);
+	void markDirty(const std::array<Vec4, 8>& worldBoundingBox);
+	bool hasDirtyRegions() const;
+	//clears and renders again only the marked regions of each map, maps that were never rendered are rendered fully
+	static void renderDirtyRegions(const std::vector<ShadowMap*>& shadowMaps, const std::vector<Model>& models, const GameSettings& gameSettings, Threadpool& threadpool, ShadowMapRenderer& renderer);
+private:
+	bool hasBeenRendered = false; //a fresh depth buffer is already clear
+	std::vector<BoundingBox> dirtyRegions; //in pixels, inclusive. Regions never share rows, so each can be rendered as a separate target
+	std::optional<int> progressiveNextRow; //set while a progressive render is going on
+	std::shared_ptr<ShadowMapRenderer> progressiveRenderer; //holds the set up triangles between the calls of a progressive render, so nothing else can reuse it's job buffers meanwhile
+	static std::vector<const Model*> getShadowCastingModels(const std::vector<Model>& models);
+	void prepareForFullRender(const std::vector<const Model*>& models, const GameSettings& gameSettings);
+	real findClosestZInv(const std::vector<const Model*>& models, const GameSettings& gameSettings) const; //integer depth formats need to know the depth range in advance
 };
\ No newline at end of file
@@ -0,0 +1,308 @@
+#include "ShadowMapCache.h"
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <iomanip>
+
+#include "ZBuffer.h"
+#include "MappedFile.h"
+#include "Threadpool.h"
+#include "TextureManager.h"
+
+namespace
+{
+	//FNV-1a, only needs to tell different scenes apart, not resist anyone
+	struct KeyHasher
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		template<typename T>
+		void add(const T& value)
+		{
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+			for (size_t i = 0; i < sizeof(T); ++i)
+			{
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+		}
+		void addVec3(const Vec4& v)
+		{
+			add(v.x);
+			add(v.y);
+			add(v.z);
+		}
+	};
+
+	void writeVarint(uint64_t value, std::vector<uint8_t>& out)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back(uint8_t(value) | 0x80);
+			value >>= 7;
+		}
+		out.push_back(uint8_t(value));
+	}
+
+	bool readVarint(const uint8_t*& p, const uint8_t* pEnd, uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (p >= pEnd) return false;
+			uint8_t byte = *p++;
+			value |= uint64_t(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false;
+	}
+
+	uint32_t readPixel(const uint8_t* row, int x, size_t bytesPerPixel)
+	{
+		if (bytesPerPixel == 2) return reinterpret_cast<const uint16_t*>(row)[x];
+		return reinterpret_cast<const uint32_t*>(row)[x];
+	}
+
+	void writePixel(uint8_t* row, int x, size_t bytesPerPixel, uint32_t value)
+	{
+		if (bytesPerPixel == 2) reinterpret_cast<uint16_t*>(row)[x] = uint16_t(value);
+		else reinterpret_cast<uint32_t*>(row)[x] = value;
+	}
+
+	uint32_t predictPixel(const uint8_t* row, int x, size_t bytesPerPixel, uint32_t valueMask)
+	{
+		if (x == 0) return 0;
+		if (x == 1) return readPixel(row, 0, bytesPerPixel);
+		return (2 * readPixel(row, x - 1, bytesPerPixel) - readPixel(row, x - 2, bytesPerPixel)) & valueMask;
+	}
+
+	int32_t signExtend(uint32_t value, size_t bytesPerPixel)
+	{
+		return bytesPerPixel == 2 ? int32_t(int16_t(value)) : int32_t(value);
+	}
+}
+
+ShadowMapCache::ShadowMapCache(std::string directory)
+{
+	this->directory = directory;
+}
+
+uint64_t ShadowMapCache::computeKey(const std::vector<Model>& models, const Camera& pov, real fovMult, const ZBuffer& depthBuffer, const GameSettings& gameSettings) const
+{
+	KeyHasher hasher;
+	hasher.add(formatVersion);
+	hasher.add(depthBuffer.getW());
+	hasher.add(depthBuffer.getH());
+	hasher.add(depthBuffer.getFormat());
+	hasher.add(fovMult);
+	hasher.addVec3(pov.pos);
+	hasher.addVec3(pov.angle);
+	hasher.add(gameSettings.nearPlaneZ);
+	hasher.add(gameSettings.backfaceCullingEnabled);
+
+	std::unordered_map<int, uint64_t> alphaHashes; //alpha tested textures are shared by many models, so each is hashed once
+	for (const auto& model : models)
+	{
+		hasher.add(model.textureIndex);
+		hasher.add(model.noBackfaceCulling);
+		if (model.noBackfaceCulling)
+		{
+			//the alpha of these textures shapes the shadow, so an edited texture must not load a stale map
+			auto it = alphaHashes.find(model.textureIndex);
+			if (it == alphaHashes.end())
+			{
+				const Texture& texture = gameSettings.textureManager->getTextureByIndex(model.textureIndex);
+				KeyHasher textureHasher;
+				for (char c : texture.getName()) textureHasher.add(c);
+				textureHasher.add(texture.getW());
+				textureHasher.add(texture.getH());
+				for (int y = 0; y < texture.getH(); ++y)
+					for (int x = 0; x < texture.getW(); ++x)
+						textureHasher.add(texture.getPixel(x, y).a);
+				it = alphaHashes.emplace(model.textureIndex, textureHasher.hash).first;
+			}
+			hasher.add(it->second);
+		}
+		hasher.add(model.getTriangleCount());
+		for (const auto& triangle : model.getTriangles())
+		{
+			for (const auto& vertex : triangle.tv)
+			{
+				hasher.addVec3(vertex.spaceCoords);
+				hasher.add(vertex.textureCoords.x);
+				hasher.add(vertex.textureCoords.y);
+			}
+		}
+	}
+	return hasher.hash;
+}
+
+std::string ShadowMapCache::getPath(uint64_t key, const std::string& extension) const
+{
+	std::stringstream ss;
+	ss << this->directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key << extension;
+	return ss.str();
+}
+
+bool ShadowMapCache::tryLoad(uint64_t key, ZBuffer& depthBuffer, Threadpool& threadpool) const
+{
+	MappedFile file(this->getPath(key));
+	if (!file.isOpen() || file.size() < sizeof(FileHeader)) return false;
+
+	FileHeader header;
+	memcpy(&header, file.data(), sizeof(header));
+	int expectedBandCount = (depthBuffer.getH() + bandH - 1) / bandH;
+	if (memcmp(header.magic, "SMC", 4) != 0 || header.version != formatVersion || header.key != key) return false;
+	if (header.w != depthBuffer.getW() || header.h != depthBuffer.getH() || header.format != uint32_t(depthBuffer.getFormat())) return false;
+	if (header.bandH != bandH || header.bandCount != expectedBandCount) return false;
+
+	size_t offsetTableBytes = (header.bandCount + 1) * sizeof(uint64_t);
+	if (file.size() < sizeof(FileHeader) + offsetTableBytes) return false;
+	std::vector<uint64_t> bandOffsets(header.bandCount + 1);
+	memcpy(bandOffsets.data(), file.data() + sizeof(FileHeader), offsetTableBytes);
+	for (size_t i = 0; i < header.bandCount; ++i)
+	{
+		if (bandOffsets[i] > bandOffsets[i + 1]) return false;
+	}
+	if (bandOffsets.back() > file.size()) return false;
+
+	std::atomic<bool> corrupted = false;
+	std::vector<task_id> decodeTasks;
+	for (int band = 0; band < expectedBandCount; ++band)
+	{
+		decodeTasks.push_back(threadpool.addTask([&, band]() {
+			int minY = band * bandH;
+			int maxY = std::min(minY + bandH, depthBuffer.getH());
+			if (!decodeBand(depthBuffer, minY, maxY, file.data() + bandOffsets[band], file.data() + bandOffsets[band + 1])) corrupted = true;
+		}));
+	}
+	threadpool.waitForMultipleTasks(decodeTasks);
+
+	if (corrupted)
+	{
+		//callers render into the buffer afterwards, which assumes it's clear
+		for (int y = 0; y < depthBuffer.getH(); ++y) memset(depthBuffer.getRawRow(y), 0, depthBuffer.getW() * depthBuffer.getBytesPerPixel());
+		std::cout << "Shadow map cache file " << this->getPath(key) << " is corrupted, rendering again\n";
+		return false;
+	}
+
+	if (header.closestZInv < 0) depthBuffer.setDepthRange(header.closestZInv);
+	return true;
+}
+
+void ShadowMapCache::store(uint64_t key, const ZBuffer& depthBuffer, Threadpool& threadpool) const
+{
+	int bandCount = (depthBuffer.getH() + bandH - 1) / bandH;
+	std::vector<std::vector<uint8_t>> encodedBands(bandCount);
+	std::vector<task_id> encodeTasks;
+	for (int band = 0; band < bandCount; ++band)
+	{
+		encodeTasks.push_back(threadpool.addTask([&, band]() {
+			int minY = band * bandH;
+			int maxY = std::min(minY + bandH, depthBuffer.getH());
+			encodeBand(depthBuffer, minY, maxY, encodedBands[band]);
+		}));
+	}
+	threadpool.waitForMultipleTasks(encodeTasks);
+
+	FileHeader header;
+	memcpy(header.magic, "SMC", 4);
+	header.version = formatVersion;
+	header.key = key;
+	header.w = depthBuffer.getW();
+	header.h = depthBuffer.getH();
+	header.format = uint32_t(depthBuffer.getFormat());
+	header.bandH = bandH;
+	header.bandCount = bandCount;
+	header.closestZInv = depthBuffer.getDepthRange();
+
+	std::vector<uint64_t> bandOffsets(bandCount + 1);
+	bandOffsets[0] = sizeof(FileHeader) + bandOffsets.size() * sizeof(uint64_t);
+	for (int i = 0; i < bandCount; ++i) bandOffsets[i + 1] = bandOffsets[i] + encodedBands[i].size();
+
+	//written under a temporary name and renamed, so an interrupted write never leaves a file that looks valid
+	std::error_code ec;
+	std::filesystem::create_directories(this->directory, ec);
+	std::string path = this->getPath(key);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream f(tempPath, std::ios::binary);
+		f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		f.write(reinterpret_cast<const char*>(bandOffsets.data()), bandOffsets.size() * sizeof(uint64_t));
+		for (const auto& it : encodedBands) f.write(reinterpret_cast<const char*>(it.data()), it.size());
+		if (!f)
+		{
+			std::cout << "Could not write shadow map cache file " << tempPath << "\n";
+			return;
+		}
+	}
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec) std::cout << "Could not write shadow map cache file " << path << ": " << ec.message() << "\n";
+	else
+	{
+		size_t rawBytes = size_t(depthBuffer.getW()) * depthBuffer.getH() * depthBuffer.getBytesPerPixel();
+		std::cout << "Stored shadow map cache file " << path << " (" << (bandOffsets.back() >> 20) << " MB, " << std::setprecision(3) << double(rawBytes) / bandOffsets.back() << "x compression)\n";
+	}
+}
+
+void ShadowMapCache::encodeBand(const ZBuffer& depthBuffer, int minY, int maxY, std::vector<uint8_t>& out)
+{
+	size_t bytesPerPixel = depthBuffer.getBytesPerPixel();
+	uint32_t valueMask = bytesPerPixel == 2 ? 0xFFFF : 0xFFFFFFFF;
+	int w = depthBuffer.getW();
+	for (int y = minY; y < maxY; ++y)
+	{
+		const uint8_t* row = depthBuffer.getRawRow(y);
+		uint64_t exactRun = 0;
+		for (int x = 0; x < w; ++x)
+		{
+			int32_t residual = signExtend((readPixel(row, x, bytesPerPixel) - predictPixel(row, x, bytesPerPixel, valueMask)) & valueMask, bytesPerPixel);
+			if (residual == 0)
+			{
+				exactRun++;
+				continue;
+			}
+			if (exactRun) writeVarint(exactRun << 1 | 1, out);
+			exactRun = 0;
+			uint32_t zigzag = (uint32_t(residual) << 1) ^ uint32_t(residual >> 31);
+			writeVarint(uint64_t(zigzag) << 1, out);
+		}
+		if (exactRun) writeVarint(exactRun << 1 | 1, out); //runs never continue into the next row, so rows decode independently
+	}
+}
+
+bool ShadowMapCache::decodeBand(ZBuffer& depthBuffer, int minY, int maxY, const uint8_t* pBegin, const uint8_t* pEnd)
+{
+	size_t bytesPerPixel = depthBuffer.getBytesPerPixel();
+	uint32_t valueMask = bytesPerPixel == 2 ? 0xFFFF : 0xFFFFFFFF;
+	int w = depthBuffer.getW();
+	const uint8_t* p = pBegin;
+	for (int y = minY; y < maxY; ++y)
+	{
+		uint8_t* row = depthBuffer.getRawRow(y);
+		int x = 0;
+		while (x < w)
+		{
+			uint64_t token;
+			if (!readVarint(p, pEnd, token)) return false;
+			if (token & 1)
+			{
+				uint64_t exactRun = token >> 1;
+				if (exactRun > uint64_t(w - x)) return false;
+				for (uint64_t i = 0; i < exactRun; ++i, ++x) writePixel(row, x, bytesPerPixel, predictPixel(row, x, bytesPerPixel, valueMask));
+			}
+			else
+			{
+				uint32_t zigzag = uint32_t(token >> 1);
+				int32_t residual = int32_t(zigzag >> 1) ^ -int32_t(zigzag & 1);
+				writePixel(row, x, bytesPerPixel, (predictPixel(row, x, bytesPerPixel, valueMask) + residual) & valueMask);
+				++x;
+			}
+		}
+	}
+	return p == pEnd;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Model.h"
+#include "Camera.h"
+#include "misc/GameSettings.h"
+
+class ZBuffer;
+class Threadpool;
+
+//Stores rendered shadow map depth on disk, so static maps don't have to be rendered again on later visits.
+//Files are named by a hash of everything the result depends on: geometry, light pose, FOV, resolution and depth format.
+//Depth is compressed per band of rows with a band offset table at the start, so a memory mapped file can be decoded by all workers at once.
+//Every row is predicted linearly from the previous two pixels (zInv is affine in screen space, so flat surfaces predict almost exactly),
+//and the residuals are stored as varints, with runs of exact predictions collapsed into one varint.
+class ShadowMapCache
+{
+public:
+	static constexpr uint32_t formatVersion = 1;
+	static constexpr int bandH = 64;
+
+	ShadowMapCache(std::string directory = "shadow_cache");
+
+	uint64_t computeKey(const std::vector<Model>& models, const Camera& pov, real fovMult, const ZBuffer& depthBuffer, const GameSettings& gameSettings) const;
+	bool tryLoad(uint64_t key, ZBuffer& depthBuffer, Threadpool& threadpool) const; //the buffer must already have the right size and format. Also restores the depth range
+	void store(uint64_t key, const ZBuffer& depthBuffer, Threadpool& threadpool) const; //failures are only reported to stdout, the cache is an optimization
+	std::string getPath(uint64_t key, const std::string& extension = ".smc") const; //other data derived from a shadow map is stored next to it with it's own extension
+private:
+	std::string directory;
+
+	struct FileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		int32_t w, h;
+		uint32_t format;
+		uint32_t bandH;
+		uint32_t bandCount;
+		float closestZInv;
+	};
+
+	static void encodeBand(const ZBuffer& depthBuffer, int minY, int maxY, std::vector<uint8_t>& out);
+	static bool decodeBand(ZBuffer& depthBuffer, int minY, int maxY, const uint8_t* pBegin, const uint8_t* pEnd);
+};
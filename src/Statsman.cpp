@@ -28,6 +28,7 @@ std::string Statsman::toString()
     ss << VAR_PRINT(zBuffer.occlusionDiscards) << "\n";
     ss << VAR_PRINT(zBuffer.writes) << "\n";
     ss << VAR_PRINT(zBuffer.writeDisabledTests) << "\n";
+    ss << VAR_PRINT(zBuffer.lazyTileClears) << "\n";
 
     ss << VAR_PRINT(triangles.verticesOutside[0]) << "\n";
     ss << VAR_PRINT(triangles.verticesOutside[1]) << "\n";
@@ -22,7 +22,8 @@ public:
 			outOfBoundsAccesses = 0,
 			occlusionDiscards = 0,
 			writes = 0,
-			writeDisabledTests = 0;
+			writeDisabledTests = 0,
+			lazyTileClears = 0;
 	};
 	struct Triangles
 	{
@@ -111,6 +111,11 @@ int Texture::getH() const
 	return pixels.getH();
 }
 
+const std::string& Texture::getName() const
+{
+	return name;
+}
+
 bool Texture::hasOnlyOpaquePixels() const
 {
 	return _hasOnlyOpaquePixels;
@@ -35,6 +35,7 @@ public:
 
 	int getW() const;
 	int getH() const;
+	const std::string& getName() const;
 	bool hasOnlyOpaquePixels() const;
 
 	static constexpr TextureDebugMode TEXTURE_DEBUG_MODE = TextureDebugMode::NONE;
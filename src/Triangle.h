@@ -16,6 +16,11 @@
 
 class Model;
 
+struct BoundingBox
+{
+	real minX, minY, maxX, maxY;
+};
+
 struct Triangle
 {
 	//std::array<TexVertex, 3> tv;
@@ -1,81 +1,108 @@
 #define _CRT_SECURE_NO_WARNINGS
-#include <fstream>
 #include <stdexcept>
 #include <iostream>
 
 #include "WadLoader.h"
 #include "helpers.h"
 #include <cstring>
-
-template <typename T>
-void readRaw(T& ret, const void* bytes)
-{
-	ret = *reinterpret_cast<const T*>(bytes);
-}
+#include <algorithm>
 
 template <typename T>
 T readRaw(const void* bytes)
 {
-	return *reinterpret_cast<const T*>(bytes);
+	T ret;
+	memcpy(&ret, bytes, sizeof(T));
+	return ret;
 }
 
-template <typename T>
-std::vector<T> getVectorFromWad(int32_t lumpDataOffset, int32_t lumpSizeBytes, const std::vector<char>& wadBytes)
+WadLoader::WadLoader(const std::string& path)
 {
-	std::vector<T> ret;
-	for (int i = 0; i < lumpSizeBytes; i += sizeof(T))
+	this->path = path;
+	this->file = MappedFile(path);
+	if (!this->file.isOpen()) throw std::runtime_error(std::string("Failed to open file ") + path + ": " + strerror(errno));
+	if (this->file.size() < 12) throw std::runtime_error(std::string("Invalid WAD file: ") + path + ": too short");
+
+	const uint8_t* wadBytes = this->file.data();
+	std::string header = wadStrToStd(reinterpret_cast<const char*>(wadBytes), 4);
+	if (header != "IWAD" && header != "PWAD")
+		throw std::runtime_error(std::string("Invalid WAD file: ") + path + ": header mismatch. Got " + header);
+
+	int32_t numFiles = readRaw<int32_t>(wadBytes + 4);
+	int32_t FAToffset = readRaw<int32_t>(wadBytes + 8);
+	if (numFiles < 0 || FAToffset < 0 || size_t(FAToffset) + size_t(numFiles) * 16 > this->file.size())
+		throw std::runtime_error(std::string("Invalid WAD file: ") + path + ": lump directory is out of the file");
+
+	//only the directory is read here, map lumps stay untouched until their map is asked for
+	this->directory.reserve(numFiles);
+	for (int i = 0; i < numFiles; ++i)
 	{
-		T v = readRaw<T>(&wadBytes[lumpDataOffset + i]);
-		ret.push_back(v);
+		const uint8_t* entry = wadBytes + FAToffset + i * 16;
+		Lump& lump = this->directory.emplace_back();
+		lump.offset = readRaw<int32_t>(entry);
+		lump.size = readRaw<int32_t>(entry + 4);
+		lump.name = wadStrToStd(reinterpret_cast<const char*>(entry + 8));
+		if (isMapMarker(lump.name)) this->mapMarkers[lump.name] = i;
 	}
-	return ret;
 }
 
-std::map<std::string, DoomMap> WadLoader::loadWad(std::string path)
+bool WadLoader::isMapMarker(const std::string& name)
 {
-	std::ifstream f(path, std::ios::binary);
-	if (!f.is_open()) throw std::runtime_error(std::string("Failed to open file ") + path + ": " + strerror(errno));
+	bool isEpisodicMap = name.length() >= 4 && name[0] == 'E' && name[2] == 'M'; //Doom 1 and Heretic
+	bool isNonEpisodicMap = name.length() >= 5 && std::string(name.begin(), name.begin() + 3) == "MAP"; //Doom 2, Hexen, Strife
+	return isEpisodicMap || isNonEpisodicMap;
+}
 
-	f.seekg(0, f.end);
-	int wadSize = f.tellg();
-	f.seekg(0, f.beg);
+std::vector<std::string> WadLoader::getMapNames() const
+{
+	std::vector<std::string> ret;
+	for (const auto& it : this->mapMarkers) ret.push_back(it.first);
+	return ret;
+}
 
-	std::vector<char> wadBytes(wadSize);
-	f.read(&wadBytes.front(), wadSize);
-	if (f.gcount() != wadSize) throw std::runtime_error(std::string("Failed to load file ") + path + ": " + strerror(errno));
+template <typename T>
+std::span<const T> WadLoader::getLump(const Lump& lump) const
+{
+	//the WAD structs are packed, so they can be used in place at any offset
+	static_assert(alignof(T) == 1);
+	if (lump.offset < 0 || lump.size < 0 || size_t(lump.offset) + size_t(lump.size) > this->file.size())
+		throw std::runtime_error(std::string("Invalid WAD file: ") + this->path + ": lump " + lump.name + " is out of the file");
+	return std::span<const T>(reinterpret_cast<const T*>(this->file.data() + lump.offset), lump.size / sizeof(T));
+}
 
-	std::string header = wadStrToStd(&wadBytes.front(), 4);
-	if (header != "IWAD" && header != "PWAD")
-		throw std::runtime_error(std::string("Invalid WAD file: ") + path + ": header mismatch. Got " + header);
+void WadLoader::finishMap(DoomMap& map)
+{
+	//a REJECT that is too short for the sector count is treated as missing, and an all zero one says nothing, so it's dropped to skip the lookups
+	size_t rejectBits = map.sectors.size() * map.sectors.size();
+	bool rejectUsable = map.reject.size() >= (rejectBits + 7) / 8 && std::any_of(map.reject.begin(), map.reject.end(), [](uint8_t b) { return b != 0; });
+	if (!rejectUsable) map.reject = {};
+}
 
-	int32_t numFiles = readRaw<int32_t>(&wadBytes[4]);
-	int32_t FAToffset = readRaw<int32_t>(&wadBytes[8]);
+DoomMap& WadLoader::getMap(const std::string& name)
+{
+	auto parsed = this->maps.find(name);
+	if (parsed != this->maps.end()) return parsed->second;
+
+	auto marker = this->mapMarkers.find(name);
+	if (marker == this->mapMarkers.end()) throw std::out_of_range("No map " + name + " in " + this->path);
 
-	int32_t filePtr = FAToffset;
-	std::string mapName = "";
+	//a map's lumps follow it's marker, up to the next map
 	DoomMap map;
-	std::map<std::string, DoomMap> maps;
-	for (int i = 0; i < numFiles; ++i)
+	for (size_t i = marker->second + 1; i < this->directory.size() && !isMapMarker(this->directory[i].name); ++i)
 	{
-		int32_t lumpDataOffset = readRaw<int32_t>(&wadBytes[filePtr]);
-		int32_t lumpSizeBytes = readRaw<int32_t>(&wadBytes[filePtr + 4]);
-		std::string name = wadStrToStd(&wadBytes[filePtr + 8]);
-		if (false) std::cout << "Found file: " << name << ", data offset: " << lumpDataOffset << ", size: " << lumpSizeBytes << "\n";
-
-		bool isEpisodicMap = name.length() >= 4 && name[0] == 'E' && name[2] == 'M'; //Doom 1 and Heretic
-		bool isNonEpisodicMap = name.length() >= 5 && std::string(name.begin(), name.begin() + 3) == "MAP"; //Doom 2, Hexen, Strife
-		if (isEpisodicMap || isNonEpisodicMap)
+		const Lump& lump = this->directory[i];
+		if (lump.name == "VERTEXES") map.vertices = this->getLump<Vertex>(lump);
+		if (lump.name == "LINEDEFS") map.linedefs = this->getLump<Linedef>(lump);
+		if (lump.name == "SIDEDEFS") map.sidedefs = this->getLump<Sidedef>(lump);
+		if (lump.name == "SECTORS")
 		{
-			if (mapName != name && mapName != "") maps[mapName] = map; //if map was in progress of being read, then save it
-			mapName = name;
+			auto sectors = this->getLump<Sector>(lump);
+			map.sectors.assign(sectors.begin(), sectors.end());
 		}
-
-		if (name == "VERTEXES") map.vertices = getVectorFromWad<Vertex>(lumpDataOffset, lumpSizeBytes, wadBytes);
-		if (name == "LINEDEFS") map.linedefs = getVectorFromWad<Linedef>(lumpDataOffset, lumpSizeBytes, wadBytes);
-		if (name == "SIDEDEFS") map.sidedefs = getVectorFromWad<Sidedef>(lumpDataOffset, lumpSizeBytes, wadBytes);
-		if (name == "SECTORS") map.sectors = getVectorFromWad<Sector>(lumpDataOffset, lumpSizeBytes, wadBytes);
-		filePtr += 16;
+		if (lump.name == "SEGS") map.segs = this->getLump<Seg>(lump);
+		if (lump.name == "SSECTORS") map.subsectors = this->getLump<Subsector>(lump);
+		if (lump.name == "NODES") map.nodes = this->getLump<Node>(lump);
+		if (lump.name == "REJECT") map.reject = this->getLump<uint8_t>(lump);
 	}
-
-	return maps;
-}
\ No newline at end of file
+	finishMap(map);
+	return this->maps[name] = std::move(map);
+}
@@ -2,12 +2,36 @@
 #include <vector>
 #include <map>
 #include <string>
+#include <span>
 
 #include "DoomStructs.h"
 #include "DoomMap.h"
+#include "MappedFile.h"
 
+//Memory maps a WAD and only reads it's lump directory up front. A map's lumps are looked at when the map is first asked for,
+//and are used in place as spans over the mapping, so startup time and memory don't depend on how many maps the WAD has
 class WadLoader
 {
 public:
-	static std::map<std::string, DoomMap> loadWad(std::string path);
-};
\ No newline at end of file
+	WadLoader() = default;
+	WadLoader(const std::string& path); //throws if the file can't be mapped or isn't a WAD
+
+	std::vector<std::string> getMapNames() const;
+	DoomMap& getMap(const std::string& name); //parsed on the first call. Throws std::out_of_range for maps the WAD doesn't have. The map points into the file, so it must not outlive the loader
+private:
+	struct Lump
+	{
+		int32_t offset, size;
+		std::string name;
+	};
+
+	std::string path;
+	MappedFile file;
+	std::vector<Lump> directory;
+	std::map<std::string, size_t> mapMarkers; //directory index of every map's marker lump
+	std::map<std::string, DoomMap> maps;
+
+	static bool isMapMarker(const std::string& lumpName);
+	template <typename T> std::span<const T> getLump(const Lump& lump) const;
+	static void finishMap(DoomMap& map);
+};
@@ -1,14 +1,97 @@
 #include "ZBuffer.h"
 #include "Statsman.h"
 #include <iostream>
+#include <cstring>
+#include <SDL/SDL_image.h>
 
-ZBuffer::ZBuffer(int w, int h) : PixelBuffer<real>(w, h)
+ZBuffer::ZBuffer(int w, int h, DepthFormat format)
 {
+	this->size = PixelBufferSize(w, h);
+	this->format = format;
+	this->store = LargePageBuffer(size_t(w) * h * this->getBytesPerPixel() + 64);
+
+	this->tilesPerRow = (w + lazyClearTileW - 1) / lazyClearTileW;
+	this->tileGenerations.resize(size_t(this->tilesPerRow) * h, 0);
+}
+
+int ZBuffer::getW() const
+{
+	return this->size.w;
+}
+
+int ZBuffer::getH() const
+{
+	return this->size.h;
+}
+
+const PixelBufferSize& ZBuffer::getSize() const
+{
+	return this->size;
+}
+
+DepthFormat ZBuffer::getFormat() const
+{
+	return this->format;
+}
+
+void ZBuffer::setDepthRange(real closestZInv)
+{
+	assert(closestZInv < 0);
+	this->closestZInv = closestZInv;
+	this->encodeMult = 1 / closestZInv;
+}
+
+real ZBuffer::getDepthRange() const
+{
+	return this->closestZInv;
+}
+
+uint8_t* ZBuffer::getRawRow(size_t y)
+{
+	return this->pixelPtr(0, y);
+}
+
+const uint8_t* ZBuffer::getRawRow(size_t y) const
+{
+	return this->pixelPtr(0, y);
+}
+
+real ZBuffer::getPixel(int x, int y) const
+{
+	const uint8_t* p = this->pixelPtr(x, y);
+	switch (this->format)
+	{
+	case DepthFormat::UNORM16:
+	{
+		uint16_t value;
+		memcpy(&value, p, sizeof(value));
+		return value * (this->closestZInv / unorm16Max);
+	}
+	case DepthFormat::UNORM24_S8:
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return (value >> 8) * (this->closestZInv / unorm24Max);
+	}
+	default:
+	{
+		real value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+	}
+}
+
+void ZBuffer::setPixel(int x, int y, real depth)
+{
+	//the scalar path is rare enough to just go through the vector one
+	this->setPixels16(x, y, depth, 1);
 }
 
 bool ZBuffer::test(int x, int y, real depth)
 {
 	StatCount(statsman.zBuffer.depthTests++);
+	this->ensureTilesCleared16(x, y);
 	bool cmp = depth < this->getPixel(x, y);
 	return cmp;
 }
@@ -29,6 +112,47 @@ bool ZBuffer::testAndSet(int x, int y, real depth, bool doWrite)
 	return cmp;
 }
 
+__mmask16 ZBuffer::checkBounds(__m512 x, __m512 y) const
+{
+	FloatPack16 fx = FloatPack16(x);
+	FloatPack16 fy = FloatPack16(y);
+	return fx >= 0.f & fx < this->size.fw & fy >= 0.f & fy < this->size.fh;
+}
+
+IntPack16 ZBuffer::getStencil16(size_t xStart, size_t y) const
+{
+	assert(this->format == DepthFormat::UNORM24_S8);
+	return _mm512_and_si512(_mm512_loadu_si512(this->pixelPtr(xStart, y)), _mm512_set1_epi32(0xFF));
+}
+
+void ZBuffer::setStencil16(size_t xStart, size_t y, const IntPack16& values, __mmask16 mask)
+{
+	assert(this->format == DepthFormat::UNORM24_S8);
+	uint8_t* p = this->pixelPtr(xStart, y);
+	__m512i depth = _mm512_andnot_si512(_mm512_set1_epi32(0xFF), _mm512_loadu_si512(p));
+	_mm512_mask_storeu_epi32(p, mask, _mm512_or_si512(depth, values.zmm));
+}
+
+const LargePageBuffer& ZBuffer::getStorage() const
+{
+	return this->store;
+}
+
+void ZBuffer::firstTouch(Threadpool& threadpool)
+{
+	this->store.firstTouch(threadpool);
+}
+
+void ZBuffer::saveToFile(const std::string& path) const
+{
+	PixelBuffer<Color> image(this->getW(), this->getH());
+	for (int y = 0; y < this->getH(); ++y)
+	{
+		for (int x = 0; x < this->getW(); ++x) image.setPixel(x, y, this->toColor(this->getPixel(x, y)));
+	}
+	image.saveToFile(path);
+}
+
 Color ZBuffer::toColor(real value) const
 {
 	real dist = -1.0/value;
@@ -38,6 +162,41 @@ Color ZBuffer::toColor(real value) const
 	return Color(fv,fv,fv);
 }
 
+void ZBuffer::beginNewGeneration()
+{
+	this->currentGeneration++;
+}
+
+int ZBuffer::getTilesPerRow() const
+{
+	return this->tilesPerRow;
+}
+
+void ZBuffer::resolveLazyClears(int minY, int maxY)
+{
+	for (int y = minY; y < maxY; ++y)
+	{
+		for (int tileX = 0; tileX < this->tilesPerRow; ++tileX)
+		{
+			if (!this->isTileTouched(tileX, y)) this->clearTile(tileX, y);
+		}
+	}
+}
+
+void ZBuffer::clearSpan(size_t y, size_t xBegin, size_t xEnd)
+{
+	memset(this->pixelPtr(xBegin, y), 0, (xEnd - xBegin) * this->getBytesPerPixel());
+}
+
+void ZBuffer::clearTile(size_t tileX, size_t y)
+{
+	StatCount(statsman.zBuffer.lazyTileClears++);
+	size_t xBegin = tileX * lazyClearTileW;
+	size_t xEnd = std::min<size_t>(xBegin + lazyClearTileW, this->getW());
+	memset(this->pixelPtr(xBegin, y), 0, (xEnd - xBegin) * this->getBytesPerPixel()); //0 means infinitely far in every format
+	this->tileGenerations[y * this->tilesPerRow + tileX] = this->currentGeneration;
+}
+
 FloatPack16 ZBuffer::toRealDist(const FloatPack16& values)
 {
 	return FloatPack16(-1) / values;
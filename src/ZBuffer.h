@@ -1,18 +1,206 @@
 #pragma once
 #include <vector>
+#include <string>
 
 #include "PixelBuffer.h"
+#include "IntPack16.h"
 #include "real.h"
+#include "misc/Enums.h"
 
-class ZBuffer : public PixelBuffer<real>
+//Stores depth as zInv (fovMult / z), in one of several formats. The 16 and 24 bit formats store zInv normalized by the closest value expected in the buffer (see setDepthRange),
+//with larger values meaning closer, so that 0 means infinitely far for every format. All accessors take and return zInv as floats regardless of the storage format.
+class ZBuffer
 {
 public:
 	ZBuffer() = default;
-	ZBuffer(int w, int h);
+	ZBuffer(int w, int h, DepthFormat format = DepthFormat::FLOAT32);
+
+	int getW() const;
+	int getH() const;
+	const PixelBufferSize& getSize() const;
+	DepthFormat getFormat() const;
+	size_t getBytesPerPixel() const;
+
+	void setDepthRange(real closestZInv); //values closer than closestZInv get clamped to it. Ignored by FLOAT32
+	real getDepthRange() const;
+	real getPixel(int x, int y) const; //does not perform bounds checks
+	void setPixel(int x, int y, real depth);
 	bool test(int x, int y, real depth);
 	bool testAndSet(int x, int y, real depth, bool doWrite = true); //the doWrite flag is for transparent pixels, they can still be occluded, but will not occlude others
 
-	Color toColor(real value) const override;
+	__mmask16 checkBounds(__m512 x, __m512 y) const;
+	FloatPack16 getPixels16(size_t xStart, size_t y) const;
+	FloatPack16 gatherPixels16(__m512i x, __m512i y, __mmask16 mask) const;
+	void setPixels16(size_t xStart, size_t y, const FloatPack16& depths, __mmask16 mask); //keeps the stencil bits of UNORM24_S8 intact
+	Mask16 testAndSet16(size_t xStart, size_t y, const FloatPack16& depths, Mask16 mask, bool doWrite = true); //returns which of the masked pixels are closer than the stored ones
+
+	IntPack16 getStencil16(size_t xStart, size_t y) const; //UNORM24_S8 only
+	void setStencil16(size_t xStart, size_t y, const IntPack16& values, __mmask16 mask); //UNORM24_S8 only, values must fit into 8 bits
+
+	void saveToFile(const std::string& path) const;
+	const LargePageBuffer& getStorage() const;
+	uint8_t* getRawRow(size_t y); //getBytesPerPixel() * getW() bytes in the storage format, for serialization
+	const uint8_t* getRawRow(size_t y) const;
+	void firstTouch(Threadpool& threadpool); //see LargePageBuffer::firstTouch
+	Color toColor(real value) const;
 
 	static FloatPack16 toRealDist(const FloatPack16& values); //the Z buffer doesn't store real dist, but it's warped form, this one can be used to get real distance
-};
\ No newline at end of file
+
+	//Lazy clearing: every row is split into tiles tagged with the generation they were last cleared in. Starting a new generation invalidates all tiles at once,
+	//and a tile only gets cleared when it's first touched. Since tiles never span multiple rows, workers owning different rows never share a tile.
+	static constexpr int lazyClearTileW = 64;
+	void beginNewGeneration();
+	void ensureTilesCleared16(size_t xStart, size_t y); //clears tiles covering pixels xStart..xStart+15 of row y if they weren't touched in the current generation
+	bool isTileTouched(size_t tileX, size_t y) const;
+	int getTilesPerRow() const;
+	void resolveLazyClears(int minY, int maxY); //clears all untouched tiles in the rows, so that raw pixels can be read directly
+	void clearSpan(size_t y, size_t xBegin, size_t xEnd); //sets pixels xBegin..xEnd-1 of row y to infinitely far right away, without touching tile generations
+private:
+	static constexpr uint32_t unorm16Max = (1 << 16) - 1;
+	static constexpr uint32_t unorm24Max = (1 << 24) - 1;
+
+	PixelBufferSize size;
+	DepthFormat format = DepthFormat::FLOAT32;
+	LargePageBuffer store; //has 64 bytes of padding at the end, so that 16 pixel loads and gathers of narrow formats never read past it
+	real closestZInv = -1; //matches a camera with default FOV and near plane
+	real encodeMult = -1; //1 / closestZInv
+
+	std::vector<uint32_t> tileGenerations; //a fresh buffer is zero-filled, so all tiles start as cleared in generation 0
+	uint32_t currentGeneration = 0;
+	int tilesPerRow = 0;
+
+	void clearTile(size_t tileX, size_t y);
+	uint8_t* pixelPtr(size_t x, size_t y);
+	const uint8_t* pixelPtr(size_t x, size_t y) const;
+
+	IntPack16 encodeUnorm(const FloatPack16& depths, uint32_t maxValue) const; //returns zInv normalized to 0..maxValue
+	FloatPack16 decodeUnorm(const IntPack16& values, uint32_t maxValue) const;
+};
+
+inline uint8_t* ZBuffer::pixelPtr(size_t x, size_t y)
+{
+	return this->store.data() + (y * this->size.w + x) * this->getBytesPerPixel();
+}
+
+inline const uint8_t* ZBuffer::pixelPtr(size_t x, size_t y) const
+{
+	return this->store.data() + (y * this->size.w + x) * this->getBytesPerPixel();
+}
+
+inline size_t ZBuffer::getBytesPerPixel() const
+{
+	return this->format == DepthFormat::UNORM16 ? 2 : 4;
+}
+
+inline IntPack16 ZBuffer::encodeUnorm(const FloatPack16& depths, uint32_t maxValue) const
+{
+	FloatPack16 normalized = (depths * this->encodeMult).clamp(0.f, 1.f);
+	return _mm512_cvtps_epu32(normalized * float(maxValue));
+}
+
+inline FloatPack16 ZBuffer::decodeUnorm(const IntPack16& values, uint32_t maxValue) const
+{
+	return FloatPack16(_mm512_cvtepi32_ps(values.zmm)) * (this->closestZInv / maxValue);
+}
+
+inline FloatPack16 ZBuffer::getPixels16(size_t xStart, size_t y) const
+{
+	const uint8_t* p = this->pixelPtr(xStart, y);
+	switch (this->format)
+	{
+	case DepthFormat::UNORM16:
+		return this->decodeUnorm(_mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))), unorm16Max);
+	case DepthFormat::UNORM24_S8:
+		return this->decodeUnorm(_mm512_srli_epi32(_mm512_loadu_si512(p), 8), unorm24Max);
+	default:
+		return _mm512_loadu_ps(p);
+	}
+}
+
+inline FloatPack16 ZBuffer::gatherPixels16(__m512i x, __m512i y, __mmask16 mask) const
+{
+	__m512i indices = _mm512_add_epi32(x, _mm512_mullo_epi32(y, _mm512_set1_epi32(this->size.w)));
+	switch (this->format)
+	{
+	case DepthFormat::UNORM16:
+	{
+		__m512i raw = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indices, this->store.data(), 2); //reads 2 extra bytes, which is what the padding is for
+		return this->decodeUnorm(_mm512_and_si512(raw, _mm512_set1_epi32(0xFFFF)), unorm16Max);
+	}
+	case DepthFormat::UNORM24_S8:
+	{
+		__m512i raw = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indices, this->store.data(), 4);
+		return this->decodeUnorm(_mm512_srli_epi32(raw, 8), unorm24Max);
+	}
+	default:
+		return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, this->store.data(), 4);
+	}
+}
+
+inline void ZBuffer::setPixels16(size_t xStart, size_t y, const FloatPack16& depths, __mmask16 mask)
+{
+	assert(xStart < this->size.w);
+	assert(y < this->size.h);
+	uint8_t* p = this->pixelPtr(xStart, y);
+	switch (this->format)
+	{
+	case DepthFormat::UNORM16:
+		_mm256_mask_storeu_epi16(p, mask, _mm512_cvtepi32_epi16(this->encodeUnorm(depths, unorm16Max).zmm));
+		break;
+	case DepthFormat::UNORM24_S8:
+	{
+		__m512i stencil = _mm512_and_si512(_mm512_loadu_si512(p), _mm512_set1_epi32(0xFF));
+		__m512i packed = _mm512_or_si512(_mm512_slli_epi32(this->encodeUnorm(depths, unorm24Max).zmm, 8), stencil);
+		_mm512_mask_storeu_epi32(p, mask, packed);
+		break;
+	}
+	default:
+		_mm512_mask_storeu_ps(p, mask, depths);
+		break;
+	}
+}
+
+inline Mask16 ZBuffer::testAndSet16(size_t xStart, size_t y, const FloatPack16& depths, Mask16 mask, bool doWrite)
+{
+	uint8_t* p = this->pixelPtr(xStart, y);
+	Mask16 passed;
+	switch (this->format)
+	{
+	case DepthFormat::UNORM16:
+	{
+		//compare in the encoded domain, so the stored values never have to be converted to floats
+		IntPack16 encoded = this->encodeUnorm(depths, unorm16Max);
+		__m512i stored = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+		passed = mask & Mask16(_mm512_cmpgt_epu32_mask(encoded, stored));
+		if (doWrite) _mm256_mask_storeu_epi16(p, passed, _mm512_cvtepi32_epi16(encoded.zmm));
+		break;
+	}
+	case DepthFormat::UNORM24_S8:
+	{
+		__m512i stored = _mm512_loadu_si512(p);
+		__m512i encoded = _mm512_slli_epi32(this->encodeUnorm(depths, unorm24Max).zmm, 8);
+		passed = mask & Mask16(_mm512_cmpgt_epu32_mask(encoded, _mm512_andnot_si512(_mm512_set1_epi32(0xFF), stored)));
+		if (doWrite) _mm512_mask_storeu_epi32(p, passed, _mm512_or_si512(encoded, _mm512_and_si512(stored, _mm512_set1_epi32(0xFF))));
+		break;
+	}
+	default:
+		passed = mask & FloatPack16(_mm512_loadu_ps(p)) > depths;
+		if (doWrite) _mm512_mask_storeu_ps(p, passed, depths);
+		break;
+	}
+	return passed;
+}
+
+inline void ZBuffer::ensureTilesCleared16(size_t xStart, size_t y)
+{
+	size_t firstTile = xStart / lazyClearTileW;
+	size_t lastTile = std::min<size_t>((xStart + 15) / lazyClearTileW, this->tilesPerRow - 1);
+	uint32_t* generations = &this->tileGenerations[y * this->tilesPerRow];
+	if (generations[firstTile] != this->currentGeneration) this->clearTile(firstTile, y);
+	if (generations[lastTile] != this->currentGeneration) this->clearTile(lastTile, y);
+}
+
+inline bool ZBuffer::isTileTouched(size_t tileX, size_t y) const
+{
+	return this->tileGenerations[y * this->tilesPerRow + tileX] == this->currentGeneration;
+}
@@ -1,5 +1,6 @@
 #include "blitting.h"
 #include "Lehmer.h"
+#include "DitherTable.h"
 #include "avx_helpers.h"
 #include "IntPack16.h"
 
@@ -23,7 +24,7 @@ void blitting::lightIntoFrameBuffer(FloatColorBuffer& frameBuf, const PixelBuffe
 	}
 }
 
-void blitting::frameBufferIntoSurface(const FloatColorBuffer& frameBuf, SDL_Surface* surf, size_t minY, size_t maxY, const std::array<uint32_t, 4> shifts, const bool ditheringEnabled, const uint32_t ssaaMult, LehmerRNG& rngSource)
+void blitting::frameBufferIntoSurface(const FloatColorBuffer& frameBuf, SDL_Surface* surf, size_t minY, size_t maxY, const std::array<uint32_t, 4> shifts, const uint32_t ssaaMult, const DitheringContext& dithering)
 {
 	assert(frameBuf.getW() == surf->w * ssaaMult);
 	assert(frameBuf.getH() == surf->h * ssaaMult);
@@ -71,25 +72,35 @@ void blitting::frameBufferIntoSurface(const FloatColorBuffer& frameBuf, SDL_Surf
 			}
 			else screenPixels = frameBuf.getPixels16(dstX, dstY) * 255;
 
-			IntPack16 surfacePixels = 0;
-			for (int i = 0; i < 4; ++i)
-			{
-				IntPack16 channelValue = screenPixels[i].trunc(); //now lower bits of each epi32 contain values of channels
-				if (ditheringEnabled)
-				{
-					IntPack16 rngOut = rngSource.next();
-					FloatPack16 increaseThreshold = (screenPixels[i] - _mm512_floor_ps(screenPixels[i])) * float(UINT32_MAX);
-
-					Mask16 increaseMask = _mm512_cmplt_epu32_mask(rngOut, _mm512_cvttps_epu32(increaseThreshold));
-					channelValue += IntPack16(1, increaseMask);
-				}
+			IntPack16 surfacePixels = blitting::packPixels16(screenPixels, shifts, dithering, dstX, dstY);
+			surfacePixels.store(surfPixelsStart + dstY * w + dstX, loopBounds);
+		}
+	}
+}
 
-				surfacePixels |= channelValue.clamp(0, 255) << shifts[i];
+IntPack16 blitting::packPixels16(const VectorPack16& screenPixels, const std::array<uint32_t, 4>& shifts, const DitheringContext& dithering, size_t x, size_t y)
+{
+	IntPack16 surfacePixels = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		IntPack16 channelValue = screenPixels[i].trunc(); //now lower bits of each epi32 contain values of channels
+		if (dithering.enabled)
+		{
+			FloatPack16 fraction = screenPixels[i] - _mm512_floor_ps(screenPixels[i]);
+			Mask16 increaseMask;
+			if (dithering.mode == DitheringMode::LEHMER_RNG)
+			{
+				IntPack16 rngOut = dithering.rngSource->next();
+				increaseMask = _mm512_cmplt_epu32_mask(rngOut, _mm512_cvttps_epu32(fraction * float(UINT32_MAX)));
 			}
+			else increaseMask = fraction > dithering.table->getThresholds16(x, y, i, dithering.frameNumber);
 
-			surfacePixels.store(surfPixelsStart + dstY * w + dstX, loopBounds);
+			channelValue += IntPack16(1, increaseMask);
 		}
+
+		surfacePixels |= channelValue.clamp(0, 255) << shifts[i];
 	}
+	return surfacePixels;
 }
 
 void blitting::applyFog(FloatColorBuffer& frameBuf, const FloatColorBuffer& worldPos, Vec4 camPos, float fogIntensity, Vec4 fogColor, size_t minY, size_t maxY, FogEffectVersion fogEffectVersion)
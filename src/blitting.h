@@ -6,13 +6,26 @@
 #include "PixelBuffer.h"
 #include "FloatColorBuffer.h"
 #include "ZBuffer.h"
+#include "IntPack16.h"
 #include "misc/Enums.h"
 
 class LehmerRNG;
+class DitherTable;
 
 namespace blitting
 {
+	//everything needed to round float channel values to 8 bits. rngSource is only used in LEHMER_RNG mode, table and frameNumber - in the others
+	struct DitheringContext
+	{
+		bool enabled;
+		DitheringMode mode;
+		LehmerRNG* rngSource;
+		const DitherTable* table;
+		uint32_t frameNumber;
+	};
+
 	void lightIntoFrameBuffer(FloatColorBuffer& frameBuf, const PixelBuffer<real>& lightBuf, size_t minY, size_t maxY);
-	void frameBufferIntoSurface(const FloatColorBuffer& frameBuf, SDL_Surface* surf, size_t minY, size_t maxY, std::array<uint32_t, 4> shifts, bool ditheringEnabled, uint32_t ssaaMult, LehmerRNG& rngSource);
+	void frameBufferIntoSurface(const FloatColorBuffer& frameBuf, SDL_Surface* surf, size_t minY, size_t maxY, std::array<uint32_t, 4> shifts, uint32_t ssaaMult, const DitheringContext& dithering);
+	IntPack16 packPixels16(const VectorPack16& screenPixels, const std::array<uint32_t, 4>& shifts, const DitheringContext& dithering, size_t x, size_t y); //screenPixels must be in 0-255 range, x and y are the surface coordinates of the first pixel. Returns pixels packed according to shifts, ready to be put into a surface
 	void applyFog(FloatColorBuffer& frameBuf, const FloatColorBuffer& worldPos, Vec4 camPos, float fogIntensity, Vec4 fogColor, size_t minY, size_t maxY, FogEffectVersion fogEffectVersion);
 }
\ No newline at end of file
@@ -76,7 +76,7 @@ std::map<std::string, std::string> parseCmdArgs(int argc, char** argv)
 	if (argc < 2) return {}; //argv[0] is out exe path, so it's meaningless to try and parse something else
 
 	std::map<std::string, std::string> ret;
-	std::unordered_set<std::string> validKeys = { "benchmark", "threads", "wnd_w", "wnd_h"};
+	std::unordered_set<std::string> validKeys = { "benchmark", "threads", "wnd_w", "wnd_h", "lights"};
 
 	for (int i = 1; i < argc; ++i) //skip our executable path
 	{
@@ -89,7 +89,7 @@ std::map<std::string, std::string> parseCmdArgs(int argc, char** argv)
 		else 
 		{
 			argName = argName.substr(2);
-			if ((argName == "threads" || argName == "wnd_w" || argName == "wnd_h") && argc > i + 1) ret[argName] = argv[i++ + 1];
+			if ((argName == "threads" || argName == "wnd_w" || argName == "wnd_h" || argName == "lights") && argc > i + 1) ret[argName] = argv[i++ + 1];
 			if (argName == "benchmark") ret[argName] = "true";
 		}
 		
@@ -161,6 +161,7 @@ void program(int argc, char** argv)
 	initData.wnd = wnd;
 	initData.argc = argc;
 	initData.argv = argv;
+	initData.args = args;
 	initData.threadpool = threadpool.get();
 
 	if (benchmarkMode) currGameState = std::make_shared<BenchmarkState>(initData);
@@ -14,6 +14,54 @@ enum class SkyRenderingMode : uint32_t
 	COUNT
 };
 
+enum class DitheringMode
+{
+	LEHMER_RNG,
+	BLUE_NOISE,
+	ORDERED,
+	COUNT
+};
+
+enum class DepthFormat
+{
+	FLOAT32,
+	UNORM16,
+	UNORM24_S8, //24 bits of depth in the upper bits, 8 bits of stencil/ID in the lower ones
+	COUNT
+};
+
+enum class ShadowMode
+{
+	FIXED_SUN, //one huge shadow map covering the whole level
+	CASCADED, //a few small shadow maps fitted to the view frustum
+	BAKED, //sun visibility baked into per model lightmaps from the fixed sun map, which is used until they are ready
+	COUNT
+};
+
+enum class ShadowPass
+{
+	INLINE, //shadow maps are sampled for every shaded fragment
+	DEFERRED, //shadow maps are sampled once per screen pixel after depth is final
+	DEFERRED_HALF_RES, //same, but at half resolution in both axes, upsampled using depth
+	COUNT
+};
+
+enum class SurfaceOrientation
+{
+	ANY,
+	VERTICAL, //walls, depth is constant along screen columns while the camera doesn't pitch
+	HORIZONTAL, //floors and ceilings, depth is constant along screen rows while the camera doesn't roll
+	COUNT
+};
+
+enum class SectorCullingMode
+{
+	NONE,
+	BSP, //front to back BSP walk, occluded by solid walls
+	PORTALS, //flood through the openings of two sided linedefs, clipping the screen window at each
+	COUNT
+};
+
 enum class FogEffectVersion
 {
 	//DISABLED,
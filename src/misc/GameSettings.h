@@ -17,6 +17,10 @@ struct GameSettings
 
 	WheelAdjustmentMode wheelAdjMod = WheelAdjustmentMode::FLY_SPEED;
 	SkyRenderingMode skyRenderingMode = SkyRenderingMode::SPHERE;
+	DitheringMode ditheringMode = DitheringMode::BLUE_NOISE;
+	ShadowMode shadowMode = ShadowMode::CASCADED;
+	ShadowPass shadowPass = ShadowPass::DEFERRED;
+	SectorCullingMode sectorCullingMode = SectorCullingMode::BSP;
 
 	bool fogEnabled = false;
 	bool mouseCaptured = false;
@@ -25,6 +29,10 @@ struct GameSettings
 	bool bufferCleaningEnabled = false;
 	bool performanceMonitorDisplayEnabled = true;
 	bool ditheringEnabled = true;
+	bool directSurfaceOutputEnabled = true;
+	bool pointLightsEnabled = false;
+	bool rejectCullingEnabled = true;
+	bool sectorAnimationEnabled = false; //doors and lifts of Doom maps open and close on their own
 
 	int ssaaMult;
 